@@ -0,0 +1,455 @@
+#ifndef _ARBITRAGE_ENGINE_H
+#define _ARBITRAGE_ENGINE_H
+
+#include "cost_model.h"
+#include "exchange_api.h"
+#include "opportunity_cache.h"
+
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * Crossed market between two venues: buying at `buy_exchange`'s best offer and selling
+ * at `sell_exchange`'s best bid makes `spread` per unit.
+ */
+struct arbitrage_opportunity_t
+{
+    uint32_t       pair_id;
+    exchange_api_t buy_exchange;
+    exchange_api_t sell_exchange;
+    double         buy_price;     // best ask of `buy_exchange`
+    double         buy_quantity;
+    double         sell_price;    // best bid of `sell_exchange`
+    double         sell_quantity;
+    double         quantity;      // size to trade on both legs
+    double         buy_limit;     // limit price of the buy leg, the worst ask `quantity` reaches
+    double         sell_limit;    // limit price of the sell leg, the worst bid `quantity` reaches
+    double         spread;        // sell_price - buy_price
+    double         profit;        // of `quantity` across the crossed levels, before costs
+    double         net_profit;    // after fees when there is a cost model, otherwise `profit`
+    int64_t        recv_ns;       // receive time of the quote that triggered it
+};
+
+/**
+ * Result of `sweep_crossed_depth`.
+ */
+struct depth_sweep_t
+{
+    double quantity      {0};
+    double buy_limit     {0};
+    double buy_notional  {0};
+    double sell_limit    {0};
+    double sell_notional {0};
+
+    double profit() const
+    { return sell_notional - buy_notional; }
+};
+
+/**
+ * Profit maximizing size to buy out of `asks` (ascending prices) and sell into `bids`
+ * (descending prices), as one order per leg.
+ *
+ * Walks both ladders' cumulative depth together like a merge of two sorted lists: each
+ * step fills the smaller of the two remaining level quantities and stops at the first
+ * pair of levels that no longer cross. The marginal profit only shrinks along the walk,
+ * so the whole crossed region is the optimum. The limit prices are the last levels
+ * reached on each side.
+ *
+ * With taker fees, levels only cross while bid * (1 - sell_fee) > ask * (1 + buy_fee).
+ */
+inline depth_sweep_t sweep_crossed_depth(const orderbook_t::order_t* asks, size_t ask_count,
+                                         const orderbook_t::order_t* bids, size_t bid_count,
+                                         double buy_fee = 0, double sell_fee = 0)
+{
+    depth_sweep_t sweep;
+    const double buy_cost      = 1 + buy_fee;
+    const double sell_proceeds = 1 - sell_fee;
+    if (!ask_count || !bid_count || bids[0].first * sell_proceeds <= asks[0].first * buy_cost)
+        return sweep;
+
+    // a scalar merge over the (at most guarded) levels, it stops at the first pair that no longer crosses
+    size_t i = 0, j = 0;
+    double ask_left = asks[0].second;
+    double bid_left = bids[0].second;
+    while (i < ask_count && j < bid_count && bids[j].first * sell_proceeds > asks[i].first * buy_cost)
+    {
+        const double quantity = ask_left < bid_left ? ask_left : bid_left;
+        sweep.quantity      += quantity;
+        sweep.buy_notional  += quantity * asks[i].first;
+        sweep.sell_notional += quantity * bids[j].first;
+        sweep.buy_limit      = asks[i].first;
+        sweep.sell_limit     = bids[j].first;
+
+        ask_left -= quantity;
+        bid_left -= quantity;
+        if (ask_left <= 0 && ++i < ask_count)
+            ask_left = asks[i].second;
+        if (bid_left <= 0 && ++j < bid_count)
+            bid_left = bids[j].second;
+    }
+    return sweep;
+}
+
+struct arbitrage_config_t
+{
+    double  min_spread_bps {0}; // minimum spread relative to the buy price, in basis points
+    int64_t max_age_ns     {0}; // ignore quotes received this much before the triggering one, 0 to disable
+    bool    sweep_depth    {true}; // size opportunities over the guarded levels of both books, see `sweep_crossed_depth`
+    double  min_profit     {0};    // net of fees, only with a cost model
+    int64_t cooldown_ns    {0};    // report the same crossing (venues and prices) at most this often, 0 to disable
+    int64_t forget_ns      {0};    // a crossing not seen for this long counts as new again, at least `cooldown_ns`
+};
+
+/**
+ * Tracks the best bid/offer of every (pair, venue) in flat arrays and reports crossed
+ * markets as books change.
+ *
+ * Each pair keeps its venues in one contiguous row along with the venues holding the two
+ * best bids and the two best offers, so an update re-evaluates only the two crossings it
+ * can affect (its bid against the best other offer, its offer against the best other bid)
+ * in O(1). A row is rescanned only when a venue that held one of the two best prices
+ * backs off.
+ *
+ * There is one writer: callers feeding it from several feed threads must serialize
+ * `on_book`, see `ArbritrageTrader`. Nothing is logged or allocated once the pairs are
+ * registered.
+ */
+class arbitrage_engine_t
+{
+public:
+    typedef std::function<void(const arbitrage_opportunity_t&)> handler_t;
+
+    static constexpr const size_t MAX_VENUES = 8;
+    static_assert(MAX_VENUES <= cost_model_t::MAX_VENUES, "the cost model must cover every venue of the engine");
+    static constexpr const size_t OPPORTUNITY_CACHE_SIZE = 1024;
+
+    arbitrage_engine_t(const arbitrage_config_t& config = {})
+        : m_config{config}, m_handler{}, m_costs{nullptr}, m_rejected{0},
+          m_recent{OPPORTUNITY_CACHE_SIZE, config.cooldown_ns, config.forget_ns}, m_pair_ids{}, m_pairs{}, m_quotes{}, m_rows{}, m_asks{}, m_bids{}
+    {
+        m_asks.reserve(orderbook_t::GUARDED_SUBSET_SIZE);
+        m_bids.reserve(orderbook_t::GUARDED_SUBSET_SIZE);
+    }
+
+    void set_handler(handler_t handler)
+    { m_handler = std::move(handler); }
+
+    /**
+     * Check opportunities against fees, lot/tick sizes, minimums and balances before
+     * reporting them, see `cost_model_t::apply`. `costs` must use the same pair ids, cover
+     * every pair registered (now and later) and outlive the engine.
+     */
+    void set_cost_model(const cost_model_t* costs)
+    {
+        if (costs && costs->pairs() < m_pairs.size())
+            throw std::invalid_argument("cost model has fewer pairs than the arbitrage engine");
+        m_costs = costs;
+    }
+
+    /**
+     * Crossed markets the cost model turned down.
+     */
+    uint64_t rejected() const
+    { return m_rejected; }
+
+    /**
+     * Repeats of a reported crossing held back by `cooldown_ns`.
+     */
+    uint64_t suppressed() const
+    { return m_recent.suppressed(); }
+
+    /**
+     * Register `pair`, returns its id. Not thread-safe, call before feeding books.
+     */
+    uint32_t add_pair(const instrument_pair_t& pair)
+    {
+        auto [it, inserted] = m_pair_ids.try_emplace(instrument_pair::hash(pair), static_cast<uint32_t>(m_pairs.size()));
+        if (!inserted)
+            return it->second;
+
+        if (m_costs && m_pairs.size() >= m_costs->pairs())
+        {
+            m_pair_ids.erase(it);
+            throw std::invalid_argument("cost model has no room for another pair");
+        }
+        m_pairs.push_back(pair);
+        m_quotes.resize(m_pairs.size() * MAX_VENUES);
+        m_rows.resize(m_pairs.size());
+        return it->second;
+    }
+
+    /**
+     * Id of a registered pair, -1 if unknown.
+     */
+    int64_t pair_id(const instrument_pair_t& pair) const
+    {
+        auto it = m_pair_ids.find(instrument_pair::hash(pair));
+        return it == m_pair_ids.end() ? -1 : static_cast<int64_t>(it->second);
+    }
+
+    const instrument_pair_t& pair(uint32_t pair_id) const
+    { return m_pairs.at(pair_id); }
+
+    /**
+     * Take in the current best bid/offer of `book` and report the crossings it creates,
+     * returns the number of opportunities found.
+     */
+    size_t on_book(const orderbook_t& book)
+    {
+        auto it = m_pair_ids.find(instrument_pair::hash(book.pair));
+        if (it == m_pair_ids.end())
+            return 0;
+        return on_quote(it->second, book.exchange, book.top_of_book(), &book);
+    }
+
+    /**
+     * `book`, when given, provides the depth for `sweep_depth` until the venue's next quote.
+     */
+    size_t on_quote(uint32_t pair_id, exchange_api_t exchange, const orderbook_t::top_of_book_t& top,
+                    const orderbook_t* book = nullptr)
+    {
+        const size_t venue = static_cast<size_t>(exchange);
+        if (venue >= MAX_VENUES || pair_id >= m_pairs.size())
+            return 0;
+
+        quote_t* quotes = &m_quotes[pair_id * MAX_VENUES];
+        row_t&   row    = m_rows[pair_id];
+
+        quote_t& quote = quotes[venue];
+        const double old_bid = quote.bid_price;
+        const double old_ask = quote.ask_price;
+        quote.bid_price    = top.bid_quantity > 0 ? top.bid_price : 0.0;
+        quote.bid_quantity = top.bid_quantity;
+        quote.ask_price    = top.ask_quantity > 0 ? top.ask_price : 0.0;
+        quote.ask_quantity = top.ask_quantity;
+        quote.recv_ns      = top.recv_ns;
+        quote.book         = book;
+        row.venues        |= 1u << venue;
+
+        update_best_bids(quotes, row, venue, old_bid);
+        update_best_asks(quotes, row, venue, old_ask);
+
+        size_t found = 0;
+
+        // sell into this venue's bid, buy the best offer elsewhere
+        const int buy_venue = row.best_ask[0] != static_cast<int>(venue) ? row.best_ask[0] : row.best_ask[1];
+        if (buy_venue >= 0 && quote.bid_price > 0)
+            found += check(pair_id, quotes, buy_venue, venue, top.recv_ns);
+
+        // buy this venue's offer, sell into the best bid elsewhere
+        const int sell_venue = row.best_bid[0] != static_cast<int>(venue) ? row.best_bid[0] : row.best_bid[1];
+        if (sell_venue >= 0 && quote.ask_price > 0)
+            found += check(pair_id, quotes, venue, sell_venue, top.recv_ns);
+
+        return found;
+    }
+
+private:
+    struct quote_t
+    {
+        double  bid_price    {0}; // 0 when the side is empty
+        double  bid_quantity {0};
+        double  ask_price    {0};
+        double  ask_quantity {0};
+        int64_t recv_ns      {0};
+        const orderbook_t* book {nullptr};
+    };
+
+    struct row_t
+    {
+        int      best_bid[2] {-1, -1}; // venues with the highest bids
+        int      best_ask[2] {-1, -1}; // venues with the lowest offers
+        uint32_t venues      {0};      // bitmask of venues with a quote
+    };
+
+    arbitrage_config_t                     m_config;
+    handler_t                              m_handler;
+    const cost_model_t*                    m_costs;
+    uint64_t                               m_rejected;
+    opportunity_cache_t                    m_recent;
+    std::unordered_map<uint64_t, uint32_t> m_pair_ids;
+    std::vector<instrument_pair_t>         m_pairs;
+    std::vector<quote_t>                   m_quotes; // MAX_VENUES quotes per pair
+    std::vector<row_t>                     m_rows;
+    std::vector<orderbook_t::order_t>      m_asks; // scratch copies of the guarded levels
+    std::vector<orderbook_t::order_t>      m_bids;
+
+    static bool better_bid(const quote_t* quotes, int lhs, int rhs)
+    { return rhs < 0 || quotes[lhs].bid_price > quotes[rhs].bid_price; }
+
+    static bool better_ask(const quote_t* quotes, int lhs, int rhs)
+    { return rhs < 0 || (quotes[lhs].ask_price > 0 && (quotes[rhs].ask_price == 0 || quotes[lhs].ask_price < quotes[rhs].ask_price)); }
+
+    void update_best_bids(const quote_t* quotes, row_t& row, size_t venue, double old_price)
+    {
+        const int v = static_cast<int>(venue);
+        const bool held = row.best_bid[0] == v || row.best_bid[1] == v;
+        if (held && quotes[venue].bid_price < old_price)
+        {
+            // backed off from a best price, the runner up may be anywhere in the row
+            rescan(quotes, row.venues, row.best_bid, &arbitrage_engine_t::better_bid, [](const quote_t& q) { return q.bid_price > 0; });
+            return;
+        }
+        if (quotes[venue].bid_price <= 0)
+            return;
+
+        if (row.best_bid[0] == v)
+            return;
+        if (better_bid(quotes, v, row.best_bid[0]))
+        {
+            row.best_bid[1] = row.best_bid[0];
+            row.best_bid[0] = v;
+        }
+        else if (row.best_bid[1] == v || better_bid(quotes, v, row.best_bid[1]))
+        {
+            row.best_bid[1] = v;
+        }
+    }
+
+    void update_best_asks(const quote_t* quotes, row_t& row, size_t venue, double old_price)
+    {
+        const int v = static_cast<int>(venue);
+        const bool held = row.best_ask[0] == v || row.best_ask[1] == v;
+        if (held && (quotes[venue].ask_price == 0 || quotes[venue].ask_price > old_price))
+        {
+            rescan(quotes, row.venues, row.best_ask, &arbitrage_engine_t::better_ask, [](const quote_t& q) { return q.ask_price > 0; });
+            return;
+        }
+        if (quotes[venue].ask_price <= 0)
+            return;
+
+        if (row.best_ask[0] == v)
+            return;
+        if (better_ask(quotes, v, row.best_ask[0]))
+        {
+            row.best_ask[1] = row.best_ask[0];
+            row.best_ask[0] = v;
+        }
+        else if (row.best_ask[1] == v || better_ask(quotes, v, row.best_ask[1]))
+        {
+            row.best_ask[1] = v;
+        }
+    }
+
+    template <typename Valid>
+    static void rescan(const quote_t* quotes, uint32_t venues, int (&best)[2], bool (*better)(const quote_t*, int, int), Valid valid)
+    {
+        best[0] = best[1] = -1;
+        for (int v = 0; v < static_cast<int>(MAX_VENUES); ++v)
+        {
+            if (!(venues & (1u << v)) || !valid(quotes[v]))
+                continue;
+            if (better(quotes, v, best[0]))
+            {
+                best[1] = best[0];
+                best[0] = v;
+            }
+            else if (better(quotes, v, best[1]))
+            {
+                best[1] = v;
+            }
+        }
+    }
+
+    size_t check(uint32_t pair_id, const quote_t* quotes, size_t buy_venue, size_t sell_venue, int64_t recv_ns)
+    {
+        const quote_t& buy  = quotes[buy_venue];
+        const quote_t& sell = quotes[sell_venue];
+        if (buy.ask_price <= 0 || sell.bid_price <= buy.ask_price)
+            return 0;
+
+        const int64_t oldest = buy.recv_ns < sell.recv_ns ? buy.recv_ns : sell.recv_ns;
+        if (m_config.max_age_ns && recv_ns - oldest > m_config.max_age_ns)
+            return 0;
+
+        const double spread = sell.bid_price - buy.ask_price;
+        if (spread * 1e4 < m_config.min_spread_bps * buy.ask_price)
+            return 0;
+
+        const exchange_api_t buy_exchange  = static_cast<exchange_api_t>(buy_venue);
+        const exchange_api_t sell_exchange = static_cast<exchange_api_t>(sell_venue);
+        venue_costs_t buy_costs, sell_costs;
+        if (m_costs)
+        {
+            buy_costs  = m_costs->get(pair_id, buy_exchange);
+            sell_costs = m_costs->get(pair_id, sell_exchange);
+            if (sell.bid_price * (1 - sell_costs.taker_fee) <= buy.ask_price * (1 + buy_costs.taker_fee))
+            {
+                ++m_rejected;
+                return 0;
+            }
+        }
+
+        arbitrage_opportunity_t opportunity;
+        opportunity.pair_id       = pair_id;
+        opportunity.buy_exchange  = buy_exchange;
+        opportunity.sell_exchange = sell_exchange;
+        opportunity.buy_price     = buy.ask_price;
+        opportunity.buy_quantity  = buy.ask_quantity;
+        opportunity.sell_price    = sell.bid_price;
+        opportunity.sell_quantity = sell.bid_quantity;
+        opportunity.quantity      = buy.ask_quantity < sell.bid_quantity ? buy.ask_quantity : sell.bid_quantity;
+        opportunity.buy_limit     = buy.ask_price;
+        opportunity.sell_limit    = sell.bid_price;
+        opportunity.spread        = spread;
+        opportunity.profit        = spread * opportunity.quantity;
+
+        double buy_notional  = opportunity.quantity * buy.ask_price;
+        double sell_notional = opportunity.quantity * sell.bid_price;
+        if (m_config.sweep_depth && buy.book && sell.book)
+        {
+            buy.book->copy_guarded_asks(m_asks);
+            sell.book->copy_guarded_bids(m_bids);
+            const depth_sweep_t sweep = sweep_crossed_depth(m_asks.data(), m_asks.size(), m_bids.data(), m_bids.size(),
+                                                            buy_costs.taker_fee, sell_costs.taker_fee);
+            // the levels can lag a direct top of book quote, only trust them when they go further
+            if (sweep.quantity > opportunity.quantity)
+            {
+                opportunity.quantity   = sweep.quantity;
+                opportunity.buy_limit  = sweep.buy_limit;
+                opportunity.sell_limit = sweep.sell_limit;
+                opportunity.profit     = sweep.profit();
+                buy_notional           = sweep.buy_notional;
+                sell_notional          = sweep.sell_notional;
+            }
+        }
+
+        opportunity.net_profit = opportunity.profit;
+        if (m_costs)
+        {
+            trade_plan_t plan;
+            if (!cost_model_t::apply(buy_costs, sell_costs, opportunity.quantity, opportunity.buy_limit, opportunity.sell_limit,
+                                     buy_notional, sell_notional, m_config.min_profit, plan))
+            {
+                ++m_rejected;
+                return 0;
+            }
+            // valued at the average prices of the full sweep, like the net profit
+            opportunity.profit     = plan.quantity * (sell_notional - buy_notional) / opportunity.quantity;
+            opportunity.quantity   = plan.quantity;
+            opportunity.buy_limit  = plan.buy_limit;
+            opportunity.sell_limit = plan.sell_limit;
+            opportunity.net_profit = plan.net_profit;
+        }
+
+        if (m_config.cooldown_ns > 0)
+        {
+            const opportunity_key_t key {pair_id, static_cast<uint16_t>(buy_venue), static_cast<uint16_t>(sell_venue),
+                                         buy.ask_price, sell.bid_price};
+            if (!m_recent.admit(key, recv_ns))
+                return 0;
+        }
+
+        if (!m_handler)
+            return 1;
+        opportunity.recv_ns       = recv_ns;
+        m_handler(opportunity);
+        return 1;
+    }
+};
+
+#endif
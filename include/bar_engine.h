@@ -0,0 +1,506 @@
+#ifndef _BAR_ENGINE_H
+#define _BAR_ENGINE_H
+
+#include "seqlock.h"
+#include "trade_tape.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+
+/**
+ * OHLCV bar covering [start_ms, end_ms). Inputs (klines, ticker prices, trades) are
+ * expressed as partial bars, a single price being a bar with start_ms == end_ms.
+ */
+struct bar_t
+{
+    int64_t  start_ms {0};
+    int64_t  end_ms   {0};
+    double   open     {0};
+    double   high     {0};
+    double   low      {0};
+    double   close    {0};
+    double   volume   {0}; // base volume
+    double   notional {0}; // quote volume
+    uint64_t trades   {0};
+
+    double vwap() const
+    { return volume > 0 ? notional / volume : close; }
+};
+
+enum class bar_source_t : int {
+    EXCHANGE, // klines/tickers pushed by the exchange
+    TRADES,   // the feed's own trade tape, see `set_trade_tape`
+    BOOK      // mid price of the local book whenever its best bid/offer changes, no volume
+};
+
+struct bar_config_t
+{
+    bool                              enabled      {false};
+    bar_source_t                      source       {bar_source_t::EXCHANGE};
+    std::vector<std::chrono::seconds> intervals    {std::chrono::seconds{1}, std::chrono::seconds{60}};
+    size_t                            history      {256}; // closed bars kept per interval
+    size_t                            ema_fast     {12};
+    size_t                            ema_slow     {26};
+    size_t                            stdev_period {20};
+    size_t                            rsi_period   {14};
+    size_t                            vwap_period  {20};
+};
+
+/**
+ * Indicators as of the last closed bar of an interval.
+ */
+struct bar_signal_t
+{
+    bar_t    bar;              // last closed bar
+    uint64_t bars       {0};   // bars closed so far
+    double   ema_fast   {0};
+    double   ema_slow   {0};
+    double   momentum   {0};   // (ema_fast - ema_slow) / ema_slow
+    double   volatility {0};   // stdev of close to close returns
+    double   rsi        {50};  // 0..100
+    double   vwap       {0};   // over the last `vwap_period` bars
+    bool     ready      {false}; // every indicator has seen its full period
+};
+
+/**
+ * Exponential moving average, seeded with the first value.
+ */
+struct ema_t
+{
+    double alpha  {1};
+    double value  {0};
+    size_t count  {0};
+    size_t period {1};
+
+    void configure(size_t n)
+    {
+        period = std::max<size_t>(n, 1);
+        alpha  = 2.0 / (period + 1);
+        value  = 0;
+        count  = 0;
+    }
+
+    void update(double x)
+    {
+        value = count++ ? value + alpha * (x - value) : x;
+    }
+
+    bool ready() const
+    { return count >= period; }
+};
+
+/**
+ * Standard deviation over the last `period` values, running sums over a ring that are
+ * recomputed from scratch once per lap so rounding errors can't build up.
+ */
+struct rolling_stdev_t
+{
+    std::vector<double> ring;
+    size_t              next  {0};
+    size_t              count {0};
+    double              sum   {0};
+    double              sumsq {0};
+
+    void configure(size_t period)
+    {
+        ring.assign(std::max<size_t>(period, 2), 0.0);
+        next = count = 0;
+        sum = sumsq = 0;
+    }
+
+    void update(double x)
+    {
+        if (count == ring.size())
+        {
+            sum   -= ring[next];
+            sumsq -= ring[next] * ring[next];
+        }
+        else
+        {
+            ++count;
+        }
+        ring[next] = x;
+        sum   += x;
+        sumsq += x * x;
+
+        if (++next == ring.size())
+        {
+            next = 0;
+            sum = sumsq = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                sum   += ring[i];
+                sumsq += ring[i] * ring[i];
+            }
+        }
+    }
+
+    double value() const
+    {
+        if (count < 2)
+            return 0.0;
+        const double var = (sumsq - sum * sum / count) / (count - 1);
+        return var > 0 ? std::sqrt(var) : 0.0;
+    }
+
+    bool ready() const
+    { return count == ring.size(); }
+};
+
+/**
+ * Wilder's relative strength index.
+ */
+struct rsi_t
+{
+    size_t period   {14};
+    size_t count    {0};
+    double avg_gain {0};
+    double avg_loss {0};
+
+    void configure(size_t n)
+    {
+        period = std::max<size_t>(n, 1);
+        count  = 0;
+        avg_gain = avg_loss = 0;
+    }
+
+    void update(double change)
+    {
+        const double gain = change > 0 ? change : 0.0;
+        const double loss = change < 0 ? -change : 0.0;
+        if (count < period)
+        {
+            // plain average until the first full period
+            ++count;
+            avg_gain += (gain - avg_gain) / count;
+            avg_loss += (loss - avg_loss) / count;
+            return;
+        }
+        avg_gain = (avg_gain * (period - 1) + gain) / period;
+        avg_loss = (avg_loss * (period - 1) + loss) / period;
+    }
+
+    double value() const
+    {
+        if (avg_loss == 0)
+            return avg_gain == 0 ? 50.0 : 100.0;
+        return 100.0 - 100.0 / (1.0 + avg_gain / avg_loss);
+    }
+
+    bool ready() const
+    { return count >= period; }
+};
+
+/**
+ * Volume weighted average price over the last `period` bars.
+ */
+struct rolling_vwap_t
+{
+    std::vector<std::pair<double, double>> ring; // notional, volume
+    size_t next     {0};
+    size_t count    {0};
+    double notional {0};
+    double volume   {0};
+    double last     {0};
+
+    void configure(size_t period)
+    {
+        ring.assign(std::max<size_t>(period, 1), {0.0, 0.0});
+        next = count = 0;
+        notional = volume = last = 0;
+    }
+
+    void update(const bar_t& bar)
+    {
+        if (count == ring.size())
+        {
+            notional -= ring[next].first;
+            volume   -= ring[next].second;
+        }
+        else
+        {
+            ++count;
+        }
+        ring[next] = {bar.notional, bar.volume};
+        notional += bar.notional;
+        volume   += bar.volume;
+        last      = bar.close;
+        next      = (next + 1) % ring.size();
+    }
+
+    double value() const
+    { return volume > 0 ? notional / volume : last; }
+
+    bool ready() const
+    { return count == ring.size(); }
+};
+
+/**
+ * Bars of one interval and the indicators over their closes. Everything is sized in
+ * `configure`, updates don't allocate.
+ *
+ * A bar closes as soon as an input reaches its end (eg. the kline covering its last
+ * second) or, failing that, when the first input of a later interval arrives. Intervals
+ * without any input produce no bar.
+ */
+class bar_series_t
+{
+public:
+    bar_series_t()
+        : m_interval_ms{0}, m_current{}, m_open{false}, m_history{}, m_next{0}, m_count{0},
+          m_ema_fast{}, m_ema_slow{}, m_stdev{}, m_rsi{}, m_vwap{}, m_signal{}, m_published{}
+    { }
+
+    bar_series_t(const bar_series_t&) = delete;
+    bar_series_t& operator=(const bar_series_t&) = delete;
+
+    void configure(int64_t interval_ms, const bar_config_t& config)
+    {
+        if (interval_ms <= 0)
+            throw std::invalid_argument("bar interval must be positive");
+
+        m_interval_ms = interval_ms;
+        m_open        = false;
+        m_history.assign(std::max<size_t>(config.history, 1), bar_t{});
+        m_next = m_count = 0;
+        m_ema_fast.configure(config.ema_fast);
+        m_ema_slow.configure(config.ema_slow);
+        m_stdev.configure(config.stdev_period);
+        m_rsi.configure(config.rsi_period);
+        m_vwap.configure(config.vwap_period);
+        m_signal = bar_signal_t{};
+        m_published.store(m_signal);
+    }
+
+    /**
+     * Merge a partial bar, returns true if a bar was closed.
+     */
+    bool update(const bar_t& part)
+    {
+        const int64_t start = part.start_ms - part.start_ms % m_interval_ms;
+        bool closed = false;
+        if (m_open && start != m_current.start_ms)
+        {
+            if (start < m_current.start_ms)
+                return false; // late input for a bar that is already closed
+            close_bar();
+            closed = true;
+        }
+
+        if (!m_open)
+        {
+            m_current          = part;
+            m_current.start_ms = start;
+            m_current.end_ms   = start + m_interval_ms;
+            m_open             = true;
+        }
+        else
+        {
+            m_current.high      = std::max(m_current.high, part.high);
+            m_current.low       = std::min(m_current.low, part.low);
+            m_current.close     = part.close;
+            m_current.volume   += part.volume;
+            m_current.notional += part.notional;
+            m_current.trades   += part.trades;
+        }
+
+        if (part.end_ms >= m_current.end_ms)
+        {
+            close_bar();
+            closed = true;
+        }
+        return closed;
+    }
+
+    int64_t interval_ms() const
+    { return m_interval_ms; }
+
+    /**
+     * Indicators as of the last closed bar, safe to call from any thread.
+     */
+    bar_signal_t signal() const
+    { return m_published.load(); }
+
+    /**
+     * Number of closed bars kept, writer thread only.
+     */
+    size_t size() const
+    { return m_count; }
+
+    /**
+     * `i`-th most recent closed bar, 0 being the last one. Writer thread only.
+     */
+    const bar_t& bar(size_t i) const
+    { return m_history[(m_next + m_history.size() - 1 - i) % m_history.size()]; }
+
+    /**
+     * The bar still being built, writer thread only.
+     */
+    const bar_t* forming() const
+    { return m_open ? &m_current : nullptr; }
+
+private:
+    int64_t            m_interval_ms;
+    bar_t              m_current;
+    bool               m_open;
+    std::vector<bar_t> m_history;
+    size_t             m_next;
+    size_t             m_count;
+
+    ema_t              m_ema_fast;
+    ema_t              m_ema_slow;
+    rolling_stdev_t    m_stdev;
+    rsi_t              m_rsi;
+    rolling_vwap_t     m_vwap;
+
+    bar_signal_t           m_signal;    // writer's copy of `m_published`
+    seqlock<bar_signal_t>  m_published;
+
+    void close_bar()
+    {
+        m_open = false;
+
+        const bool has_previous = m_signal.bars > 0;
+        const double previous_close = m_signal.bar.close;
+
+        m_history[m_next] = m_current;
+        m_next  = (m_next + 1) % m_history.size();
+        m_count = std::min(m_count + 1, m_history.size());
+
+        m_ema_fast.update(m_current.close);
+        m_ema_slow.update(m_current.close);
+        m_vwap.update(m_current);
+        if (has_previous && previous_close > 0)
+        {
+            m_stdev.update(m_current.close / previous_close - 1.0);
+            m_rsi.update(m_current.close - previous_close);
+        }
+
+        m_signal.bar        = m_current;
+        m_signal.bars      += 1;
+        m_signal.ema_fast   = m_ema_fast.value;
+        m_signal.ema_slow   = m_ema_slow.value;
+        m_signal.momentum   = m_ema_slow.value > 0 ? (m_ema_fast.value - m_ema_slow.value) / m_ema_slow.value : 0.0;
+        m_signal.volatility = m_stdev.value();
+        m_signal.rsi        = m_rsi.value();
+        m_signal.vwap       = m_vwap.value();
+        m_signal.ready      = m_ema_fast.ready() && m_ema_slow.ready() && m_stdev.ready()
+                              && m_rsi.ready() && m_vwap.ready();
+        m_published.store(m_signal);
+    }
+};
+
+/**
+ * Builds bars at several intervals out of one stream of inputs, see `bar_series_t`.
+ * There is one writer, the thread applying the pair's book updates.
+ */
+class bar_engine_t
+{
+public:
+    static constexpr const size_t MAX_INTERVALS = 4;
+
+    bar_engine_t()
+        : m_source{bar_source_t::EXCHANGE}, m_intervals{0}, m_series{}
+    { }
+
+    bar_engine_t(const bar_engine_t&) = delete;
+    bar_engine_t& operator=(const bar_engine_t&) = delete;
+
+    /**
+     * Not thread-safe, a disabled config drops every interval.
+     */
+    void configure(const bar_config_t& config)
+    {
+        if (config.intervals.size() > MAX_INTERVALS)
+            throw std::invalid_argument("too many bar intervals");
+
+        m_source    = config.source;
+        m_intervals = config.enabled ? config.intervals.size() : 0;
+        for (size_t i = 0; i < m_intervals; ++i)
+            m_series[i].configure(std::chrono::duration_cast<std::chrono::milliseconds>(config.intervals[i]).count(), config);
+    }
+
+    /**
+     * Kline or ticker from the exchange, returns true if any bar closed.
+     */
+    bool on_bar(const bar_t& part)
+    {
+        if (m_source != bar_source_t::EXCHANGE)
+            return false;
+        return update(part);
+    }
+
+    /**
+     * Trades from the tape, returns true if any bar closed.
+     */
+    bool on_trades(const trade_t* trades, size_t n)
+    {
+        if (m_source != bar_source_t::TRADES)
+            return false;
+
+        bool closed = false;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const trade_t& trade = trades[i];
+            bar_t part;
+            part.start_ms = part.end_ms = trade.time_ms;
+            part.open = part.high = part.low = part.close = trade.price;
+            part.volume   = trade.quantity;
+            part.notional = trade.price * trade.quantity;
+            part.trades   = 1;
+            closed |= update(part);
+        }
+        return closed;
+    }
+
+    /**
+     * Best bid/offer change of the local book at wall clock `time_ms`, returns true if any
+     * bar closed.
+     */
+    bool on_quote(double bid_price, double ask_price, int64_t time_ms)
+    {
+        if (m_source != bar_source_t::BOOK || bid_price <= 0 || ask_price <= 0)
+            return false;
+
+        bar_t part;
+        part.start_ms = part.end_ms = time_ms;
+        part.open = part.high = part.low = part.close = (bid_price + ask_price) / 2;
+        return update(part);
+    }
+
+    bar_source_t source() const
+    { return m_source; }
+
+    size_t intervals() const
+    { return m_intervals; }
+
+    const bar_series_t& series(size_t interval) const
+    { return m_series.at(interval); }
+
+    /**
+     * Indicators of `interval`, safe to call from any thread.
+     */
+    bar_signal_t signal(size_t interval) const
+    { return m_series.at(interval).signal(); }
+
+private:
+    bar_source_t                               m_source;
+    size_t                                     m_intervals;
+    std::array<bar_series_t, MAX_INTERVALS>    m_series;
+
+    bool update(const bar_t& part)
+    {
+        bool closed = false;
+        for (size_t i = 0; i < m_intervals; ++i)
+            closed |= m_series[i].update(part);
+        return closed;
+    }
+};
+
+#endif
@@ -6,10 +6,23 @@
 #include "crypto.h"
 #include "json.h"
 #include "requests.h"
+#include "feed_pipeline.h"
+#include "reactor_pool.h"
+#include "feed_arbiter.h"
+#include "feed_shard.h"
+#include "trade_tape.h"
+#include "thread_util.h"
 
 #include <thread>
 #include <string>
+#include <string_view>
 #include <cstring>
+#include <atomic>
+#include <cstdlib>
+#include <future>
+#include <mutex>
+#include <numeric>
+#include <algorithm>
 
 template <>
 class market_feed<binance_api>
@@ -20,57 +33,45 @@ public:
         : m_pairs {pairs}, m_streams {"depth@100ms", "kline_1s"},
           m_secret_key {secret_key},
           m_api_key {api_key},
-          m_socket{nullptr},
-          m_thread {nullptr},
-          m_stop_source {},
-          m_orderbooks{},
+          m_shards{},
+          m_connections{1},
+          m_sharding{},
+          m_reactor {nullptr},
+          m_reactor_index {0},
+          m_pipeline_config {},
+          m_placement {thread_config_t{}[thread_role::FEED]},
+          m_busy_poll {},
+          m_reconnect {},
+          m_transport {ws_transport_t::WEBSOCKETPP},
+          m_trade_tape {},
+          m_bars {},
+          m_subscription_mutex{},
+          m_request_id{0},
+          m_warmups{},
           m_handlers{},
-          m_raw_handlers{},
-          m_get_snapshot{true}
-    {
-        for (auto& pair : m_pairs)
-        {
-            m_orderbooks.emplace(std::piecewise_construct,
-                    std::forward_as_tuple(instrument_pair::to_binance(pair)),
-                    std::forward_as_tuple(pair, binance_api::exchange_api_id));
-        }
-    }
+          m_raw_handlers{}
+    { }
 
     void start_feed()
     {
-        if (m_thread && m_thread->joinable())
+        if (!m_shards.empty() && m_shards.front()->thread)
             throw std::runtime_error("start_feed called when another is already running in another thread");
 
-        std::stringstream uri {};
-        uri << binance_api::SOCKET_URI << "/stream?streams=";
-        for (auto i = 0; i < m_streams.size(); ++i)
-        {
-            const auto& stream = m_streams[i];
-            for (auto j = 0; j < m_pairs.size(); ++j)
-            {
-                uri << instrument_pair::to_binance_lower(m_pairs[j]) << "@" << stream;
-                if (j+1 != m_pairs.size() || i+1 != m_streams.size())
-                    uri << "/";
-            }
-        }
-
-        m_socket = std::make_unique<market_feed_socket>(uri.str(), 
-                std::bind(&market_feed<binance_api>::message_handler, this, std::placeholders::_1));
-
-        m_thread = std::make_unique<std::jthread>(&market_feed<binance_api>::_start_feed, this, m_stop_source.get_token());
+        create_shards();
+        for (auto& shard : m_shards)
+            shard->start(m_placement, m_busy_poll);
     }
 
     void join()
     {
-        if (m_thread)
-            m_thread->join();
+        for (auto& shard : m_shards)
+            shard->join();
     }
 
     void close()
     {
-        if (!m_socket) return;
-
-        m_socket->close();
+        for (auto& shard : m_shards)
+            shard->close();
     }
 
     void register_event_handler(const feed_event_t& ev, feed_event_handler_t handler)
@@ -83,98 +84,692 @@ public:
         m_raw_handlers.emplace_back(ev, handler, std::move(state));
     }
 
+    /**
+     * Run parsing and book updates on their own threads, see `feed_pipeline`.
+     * Must be called before `start_feed`. Event handlers are then invoked from the book worker
+     * threads, all events for a given pair come from the same worker. Every shard gets a
+     * pipeline of its own built from `config`.
+     */
+    void configure_pipeline(const pipeline_config_t& config)
+    {
+        if (config.book_workers == 0)
+            throw std::invalid_argument("feed pipeline needs at least one book worker");
+        m_pipeline_config = config;
+    }
+
+    const feed_pipeline& pipeline(size_t shard = 0) const
+    { return get_shard(shard).pipeline; }
+
+    /**
+     * Run the sockets on reactor `index` of `pool` instead of on threads of their own, shard
+     * `i` goes to reactor `index + i` (wrapping around).
+     * Must be called before `start_feed`, and the pool has to be running for the feed to connect.
+     */
+    void attach_to_reactor(reactor_pool& pool, size_t index)
+    {
+        m_reactor       = &pool;
+        m_reactor_index = index;
+    }
+
+    /**
+     * Placement of the threads running the sockets, shard `i` uses index `i` of the placement.
+     * Unused when attached to a reactor. Must be called before `start_feed`.
+     */
+    void set_thread_placement(const thread_placement_t& placement)
+    {
+        m_placement = placement;
+    }
+
+    /**
+     * Spin the feed thread on the socket instead of sleeping between frames, trading a
+     * core for lower wake-up latency. When attached to a reactor only the socket options
+     * apply, the reactor decides how it is run. Must be called before `start_feed`.
+     */
+    void set_busy_poll(const busy_poll_config_t& config)
+    {
+        m_busy_poll = config;
+    }
+
+    /**
+     * Heartbeat, stall detection and backoff for the supervised connection, see `market_feed_socket`.
+     * Must be called before `start_feed`.
+     */
+    void set_reconnect(const reconnect_config_t& config)
+    {
+        m_reconnect = config;
+    }
+
+    /**
+     * Websocket implementation used by the feed's connections. Must be called before `start_feed`.
+     */
+    void set_transport(ws_transport_t transport)
+    {
+        m_transport = transport;
+    }
+
+    const reconnect_stats_t& reconnect_stats(size_t connection = 0, size_t shard = 0) const
+    {
+        const feed_shard_t& s = get_shard(shard);
+        if (connection >= s.sockets.size())
+            throw std::out_of_range("no such connection");
+        return s.sockets[connection]->stats;
+    }
+
+    /**
+     * Open `connections` redundant connections carrying the same streams. Each update is
+     * applied from whichever connection delivers it first, so jitter on one connection is
+     * hidden by the others and losing one doesn't interrupt the books. All connections are
+     * driven by the same thread. Must be called before `start_feed`.
+     */
+    void set_redundant_connections(size_t connections)
+    {
+        if (connections == 0)
+            throw std::invalid_argument("feed needs at least one connection");
+        m_connections = connections;
+    }
+
+    const feed_arbiter& arbiter(size_t shard = 0) const
+    { return get_shard(shard).arbiter; }
+
+    /**
+     * Spread the pairs over several connections once a single one would carry more streams
+     * or messages than `config` allows, see `plan_shards`. Each shard has its own I/O thread
+     * (or reactor) and pipeline, handlers stay registered on the feed as a whole but may then
+     * be invoked concurrently for pairs of different shards. Must be called before `start_feed`.
+     */
+    void set_sharding(const shard_config_t& config)
+    {
+        if (!config.pair_rates.empty() && config.pair_rates.size() != m_pairs.size())
+            throw std::invalid_argument("pair_rates must have one entry per pair");
+        m_sharding = config;
+    }
+
+    size_t shards() const
+    { return m_shards.size(); }
+
+    /**
+     * Also subscribe to the `bookTicker` stream, which pushes every change of the best
+     * bid/offer in real time instead of with the 100ms batching of the depth stream. The
+     * quotes update `orderbook_t::top_of_book` and fire `BBO_UPDATED`, the depth stream then
+     * takes the top over again once it has caught up. Must be called before `start_feed`.
+     */
+    void set_book_ticker(bool enabled)
+    {
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        std::erase(m_streams, BOOK_TICKER_STREAM);
+        if (enabled)
+            m_streams.push_back(BOOK_TICKER_STREAM);
+    }
+
+    /**
+     * Record executed trades (`aggTrade`, or `trade` when not aggregated) on each book's
+     * `orderbook_t::trades` tape and fire `TRADES_UPDATED`. Must be called before `start_feed`.
+     */
+    void set_trade_tape(const trade_tape_config_t& config)
+    {
+        if (config.windows.size() > trade_flow_t::MAX_WINDOWS)
+            throw std::invalid_argument("too many trade windows");
+
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        std::erase(m_streams, TRADE_STREAM);
+        std::erase(m_streams, AGG_TRADE_STREAM);
+        if (config.enabled)
+            m_streams.push_back(config.aggregated ? AGG_TRADE_STREAM : TRADE_STREAM);
+        m_trade_tape = config;
+    }
+
+    /**
+     * Build OHLCV bars and momentum indicators on each book's `orderbook_t::bars`, firing
+     * `BARS_UPDATED` whenever a bar closes. `bar_source_t::EXCHANGE` bars are built out of
+     * the `kline_1s` stream, `TRADES` needs `set_trade_tape`. Must be called before `start_feed`.
+     */
+    void set_bars(const bar_config_t& config)
+    {
+        if (config.intervals.size() > bar_engine_t::MAX_INTERVALS)
+            throw std::invalid_argument("too many bar intervals");
+
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        m_bars = config;
+    }
+
+    /**
+     * Pairs currently handled by `shard`, only valid once started.
+     */
+    std::vector<instrument_pair_t> shard_pairs(size_t shard) const
+    { return get_shard(shard).pairs(); }
+
+    /**
+     * Add `pair` to the running feed with a SUBSCRIBE on the connections of the shard with
+     * the fewest pairs, leaving every other stream untouched. The book is snapshotted in the
+     * background, diffs received meanwhile are buffered and replayed on top of the snapshot,
+     * and it only publishes events once in sync. Before `start_feed` this just extends the
+     * pair set.
+     */
+    void subscribe(const instrument_pair_t& pair)
+    {
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        if (std::find(m_pairs.begin(), m_pairs.end(), pair) != m_pairs.end())
+            return;
+
+        if (m_sharding.pair_rates.size() == m_pairs.size() && !m_pairs.empty())
+        {
+            // no measurement yet, assume an average pair
+            const auto& rates = m_sharding.pair_rates;
+            m_sharding.pair_rates.push_back(std::accumulate(rates.begin(), rates.end(), 0.0) / rates.size());
+        }
+        m_pairs.push_back(pair);
+        if (m_shards.empty())
+            return;
+
+        feed_shard_t& shard = **std::min_element(m_shards.begin(), m_shards.end(),
+                [](const auto& lhs, const auto& rhs) { return lhs->pair_count() < rhs->pair_count(); });
+        shard.push_change({subscription_change_t::ADD, pair, {}});
+        update_subscriptions(shard, "SUBSCRIBE", pair);
+
+        // warm the book up off the parsing thread, the other pairs keep flowing meanwhile
+        warm_up(shard, {pair});
+    }
+
+    /**
+     * Drop `pair` from the running feed with an UNSUBSCRIBE, the other pairs are unaffected.
+     * Handlers registered for it simply stop being invoked.
+     */
+    void unsubscribe(const instrument_pair_t& pair)
+    {
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        auto it = std::find(m_pairs.begin(), m_pairs.end(), pair);
+        if (it == m_pairs.end())
+            return;
+
+        if (m_sharding.pair_rates.size() == m_pairs.size())
+            m_sharding.pair_rates.erase(m_sharding.pair_rates.begin() + (it - m_pairs.begin()));
+        m_pairs.erase(it);
+
+        for (auto& shard : m_shards)
+        {
+            const auto pairs = shard->pairs();
+            if (std::find(pairs.begin(), pairs.end(), pair) == pairs.end())
+                continue;
+
+            shard->push_change({subscription_change_t::REMOVE, pair, {}});
+            update_subscriptions(*shard, "UNSUBSCRIBE", pair);
+        }
+    }
+
 
 private:
+    static constexpr const char* BOOK_TICKER_STREAM = "bookTicker";
+    static constexpr const char* TRADE_STREAM       = "trade";
+    static constexpr const char* AGG_TRADE_STREAM   = "aggTrade";
+
     std::vector<instrument_pair_t>       m_pairs;
-    std::array<std::string,2>            m_streams;
+    std::vector<std::string>             m_streams;
     std::string                          m_secret_key;
     std::string                          m_api_key;
-    std::unique_ptr<market_feed_socket>  m_socket;
-    std::unique_ptr<std::jthread>        m_thread;
-    std::stop_source                     m_stop_source;
-    std::unordered_map<std::string, orderbook_t> m_orderbooks;
-
-    typedef int snapshot_id_t;
-    typedef int update_id_t;
-    std::unordered_map<std::string, std::pair<snapshot_id_t, update_id_t>> m_update_ids;
+    std::vector<std::unique_ptr<feed_shard_t>> m_shards;
+    size_t                               m_connections;
+    shard_config_t                       m_sharding;
+    reactor_pool*                        m_reactor;
+    size_t                               m_reactor_index;
+    pipeline_config_t                    m_pipeline_config;
+    thread_placement_t                   m_placement;
+    busy_poll_config_t                   m_busy_poll;
+    reconnect_config_t                   m_reconnect;
+    ws_transport_t                       m_transport;
+    trade_tape_config_t                  m_trade_tape;
+    bar_config_t                         m_bars;
+    std::mutex                           m_subscription_mutex;
+    std::atomic<uint64_t>                m_request_id;
+    std::vector<std::future<void>>       m_warmups; // destroyed before the shards they feed
 
     std::vector<std::tuple<feed_event_t, feed_event_handler_t>>               m_handlers;
     std::vector<std::tuple<feed_event_t, feed_event_handler_ptr, std::any>> m_raw_handlers;
-    bool m_get_snapshot;
 
-    void _start_feed(const std::stop_token &stop_token)
+    const feed_shard_t& get_shard(size_t shard) const
+    {
+        if (m_shards.empty())
+            throw std::logic_error("feed has not been started");
+        return *m_shards.at(shard);
+    }
+
+    void create_shards()
+    {
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        m_warmups.clear();
+
+        const auto plan = plan_shards(m_pairs, m_streams.size(), m_sharding);
+        m_shards.clear();
+        for (size_t i = 0; i < plan.size(); ++i)
+        {
+            auto& shard = *m_shards.emplace_back(std::make_unique<feed_shard_t>(i, plan[i],
+                    [this, i](const Document& payload) { return message_handler(*m_shards[i], payload); },
+                    std::bind(&market_feed<binance_api>::apply_book_update, this, std::placeholders::_1),
+                    &market_feed<binance_api>::frame_key));
+
+            for (const auto& pair : plan[i])
+                add_book(shard, pair);
+
+            shard.pipeline.configure(m_pipeline_config);
+            if (m_reactor)
+                shard.reactor = &m_reactor->context((m_reactor_index + i) % m_reactor->size());
+
+            shard.create_sockets(stream_uri(plan[i]), m_connections, [this, &shard](market_feed_socket& socket, size_t connection) {
+                    socket.set_busy_poll(m_busy_poll);
+                    socket.set_reconnect(m_reconnect);
+                    socket.set_transport(m_transport);
+                    socket.set_reconnect_handler(std::bind(&market_feed<binance_api>::on_reconnect, this, std::ref(shard), connection));
+                });
+        }
+    }
+
+    shard_book_t& add_book(feed_shard_t& shard, const instrument_pair_t& pair)
     {
-        if (!m_socket)
-            throw std::runtime_error("_start_feed called in invalid state");
-        std::error_code ec;
-        m_get_snapshot = true;
-        m_socket->connect(ec);
+        auto [it, inserted] = shard.books.try_emplace(instrument_pair::to_binance(pair));
+        shard_book_t& entry = it->second;
+        if (inserted)
+        {
+            entry.book = std::make_unique<orderbook_t>(pair, binance_api::exchange_api_id);
+            entry.book->trades().configure(m_trade_tape.windows);
+            entry.book->bars().configure(m_bars);
+        }
+        entry.subscribed = true;
+        entry.live       = false;
+        return entry;
+    }
+
+    std::string stream_uri(const std::vector<instrument_pair_t>& pairs) const
+    {
+        std::stringstream uri {};
+        uri << binance_api::SOCKET_URI << "/stream?streams=";
+        for (auto i = 0; i < m_streams.size(); ++i)
+        {
+            const auto& stream = m_streams[i];
+            for (auto j = 0; j < pairs.size(); ++j)
+            {
+                uri << instrument_pair::to_binance_lower(pairs[j]) << "@" << stream;
+                if (j+1 != pairs.size() || i+1 != m_streams.size())
+                    uri << "/";
+            }
+        }
+        return uri.str();
+    }
+
+    Document subscription_message(const char* method, const std::vector<instrument_pair_t>& pairs)
+    {
+        using namespace rapidjson;
+        Document doc(Type::kObjectType);
+        auto& alloc = doc.GetAllocator();
+
+        Value params(kArrayType);
+        for (const auto& pair : pairs)
+        {
+            for (const auto& stream : m_streams)
+            {
+                std::string name {instrument_pair::to_binance_lower(pair) + "@" + stream};
+                params.PushBack(Value().SetString(name.c_str(), name.length(), alloc), alloc);
+            }
+        }
+
+        doc.AddMember("method", Value().SetString(method, alloc), alloc)
+           .AddMember("params", params, alloc)
+           .AddMember("id", Value().SetUint64(++m_request_id), alloc);
+        return doc;
+    }
+
+    /**
+     * Send `method` for `pair` on every connection of `shard` and rewrite their opening
+     * messages so a reconnect restores the current pair set on top of the stream URI.
+     */
+    void update_subscriptions(feed_shard_t& shard, const char* method, const instrument_pair_t& pair)
+    {
+        for (auto& socket_ptr : shard.sockets)
+        {
+            market_feed_socket& socket = *socket_ptr;
+            socket.post([this, &shard, &socket, method, pair]() {
+                    const auto pairs = shard.pairs();
+                    std::vector<instrument_pair_t> added, removed;
+                    for (const auto& p : pairs)
+                    {
+                        if (std::find(shard.initial_pairs.begin(), shard.initial_pairs.end(), p) == shard.initial_pairs.end())
+                            added.push_back(p);
+                    }
+                    for (const auto& p : shard.initial_pairs)
+                    {
+                        if (std::find(pairs.begin(), pairs.end(), p) == pairs.end())
+                            removed.push_back(p);
+                    }
+
+                    socket.clear_opening_messages();
+                    if (!removed.empty())
+                        socket.add_opening_message_json(subscription_message("UNSUBSCRIBE", removed));
+                    if (!added.empty())
+                        socket.add_opening_message_json(subscription_message("SUBSCRIBE", added));
+
+                    if (socket.is_open())
+                        socket.send_json(subscription_message(method, {pair}));
+                });
+        }
     }
 
-    void process_orderbook_snapsots()
+    void on_reconnect(feed_shard_t& shard, size_t connection)
+    {
+        // as long as another connection kept delivering, the books never missed an update
+        if (shard.any_open_except(connection))
+            return;
+
+        // diffs missed while disconnected can't be recovered, start over from a fresh snapshot
+        // and take whatever the new connection delivers first
+        shard.arbiter.reset();
+        shard.resync = true;
+    }
+
+    /**
+     * Stream and sequence of a combined stream frame for `feed_arbiter`: the final update
+     * id for depth/bookTicker, the trade id for trades or the event time for everything
+     * else, each increasing within its stream.
+     */
+    static bool frame_key(const char* data, size_t len, uint64_t& stream_key, uint64_t& sequence)
+    {
+        static constexpr const char STREAM[] = "\"stream\":\"";
+        const char* stream = std::strstr(data, STREAM);
+        if (!stream)
+            return false;
+        stream += sizeof(STREAM) - 1;
+        const char* stream_end = std::strchr(stream, '"');
+        if (!stream_end)
+            return false;
+
+        // several trades can share an event time
+        const std::string_view name {stream, static_cast<size_t>(stream_end - stream)};
+        const char* id = nullptr;
+        if (name.ends_with("@trade"))
+            id = std::strstr(stream_end, "\"t\":");
+        else if (name.ends_with("@aggTrade"))
+            id = std::strstr(stream_end, "\"a\":");
+        if (!id) id = std::strstr(stream_end, "\"u\":");
+        if (!id) id = std::strstr(stream_end, "\"E\":");
+        if (!id)
+            return false;
+
+        stream_key = feed_arbiter::fnv1a(stream, stream_end - stream);
+        sequence   = std::strtoull(id + 4, nullptr, 10);
+        return true;
+    }
+
+    void apply_book_update(book_update_t& update)
+    {
+        orderbook_t& book = *update.book;
+        if (update.event == feed_event_t::NONE)
+        {
+            // unsubscribed, nothing is published for the emptied book
+            book.clear();
+            return;
+        }
+
+        if (update.reset)
+            book.clear();
+        if (!update.levels.empty())
+            book.process_level_updates(update.levels.data(), update.levels.size());
+
+        bool top_changed = false;
+        if (update.has_top)
+            top_changed = book.update_top_of_book(update.top);
+        else if (update.reset || !update.levels.empty())
+            top_changed = book.sync_top_of_book(update.sequence, update.recv_ns);
+
+        bool bars_closed = false;
+        if (!update.trades.empty())
+        {
+            book.trades().add(update.trades.data(), update.trades.size());
+            bars_closed |= book.bars().on_trades(update.trades.data(), update.trades.size());
+        }
+        else
+        {
+            // let the windows decay while the pair isn't trading
+            book.trades().advance(update.recv_ns);
+        }
+        if (update.has_bar)
+            bars_closed |= book.bars().on_bar(update.bar);
+        if (top_changed && book.bars().source() == bar_source_t::BOOK)
+        {
+            const orderbook_t::top_of_book_t top = book.top_of_book();
+            bars_closed |= book.bars().on_quote(top.bid_price, top.ask_price, wall_clock_ms());
+        }
+
+        const int mask = (update.event & ~(feed_event_t::BBO_UPDATED | feed_event_t::BARS_UPDATED))
+                         | (top_changed ? feed_event_t::BBO_UPDATED : 0)
+                         | (bars_closed ? feed_event_t::BARS_UPDATED : 0);
+        notify_event_handlers(static_cast<feed_event_t::event_type>(mask), book);
+    }
+
+    /**
+     * Fetch REST snapshots for `symbols`, failed requests leave their response empty.
+     */
+    void fetch_snapshots(const std::vector<std::string>& symbols, std::vector<std::string>& responses)
     {
         requests_t req{};
-        std::vector<std::string> pair_vec;
-        for (auto& [pair_str, orderbook] : m_orderbooks)
+        for (const auto& symbol : symbols)
         {
-            pair_vec.emplace_back(pair_str);
             req.add_request(binance_api::SNAPSHOT_URL, ReqType::GET)
-                .add_url_param("symbol", pair_str)
+                .add_url_param("symbol", symbol)
                 .add_url_param("limit", "5000")
                 .add_header("x-mbx-apikey", m_api_key);
         }
 
         std::vector<CURLcode> statuses;
         req.fetch_all(statuses);
-        for(size_t i = 0; i < pair_vec.size(); ++i)
+        responses.assign(symbols.size(), std::string{});
+        for(size_t i = 0; i < symbols.size(); ++i)
         {
             if (statuses[i])
             {
-                log("ERORR failed to get snapshot for {}: \n", pair_vec[i], req.get_error_msg(i, statuses[i]));
+                log("ERORR failed to get snapshot for {}: {}\n", symbols[i], req.get_error_msg(i, statuses[i]));
                 continue;
             }
-            std::string response {req.get_response(i)};
+            responses[i] = req.get_response(i);
+        }
+    }
 
-            Document doc(rapidjson::kObjectType);
-            // TODO: check if response string guaranteeded to be null-terminated?
-            rapidjson::ParseResult res {doc.ParseInsitu(response.data())};
-            if(!res)
-            {
-                log("ERROR failed to parse snapshot response for {}: {} at offset {:d}", pair_vec[i],
-                        rapidjson::GetParseError_En(res.Code()), res.Offset());
+    void apply_snapshot(feed_shard_t& shard, const std::string& symbol, shard_book_t& entry, std::string& response)
+    {
+        Document doc(rapidjson::kObjectType);
+        // TODO: check if response string guaranteeded to be null-terminated?
+        rapidjson::ParseResult res {doc.ParseInsitu(response.data())};
+        if(!res)
+        {
+            log("ERROR failed to parse snapshot response for {}: {} at offset {:d}", symbol,
+                    rapidjson::GetParseError_En(res.Code()), res.Offset());
+            return;
+        }
+
+        if (doc.HasMember("code"))
+        {
+            log("ERROR snapshot request for {} failed: {}", symbol, response);
+            return;
+        }
+
+        const Value& bids {doc["bids"]};
+        const Value& asks {doc["asks"]};
+        const Value& last_update_id {doc["lastUpdateId"]};
+        if (!last_update_id.IsInt64())
+        {
+            log("failed to parse lastUpdateId \"{}\"", last_update_id.GetString());
+            return;
+        }
+
+        entry.sequence = last_update_id.GetInt64();
+        entry.applied  = entry.sequence;
+        entry.live     = true;
+
+        book_update_t& update = shard.pipeline.begin_update(*entry.book, feed_event_t::ORDERS_UPDATED);
+        update.reset    = true;
+        update.sequence = entry.sequence;
+        orderbook_t::decode_order_updates<binance_api>(update.levels, bids, asks);
+        shard.pipeline.commit_update();
+
+        replay_buffered_diffs(shard, symbol, entry);
+    }
+
+    /**
+     * Apply the diffs buffered while `entry` was warming that the snapshot doesn't contain yet.
+     */
+    void replay_buffered_diffs(feed_shard_t& shard, const std::string& symbol, shard_book_t& entry)
+    {
+        for (auto& diff : entry.buffered)
+        {
+            if (diff.final_id <= entry.applied)
                 continue;
-            }
 
-            if (doc.HasMember("code"))
+            if (diff.first_id > entry.applied + 1)
             {
-                log("ERROR snapshot request for {} failed: {}", pair_vec[i], response);
-                continue;
+                // the snapshot is older than the buffered diffs, or one of them went missing
+                log("WARNING snapshot for {} doesn't reach the buffered diffs, resyncing", symbol);
+                shard.resync = true;
+                break;
             }
+            entry.applied = diff.final_id;
 
-            const Value& bids {doc["bids"]};
-            const Value& asks {doc["asks"]};
-            const Value& last_update_id {doc["lastUpdateId"]};
-            if (!last_update_id.IsInt64())
-            {
-                log("failed to parse lastUpdateId \"{}\"", last_update_id.GetString());
+            book_update_t& update = shard.pipeline.begin_update(*entry.book, feed_event_t::ORDERS_UPDATED);
+            update.sequence = diff.final_id;
+            update.levels.swap(diff.levels);
+            shard.pipeline.commit_update();
+        }
+        entry.buffered.clear();
+        entry.warming = false;
+    }
+
+    /**
+     * Fetch snapshots for `pairs` in the background and hand them to the shard's parsing
+     * thread as SNAPSHOT changes. The caller holds `m_subscription_mutex`.
+     */
+    void warm_up(feed_shard_t& shard, std::vector<instrument_pair_t> pairs)
+    {
+        std::erase_if(m_warmups, [](const std::future<void>& warmup) {
+                return warmup.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+            });
+        m_warmups.emplace_back(std::async(std::launch::async, [this, &shard, pairs = std::move(pairs)]() {
+                std::vector<std::string> symbols;
+                for (const auto& pair : pairs)
+                    symbols.push_back(instrument_pair::to_binance(pair));
+
+                std::vector<std::string> responses;
+                fetch_snapshots(symbols, responses);
+                // also sent when a request failed so the buffered diffs are dropped
+                for (size_t i = 0; i < pairs.size(); ++i)
+                    shard.push_change({subscription_change_t::SNAPSHOT, pairs[i], std::move(responses[i])});
+            }));
+    }
+
+    /**
+     * Take every subscribed book out of sync and warm them all up again, the diffs received
+     * until their snapshots arrive are buffered just like for a runtime subscription. The
+     * REST requests never run on the thread parsing the frames, which may be a reactor
+     * thread shared with other shards.
+     */
+    void process_orderbook_snapsots(feed_shard_t& shard)
+    {
+        std::vector<instrument_pair_t> pairs;
+        for (auto& [symbol, entry] : shard.books)
+        {
+            if (!entry.subscribed)
                 continue;
-            }
+            entry.live    = false;
+            entry.warming = true;
+            entry.buffered.clear();
+            pairs.push_back(entry.book->pair);
+        }
 
-            orderbook_t& orderbook = m_orderbooks.at(pair_vec[i]);
-            auto& [snapshot_id, _] = m_update_ids[pair_vec[i]];
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        warm_up(shard, std::move(pairs));
+    }
 
-            snapshot_id = last_update_id.GetInt64();
+    /**
+     * Apply pair set changes and warm-up snapshots queued by `subscribe`/`unsubscribe`.
+     */
+    void process_subscription_changes(feed_shard_t& shard)
+    {
+        std::vector<subscription_change_t> changes;
+        if (!shard.take_changes(changes))
+            return;
 
-            orderbook.process_order_snapshot<binance_api>(bids, asks);
+        for (auto& change : changes)
+        {
+            const std::string symbol {instrument_pair::to_binance(change.pair)};
+            auto it = shard.books.find(symbol);
+            switch (change.kind)
+            {
+            case subscription_change_t::ADD:
+                {
+                    shard_book_t& entry = add_book(shard, change.pair);
+                    entry.warming = true;
+                    entry.buffered.clear();
+                }
+                break;
+            case subscription_change_t::REMOVE:
+                if (it == shard.books.end())
+                    break;
+                it->second.subscribed = false;
+                it->second.live       = false;
+                it->second.warming    = false;
+                it->second.buffered.clear();
+                {
+                    // the book is kept (updates for it may still be queued), emptied silently by the worker that owns it
+                    book_update_t& update = shard.pipeline.begin_update(*it->second.book, feed_event_t::NONE);
+                    update.reset = true;
+                    shard.pipeline.commit_update();
+                }
+                break;
+            case subscription_change_t::SNAPSHOT:
+                // the pair may have been dropped again, or resynced, while its snapshot was in flight
+                if (it == shard.books.end() || !it->second.warming)
+                    break;
+                if (!change.payload.empty())
+                    apply_snapshot(shard, symbol, it->second, change.payload);
+                // a failed snapshot leaves the book out of sync until the next resync
+                it->second.buffered.clear();
+                it->second.warming = false;
+                break;
+            }
         }
     }
 
-    bool message_handler(const Document& payload)
+    /**
+     * Book for an update on `symbol`, nullptr unless subscribed.
+     */
+    shard_book_t* subscribed_book(feed_shard_t& shard, const Value& symbol)
     {
-        if (m_get_snapshot)
+        auto it = shard.books.find(std::string{symbol.GetString(), symbol.GetStringLength()});
+        if (it == shard.books.end())
         {
-            process_orderbook_snapsots();
-            m_get_snapshot = false;
+            log("update for urecognized symbol {}\n", symbol.GetString());
+            return nullptr;
+        }
+        return it->second.subscribed ? &it->second : nullptr;
+    }
+
+    /**
+     * Book for an update on `symbol`, nullptr unless subscribed and in sync.
+     */
+    shard_book_t* live_book(feed_shard_t& shard, const Value& symbol)
+    {
+        shard_book_t* entry = subscribed_book(shard, symbol);
+        return entry && entry->live ? entry : nullptr;
+    }
+
+    bool message_handler(feed_shard_t& shard, const Document& payload)
+    {
+        process_subscription_changes(shard);
+        if (shard.resync.exchange(false))
+        {
+            process_orderbook_snapsots(shard);
+        }
+
+        if (payload.HasMember("id"))
+        {
+            // response to a SUBSCRIBE/UNSUBSCRIBE
+            if (payload.HasMember("error"))
+                log("ERROR subscription request failed: {}", to_string<Document>(payload));
+            return true;
         }
 
         if (!payload.HasMember("data"))
@@ -186,6 +781,13 @@ private:
         const Value& json = payload["data"];
         const bool has_type    = json.HasMember("e");
 
+        // bookTicker is the only stream without an event type
+        if (!has_type && is_book_ticker(payload))
+        {
+            process_book_ticker(shard, json);
+            return true;
+        }
+
         if (!has_type)
         {
             log("unkown message: {}\n", to_string<Value>(json));
@@ -195,11 +797,16 @@ private:
         const auto& type = json["e"];
         if (!std::strncmp("depthUpdate", type.GetString(), type.GetStringLength()))
         {
-            process_depth_update(json);
+            process_depth_update(shard, json);
         }
         else if (!std::strncmp("kline", type.GetString(), type.GetStringLength()))
         {
-            process_ticker_update(json);
+            process_ticker_update(shard, json);
+        }
+        else if (!std::strncmp("aggTrade", type.GetString(), type.GetStringLength())
+                || !std::strncmp("trade", type.GetString(), type.GetStringLength()))
+        {
+            process_trade(shard, json);
         }
         else
         {
@@ -234,15 +841,11 @@ private:
         }
     }
 
-    void process_ticker_update(const Value& update)
+    void process_ticker_update(feed_shard_t& shard, const Value& update)
     {
-        const auto& symbol = update["s"];
-        decltype(m_orderbooks)::iterator it {m_orderbooks.find(std::string{symbol.GetString()})};
-        if (it == m_orderbooks.end())
-        {
-            log("depthUpdate for urecognized symbol {}\n", symbol.GetString());
+        shard_book_t* entry = live_book(shard, update["s"]);
+        if (!entry)
             return;
-        }
 
         // example kline response:
         //  {
@@ -271,27 +874,123 @@ private:
         //  }
         //
 
-        orderbook_t& orderbook = it->second;
-        // orderbook.process_ticker_update<binance_api>(update);
-        notify_event_handlers(feed_event_t::TICKER_UPDATED, orderbook);
+        book_update_t& book_update = shard.pipeline.begin_update(*entry->book, feed_event_t::TICKER_UPDATED);
+        book_update.has_bar = orderbook_t::decode_bar<binance_api>(book_update.bar, update["k"]);
+        shard.pipeline.commit_update();
     }
 
-    void process_depth_update(const Value& update)
+    void process_depth_update(feed_shard_t& shard, const Value& update)
     {
-        const auto& symbol = update["s"];
-        decltype(m_orderbooks)::iterator it {m_orderbooks.find(std::string{symbol.GetString()})};
-        if (it == m_orderbooks.end())
+        shard_book_t* entry = subscribed_book(shard, update["s"]);
+        if (!entry)
+            return;
+
+        if (!entry->live)
+        {
+            // kept until the snapshot of a runtime subscription arrives
+            if (entry->warming)
+            {
+                buffered_diff_t& diff = entry->buffered.emplace_back();
+                diff.first_id = update["U"].GetInt64();
+                diff.final_id = update["u"].GetInt64();
+                orderbook_t::decode_order_updates<binance_api>(diff.levels, update["b"], update["a"]);
+            }
+            return;
+        }
+
+        // buffered diffs already contained in the snapshot
+        const int64_t final_id = update["u"].GetInt64();
+        if (final_id <= entry->applied)
+            return;
+
+        if (update["U"].GetInt64() > entry->applied + 1)
         {
-            log("depthUpdate for urecognized symbol {}\n", symbol.GetString());
+            // a diff went missing, or the snapshot predates the diffs buffered while warming
+            log("WARNING gap in depth updates for {}, resyncing", update["s"].GetString());
+            shard.resync = true;
             return;
         }
+        entry->applied = final_id;
 
-        orderbook_t& orderbook = it->second;
+        orderbook_t& orderbook = *entry->book;
         const Value& bids = update["b"];
         const Value& asks = update["a"];
 
-        orderbook.process_order_updates<binance_api>(bids, asks);
-        notify_event_handlers(feed_event_t::ORDERS_UPDATED, orderbook);
+        book_update_t& book_update = shard.pipeline.begin_update(orderbook, feed_event_t::ORDERS_UPDATED);
+        book_update.sequence = final_id;
+        orderbook_t::decode_order_updates<binance_api>(book_update.levels, bids, asks);
+        shard.pipeline.commit_update();
+    }
+
+    static bool is_book_ticker(const Document& payload)
+    {
+        if (!payload.HasMember("stream"))
+            return false;
+        const Value& stream = payload["stream"];
+        const std::string_view name {stream.GetString(), stream.GetStringLength()};
+        return name.ends_with(BOOK_TICKER_STREAM);
+    }
+
+    void process_book_ticker(feed_shard_t& shard, const Value& quote)
+    {
+        // example bookTicker response:
+        //  {
+        //  "u": 400900217,     // order book updateId
+        //  "s": "BNBUSDT",     // symbol
+        //  "b": "25.35190000", // best bid price
+        //  "B": "31.21000000", // best bid qty
+        //  "a": "25.36520000", // best ask price
+        //  "A": "40.66000000"  // best ask qty
+        //  }
+        shard_book_t* entry = live_book(shard, quote["s"]);
+        if (!entry)
+            return;
+
+        const int64_t update_id = quote["u"].GetInt64();
+        if (update_id <= entry->sequence)
+            return; // already part of the snapshot
+
+        book_update_t& update = shard.pipeline.begin_update(*entry->book, feed_event_t::BBO_UPDATED);
+        update.has_top          = true;
+        update.sequence         = update_id;
+        update.top.bid_price    = std::stold(quote["b"].GetString());
+        update.top.bid_quantity = std::stold(quote["B"].GetString());
+        update.top.ask_price    = std::stold(quote["a"].GetString());
+        update.top.ask_quantity = std::stold(quote["A"].GetString());
+        update.top.sequence     = update_id;
+        update.top.recv_ns      = update.recv_ns;
+        shard.pipeline.commit_update();
+    }
+
+    void process_trade(feed_shard_t& shard, const Value& trade)
+    {
+        // example trade/aggTrade response:
+        //  {
+        //  "e": "aggTrade",    // Event type ("trade" carries "t" instead of "a")
+        //  "E": 123456789,     // Event time
+        //  "s": "BNBBTC",      // Symbol
+        //  "a": 12345,         // Aggregate trade ID
+        //  "p": "0.001",       // Price
+        //  "q": "100",         // Quantity
+        //  "f": 100,           // First trade ID
+        //  "l": 105,           // Last trade ID
+        //  "T": 123456785,     // Trade time
+        //  "m": true,          // Is the buyer the market maker?
+        //  "M": true           // Ignore
+        //  }
+        shard_book_t* entry = subscribed_book(shard, trade["s"]);
+        if (!entry)
+            return;
+
+        book_update_t& update = shard.pipeline.begin_update(*entry->book, feed_event_t::TRADES_UPDATED);
+        update.trades.push_back(trade_t{
+                std::stold(trade["p"].GetString()),
+                std::stold(trade["q"].GetString()),
+                !trade["m"].GetBool(), // a maker buyer means the taker sold
+                trade.HasMember("a") ? trade["a"].GetInt64() : trade["t"].GetInt64(),
+                trade["T"].GetInt64(),
+                update.recv_ns});
+        shard.pipeline.commit_update();
     }
 };
 
@@ -0,0 +1,184 @@
+#ifndef _BOOK_SIGNALS_H
+#define _BOOK_SIGNALS_H
+
+#include "seqlock.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+
+/**
+ * Features of a book's top levels, see `book_signal_engine_t`. Level 1 fields follow the
+ * best bid/offer, the depth fields the top `depth` levels of each side.
+ */
+struct book_signals_t
+{
+    // level 1
+    double   mid          {0};
+    double   spread       {0};
+    double   microprice   {0}; // mid weighted towards the side with less size
+    double   imbalance    {0}; // (bid size - ask size) / (bid size + ask size), in [-1, 1]
+    // top `depth` levels
+    uint32_t depth        {0}; // levels used on the thinner side
+    double   depth_imbalance {0};
+    double   depth_mid    {0}; // mid of each side's size weighted average price
+    double   bid_slope    {0}; // size added per bps away from the mid, higher is a thicker book
+    double   ask_slope    {0};
+    int64_t  recv_ns      {0}; // of the last quote taken in
+    uint64_t updates      {0}; // times the signals changed
+};
+
+/**
+ * Maintains `book_signals_t` for one book so every consumer reads the same values instead
+ * of recomputing them from the guarded levels.
+ *
+ * The book calls `on_top` when its best bid/offer changes and `on_levels` after applying
+ * depth updates. Each keeps a copy of what it last saw and returns right away when the
+ * inputs it uses didn't change, so updates deep in the book cost a short compare. Values
+ * are published through a seqlock: `latest` never blocks the writer and can be called from
+ * any thread.
+ */
+class book_signal_engine_t
+{
+public:
+    typedef std::pair<double, double> level_t; // price, quantity as in `orderbook_t::order_t`
+
+    static constexpr const size_t MAX_DEPTH = 10;
+
+    book_signal_engine_t(size_t depth = 5)
+        : m_depth{0}, m_bids{}, m_asks{}, m_bid_count{0}, m_ask_count{0}, m_signals{}, m_published{}
+    {
+        configure(depth);
+    }
+
+    book_signal_engine_t(const book_signal_engine_t&) = delete;
+    book_signal_engine_t& operator=(const book_signal_engine_t&) = delete;
+
+    /**
+     * Number of levels per side the depth signals use. Not thread-safe.
+     */
+    void configure(size_t depth)
+    {
+        if (depth == 0 || depth > MAX_DEPTH)
+            throw std::invalid_argument("book signal depth must be between 1 and 10");
+        m_depth     = depth;
+        m_bid_count = m_ask_count = 0;
+    }
+
+    size_t depth() const
+    { return m_depth; }
+
+    book_signals_t latest() const
+    { return m_published.load(); }
+
+    /**
+     * Take in a new best bid/offer, returns true if the signals changed.
+     */
+    bool on_top(double bid_price, double bid_quantity, double ask_price, double ask_quantity, int64_t recv_ns)
+    {
+        book_signals_t& s = m_signals;
+        s.recv_ns = recv_ns;
+        if (bid_quantity <= 0 || ask_quantity <= 0)
+        {
+            if (s.mid == 0)
+                return false;
+            s.mid = s.spread = s.microprice = s.imbalance = 0;
+        }
+        else
+        {
+            const double size = bid_quantity + ask_quantity;
+            s.mid        = (bid_price + ask_price) / 2;
+            s.spread     = ask_price - bid_price;
+            s.microprice = (bid_price * ask_quantity + ask_price * bid_quantity) / size;
+            s.imbalance  = (bid_quantity - ask_quantity) / size;
+        }
+        publish();
+        return true;
+    }
+
+    /**
+     * Take in the top levels of both sides (best first), returns true if the levels the
+     * depth signals use changed.
+     */
+    bool on_levels(const level_t* bids, size_t bid_count, const level_t* asks, size_t ask_count)
+    {
+        bid_count = bid_count < m_depth ? bid_count : m_depth;
+        ask_count = ask_count < m_depth ? ask_count : m_depth;
+        if (!take(m_bids, m_bid_count, bids, bid_count) & !take(m_asks, m_ask_count, asks, ask_count))
+            return false;
+
+        book_signals_t& s = m_signals;
+        const size_t depth = bid_count < ask_count ? bid_count : ask_count;
+        s.depth = static_cast<uint32_t>(depth);
+        if (depth == 0)
+        {
+            s.depth_imbalance = s.depth_mid = s.bid_slope = s.ask_slope = 0;
+            publish();
+            return true;
+        }
+
+        double bid_size = 0, bid_notional = 0, ask_size = 0, ask_notional = 0;
+        for (size_t i = 0; i < depth; ++i)
+        {
+            bid_size     += bids[i].second;
+            bid_notional += bids[i].first * bids[i].second;
+            ask_size     += asks[i].second;
+            ask_notional += asks[i].first * asks[i].second;
+        }
+        const double mid = (bids[0].first + asks[0].first) / 2;
+        s.depth_imbalance = (bid_size - ask_size) / (bid_size + ask_size);
+        s.depth_mid       = (bid_notional / bid_size + ask_notional / ask_size) / 2;
+        s.bid_slope       = slope(bids, depth, mid);
+        s.ask_slope       = slope(asks, depth, mid);
+        publish();
+        return true;
+    }
+
+private:
+    size_t         m_depth;
+    level_t        m_bids[MAX_DEPTH]; // last levels taken in
+    level_t        m_asks[MAX_DEPTH];
+    size_t         m_bid_count;
+    size_t         m_ask_count;
+    book_signals_t m_signals;         // writer's copy of `m_published`
+    seqlock<book_signals_t> m_published;
+
+    /**
+     * Copy `levels` over `dst`, returns true if they differ.
+     */
+    static bool take(level_t* dst, size_t& dst_count, const level_t* levels, size_t count)
+    {
+        if (count == dst_count && std::equal(levels, levels + count, dst))
+            return false;
+        std::copy(levels, levels + count, dst);
+        dst_count = count;
+        return true;
+    }
+
+    /**
+     * Least squares slope through the origin of the cumulative size against the distance
+     * from `mid` in bps.
+     */
+    static double slope(const level_t* levels, size_t count, double mid)
+    {
+        double cumulative = 0, dq = 0, dd = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const double distance = (levels[i].first > mid ? levels[i].first - mid : mid - levels[i].first) / mid * 1e4;
+            cumulative += levels[i].second;
+            dq += distance * cumulative;
+            dd += distance * distance;
+        }
+        return dd > 0 ? dq / dd : 0.0;
+    }
+
+    void publish()
+    {
+        ++m_signals.updates;
+        m_published.store(m_signals);
+    }
+};
+
+#endif
@@ -6,8 +6,15 @@
 #include "json.h"
 #include "logger.h"
 #include "crypto.h"
+#include "feed_pipeline.h"
+#include "reactor_pool.h"
+#include "feed_arbiter.h"
+#include "feed_shard.h"
+#include "trade_tape.h"
+#include "thread_util.h"
 
 #include <string>
+#include <cstring>
 #include <thread>
 #include <vector>
 #include <unordered_map>
@@ -15,6 +22,10 @@
 #include <functional>
 #include <algorithm>
 #include <utility>
+#include <cctype>
+#include <string_view>
+#include <mutex>
+#include <numeric>
 
 
 template <>
@@ -26,47 +37,44 @@ public:
         : m_pairs {pairs}, m_channels {"level2", "ticker"},
           m_secret_key {secret_key},
           m_api_key {api_key},
-          m_socket{nullptr},
-          m_thread {nullptr},
-          m_stop_source {},
-          m_orderbooks{},
+          m_shards{},
+          m_connections{1},
+          m_sharding{},
+          m_reactor {nullptr},
+          m_reactor_index {0},
+          m_pipeline_config {},
+          m_placement {thread_config_t{}[thread_role::FEED]},
+          m_busy_poll {},
+          m_reconnect {},
+          m_transport {ws_transport_t::WEBSOCKETPP},
+          m_trade_tape {},
+          m_bars {},
+          m_subscription_mutex{},
           m_handlers{},
           m_raw_handlers{}
-    {
-        for (auto& pair : m_pairs)
-        {
-            m_orderbooks.emplace(std::piecewise_construct,
-                    std::forward_as_tuple(instrument_pair::to_coinbase(pair)),
-                    std::forward_as_tuple(pair, coinbase_api::exchange_api_id));
-        }
-    }
+    { }
 
     void start_feed()
     {
-        if (m_thread && m_thread->joinable())
+        if (!m_shards.empty() && m_shards.front()->thread)
             throw std::runtime_error("start_feed called when another is already running in another thread");
 
-        const std::string uri {""};
-        m_socket = std::make_unique<market_feed_socket>(coinbase_api::SOCKET_URI, 
-                std::bind(&market_feed<coinbase_api>::message_handler, this, std::placeholders::_1));
-
-        add_subscribe_messages();
-
-        m_thread = std::make_unique<std::jthread>(&market_feed<coinbase_api>::_start_feed, this, m_stop_source.get_token());
+        create_shards();
+        for (auto& shard : m_shards)
+            shard->start(m_placement, m_busy_poll);
     }
 
     void join()
     {
-        if (m_thread)
-            m_thread->join();
+        for (auto& shard : m_shards)
+            shard->join();
     }
 
     void close()
     {
-        if (!m_socket) return;
         // TODO: send unsubscribe message before closing?
-
-        m_socket->close();
+        for (auto& shard : m_shards)
+            shard->close();
     }
 
     void register_event_handler(const feed_event_t& ev, feed_event_handler_t handler)
@@ -79,30 +87,394 @@ public:
         m_raw_handlers.emplace_back(ev, handler, std::move(state));
     }
 
+    /**
+     * Run parsing and book updates on their own threads, see `feed_pipeline`.
+     * Must be called before `start_feed`. Event handlers are then invoked from the book worker
+     * threads, all events for a given pair come from the same worker. Every shard gets a
+     * pipeline of its own built from `config`.
+     */
+    void configure_pipeline(const pipeline_config_t& config)
+    {
+        if (config.book_workers == 0)
+            throw std::invalid_argument("feed pipeline needs at least one book worker");
+        m_pipeline_config = config;
+    }
+
+    const feed_pipeline& pipeline(size_t shard = 0) const
+    { return get_shard(shard).pipeline; }
+
+    /**
+     * Run the sockets on reactor `index` of `pool` instead of on threads of their own, shard
+     * `i` goes to reactor `index + i` (wrapping around).
+     * Must be called before `start_feed`, and the pool has to be running for the feed to connect.
+     */
+    void attach_to_reactor(reactor_pool& pool, size_t index)
+    {
+        m_reactor       = &pool;
+        m_reactor_index = index;
+    }
+
+    /**
+     * Placement of the threads running the sockets, shard `i` uses index `i` of the placement.
+     * Unused when attached to a reactor. Must be called before `start_feed`.
+     */
+    void set_thread_placement(const thread_placement_t& placement)
+    {
+        m_placement = placement;
+    }
+
+    /**
+     * Spin the feed thread on the socket instead of sleeping between frames, trading a
+     * core for lower wake-up latency. When attached to a reactor only the socket options
+     * apply, the reactor decides how it is run. Must be called before `start_feed`.
+     */
+    void set_busy_poll(const busy_poll_config_t& config)
+    {
+        m_busy_poll = config;
+    }
+
+    /**
+     * Heartbeat, stall detection and backoff for the supervised connection, see `market_feed_socket`.
+     * Must be called before `start_feed`.
+     */
+    void set_reconnect(const reconnect_config_t& config)
+    {
+        m_reconnect = config;
+    }
+
+    /**
+     * Websocket implementation used by the feed's connections. Must be called before `start_feed`.
+     */
+    void set_transport(ws_transport_t transport)
+    {
+        m_transport = transport;
+    }
+
+    const reconnect_stats_t& reconnect_stats(size_t connection = 0, size_t shard = 0) const
+    {
+        const feed_shard_t& s = get_shard(shard);
+        if (connection >= s.sockets.size())
+            throw std::out_of_range("no such connection");
+        return s.sockets[connection]->stats;
+    }
+
+    /**
+     * Only a single connection is supported: coinbase numbers messages per connection
+     * (`sequence_num`), so copies of an update arriving on different connections can't
+     * be matched up. Must be called before `start_feed`.
+     */
+    void set_redundant_connections(size_t connections)
+    {
+        if (connections != 1)
+            throw std::invalid_argument("coinbase feed supports exactly one connection");
+        m_connections = connections;
+    }
+
+    const feed_arbiter& arbiter(size_t shard = 0) const
+    { return get_shard(shard).arbiter; }
+
+    /**
+     * Spread the pairs over several connections once a single one would carry more streams
+     * or messages than `config` allows, see `plan_shards`. Each shard has its own I/O thread
+     * (or reactor) and pipeline, handlers stay registered on the feed as a whole but may then
+     * be invoked concurrently for pairs of different shards. Must be called before `start_feed`.
+     */
+    void set_sharding(const shard_config_t& config)
+    {
+        if (!config.pair_rates.empty() && config.pair_rates.size() != m_pairs.size())
+            throw std::invalid_argument("pair_rates must have one entry per pair");
+        m_sharding = config;
+    }
+
+    size_t shards() const
+    { return m_shards.size(); }
+
+    /**
+     * Subscribe to the `market_trades` channel and record executed trades on each book's
+     * `orderbook_t::trades` tape, firing `TRADES_UPDATED`. Must be called before `start_feed`.
+     */
+    void set_trade_tape(const trade_tape_config_t& config)
+    {
+        if (config.windows.size() > trade_flow_t::MAX_WINDOWS)
+            throw std::invalid_argument("too many trade windows");
+
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        std::erase(m_channels, MARKET_TRADES_CHANNEL);
+        if (config.enabled)
+            m_channels.push_back(MARKET_TRADES_CHANNEL);
+        m_trade_tape = config;
+    }
+
+    /**
+     * Build OHLCV bars and momentum indicators on each book's `orderbook_t::bars`, firing
+     * `BARS_UPDATED` whenever a bar closes. `bar_source_t::EXCHANGE` bars are built out of
+     * the `ticker` channel, `TRADES` needs `set_trade_tape`. Must be called before `start_feed`.
+     */
+    void set_bars(const bar_config_t& config)
+    {
+        if (config.intervals.size() > bar_engine_t::MAX_INTERVALS)
+            throw std::invalid_argument("too many bar intervals");
+
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        m_bars = config;
+    }
+
+    /**
+     * Pairs currently handled by `shard`, only valid once started.
+     */
+    std::vector<instrument_pair_t> shard_pairs(size_t shard) const
+    { return get_shard(shard).pairs(); }
+
+    /**
+     * Add `pair` to the running feed with a subscribe on the connections of the shard with
+     * the fewest pairs, leaving every other product untouched. The book only publishes
+     * events once the snapshot that follows the subscription has arrived. Before
+     * `start_feed` this just extends the pair set.
+     */
+    void subscribe(const instrument_pair_t& pair)
+    {
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        if (std::find(m_pairs.begin(), m_pairs.end(), pair) != m_pairs.end())
+            return;
+
+        if (m_sharding.pair_rates.size() == m_pairs.size() && !m_pairs.empty())
+        {
+            // no measurement yet, assume an average pair
+            const auto& rates = m_sharding.pair_rates;
+            m_sharding.pair_rates.push_back(std::accumulate(rates.begin(), rates.end(), 0.0) / rates.size());
+        }
+        m_pairs.push_back(pair);
+        if (m_shards.empty())
+            return;
+
+        feed_shard_t& shard = **std::min_element(m_shards.begin(), m_shards.end(),
+                [](const auto& lhs, const auto& rhs) { return lhs->pair_count() < rhs->pair_count(); });
+        shard.push_change({subscription_change_t::ADD, pair, {}});
+        update_subscriptions(shard, "subscribe", pair);
+    }
+
+    /**
+     * Drop `pair` from the running feed with an unsubscribe, the other pairs are unaffected.
+     * Handlers registered for it simply stop being invoked.
+     */
+    void unsubscribe(const instrument_pair_t& pair)
+    {
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        auto it = std::find(m_pairs.begin(), m_pairs.end(), pair);
+        if (it == m_pairs.end())
+            return;
+
+        if (m_sharding.pair_rates.size() == m_pairs.size())
+            m_sharding.pair_rates.erase(m_sharding.pair_rates.begin() + (it - m_pairs.begin()));
+        m_pairs.erase(it);
+
+        for (auto& shard : m_shards)
+        {
+            const auto pairs = shard->pairs();
+            if (std::find(pairs.begin(), pairs.end(), pair) == pairs.end())
+                continue;
+
+            shard->push_change({subscription_change_t::REMOVE, pair, {}});
+            update_subscriptions(*shard, "unsubscribe", pair);
+        }
+    }
+
 
 private:
+    static constexpr const char* MARKET_TRADES_CHANNEL = "market_trades";
+
     std::vector<instrument_pair_t>       m_pairs;
-    std::array<std::string,2>            m_channels;
+    std::vector<std::string>             m_channels;
     std::string                          m_secret_key;
     std::string                          m_api_key;
-    std::unique_ptr<market_feed_socket>  m_socket;
-    std::unique_ptr<std::jthread>        m_thread;
-    std::stop_source                     m_stop_source;
-    std::unordered_map<std::string, orderbook_t> m_orderbooks;
+    std::vector<std::unique_ptr<feed_shard_t>> m_shards;
+    size_t                               m_connections;
+    shard_config_t                       m_sharding;
+    reactor_pool*                        m_reactor;
+    size_t                               m_reactor_index;
+    pipeline_config_t                    m_pipeline_config;
+    thread_placement_t                   m_placement;
+    busy_poll_config_t                   m_busy_poll;
+    reconnect_config_t                   m_reconnect;
+    ws_transport_t                       m_transport;
+    trade_tape_config_t                  m_trade_tape;
+    bar_config_t                         m_bars;
+    std::mutex                           m_subscription_mutex;
 
     std::vector<std::tuple<feed_event_t, feed_event_handler_t>>               m_handlers;
     std::vector<std::tuple<feed_event_t, feed_event_handler_ptr, std::any>> m_raw_handlers;
 
-    void _start_feed(const std::stop_token &stop_token)
+    const feed_shard_t& get_shard(size_t shard) const
+    {
+        if (m_shards.empty())
+            throw std::logic_error("feed has not been started");
+        return *m_shards.at(shard);
+    }
+
+    void create_shards()
+    {
+        std::lock_guard<std::mutex> lock{m_subscription_mutex};
+        const auto plan = plan_shards(m_pairs, m_channels.size(), m_sharding);
+        m_shards.clear();
+        for (size_t i = 0; i < plan.size(); ++i)
+        {
+            auto& shard = *m_shards.emplace_back(std::make_unique<feed_shard_t>(i, plan[i],
+                    [this, i](const Document& payload) { return message_handler(*m_shards[i], payload); },
+                    std::bind(&market_feed<coinbase_api>::apply_book_update, this, std::placeholders::_1),
+                    &market_feed<coinbase_api>::frame_key));
+
+            for (const auto& pair : plan[i])
+                add_book(shard, pair);
+
+            shard.pipeline.configure(m_pipeline_config);
+            if (m_reactor)
+                shard.reactor = &m_reactor->context((m_reactor_index + i) % m_reactor->size());
+
+            shard.create_sockets(coinbase_api::SOCKET_URI, m_connections, [this, &shard](market_feed_socket& socket, size_t connection) {
+                    socket.set_busy_poll(m_busy_poll);
+                    socket.set_reconnect(m_reconnect);
+                    socket.set_transport(m_transport);
+                    socket.set_reconnect_handler(std::bind(&market_feed<coinbase_api>::on_reconnect, this, std::ref(shard), connection));
+
+                    add_subscribe_messages(socket, shard.pairs());
+                });
+        }
+    }
+
+    shard_book_t& add_book(feed_shard_t& shard, const instrument_pair_t& pair)
+    {
+        auto [it, inserted] = shard.books.try_emplace(instrument_pair::to_coinbase(pair));
+        shard_book_t& entry = it->second;
+        if (inserted)
+        {
+            entry.book = std::make_unique<orderbook_t>(pair, coinbase_api::exchange_api_id);
+            entry.book->trades().configure(m_trade_tape.windows);
+            entry.book->bars().configure(m_bars);
+        }
+        entry.subscribed = true;
+        entry.live       = false;
+        return entry;
+    }
+
+    /**
+     * Send `type` for `pair` on every connection of `shard` and re-sign their opening
+     * messages for the current pair set, so a reconnect restores it.
+     */
+    void update_subscriptions(feed_shard_t& shard, const char* type, const instrument_pair_t& pair)
+    {
+        for (auto& socket_ptr : shard.sockets)
+        {
+            market_feed_socket& socket = *socket_ptr;
+            socket.post([this, &shard, &socket, type, pair]() {
+                    socket.clear_opening_messages();
+                    add_subscribe_messages(socket, shard.pairs());
+
+                    if (!socket.is_open())
+                        return;
+                    for (const auto& channel : m_channels)
+                        socket.send_json(subscription_message(type, channel, {pair}));
+                });
+        }
+    }
+
+    void on_reconnect(feed_shard_t& shard, size_t connection)
+    {
+        // subscriptions are signed with a timestamp, sign them again for the new connection.
+        // the snapshot that follows the subscription replaces the now stale books
+        market_feed_socket& socket = *shard.sockets[connection];
+        socket.clear_opening_messages();
+        add_subscribe_messages(socket, shard.pairs());
+    }
+
+    /**
+     * Frames carry no sequence shared across connections, `sequence_num` counts the
+     * messages of a connection. Never called as long as there is a single connection.
+     */
+    static bool frame_key(const char*, size_t, uint64_t&, uint64_t&)
     {
-        if (!m_socket)
-            throw std::runtime_error("_start_feed called in invalid state");
-        std::error_code ec;
-        m_socket->connect(ec);
+        return false;
+    }
+
+    void apply_book_update(book_update_t& update)
+    {
+        orderbook_t& book = *update.book;
+        if (update.event == feed_event_t::NONE)
+        {
+            // unsubscribed, nothing is published for the emptied book
+            book.clear();
+            return;
+        }
+
+        if (update.reset)
+            book.clear();
+        if (!update.levels.empty())
+            book.process_level_updates(update.levels.data(), update.levels.size());
+
+        bool top_changed = false;
+        if (update.has_top)
+            top_changed = book.update_top_of_book(update.top);
+        else if (update.reset || !update.levels.empty())
+            top_changed = book.sync_top_of_book(update.sequence, update.recv_ns);
+
+        bool bars_closed = false;
+        if (!update.trades.empty())
+        {
+            book.trades().add(update.trades.data(), update.trades.size());
+            bars_closed |= book.bars().on_trades(update.trades.data(), update.trades.size());
+        }
+        else
+        {
+            // let the windows decay while the pair isn't trading
+            book.trades().advance(update.recv_ns);
+        }
+        if (update.has_bar)
+            bars_closed |= book.bars().on_bar(update.bar);
+        if (top_changed && book.bars().source() == bar_source_t::BOOK)
+        {
+            const orderbook_t::top_of_book_t top = book.top_of_book();
+            bars_closed |= book.bars().on_quote(top.bid_price, top.ask_price, wall_clock_ms());
+        }
+
+        const int mask = (update.event & ~(feed_event_t::BBO_UPDATED | feed_event_t::BARS_UPDATED))
+                         | (top_changed ? feed_event_t::BBO_UPDATED : 0)
+                         | (bars_closed ? feed_event_t::BARS_UPDATED : 0);
+        notify_event_handlers(static_cast<feed_event_t::event_type>(mask), book);
     }
 
-    bool message_handler(const Document& json)
+    /**
+     * Apply pair set changes queued by `subscribe`/`unsubscribe`.
+     */
+    void process_subscription_changes(feed_shard_t& shard)
     {
+        std::vector<subscription_change_t> changes;
+        if (!shard.take_changes(changes))
+            return;
+
+        for (auto& change : changes)
+        {
+            if (change.kind == subscription_change_t::ADD)
+            {
+                add_book(shard, change.pair);
+                continue;
+            }
+
+            auto it = shard.books.find(instrument_pair::to_coinbase(change.pair));
+            if (change.kind != subscription_change_t::REMOVE || it == shard.books.end())
+                continue;
+
+            it->second.subscribed = false;
+            it->second.live       = false;
+            // the book is kept (updates for it may still be queued), emptied silently by the worker that owns it
+            book_update_t& update = shard.pipeline.begin_update(*it->second.book, feed_event_t::NONE);
+            update.reset = true;
+            shard.pipeline.commit_update();
+        }
+    }
+
+    bool message_handler(feed_shard_t& shard, const Document& json)
+    {
+        process_subscription_changes(shard);
+
         const bool has_channel = json.HasMember("channel");
         const bool has_type    = json.HasMember("type");
         if (!has_type && !has_channel)
@@ -134,12 +506,17 @@ private:
         if (!std::strncmp("l2_data", channel.GetString(), channel.GetStringLength()))
         {
             // maket feed data
-            process_l2_data_events(json["events"]);
+            process_l2_data_events(shard, json["events"]);
         }
         else if (!std::strncmp("ticker", channel.GetString(), channel.GetStringLength()))
         {
             // ticker data
-            process_tickers_data_events(json["events"]);
+            const int64_t time_ms = json.HasMember("timestamp") ? trade_time_ms(json["timestamp"]) : 0;
+            process_tickers_data_events(shard, json["events"], time_ms ? time_ms : wall_clock_ms());
+        }
+        else if (!std::strncmp("market_trades", channel.GetString(), channel.GetStringLength()))
+        {
+            process_market_trades_events(shard, json["events"]);
         }
         else if (!std::strncmp("subscriptions", channel.GetString(), channel.GetStringLength()))
         {
@@ -178,7 +555,7 @@ private:
         }
     }
 
-    void process_tickers_data_events(const Value& events)
+    void process_tickers_data_events(feed_shard_t& shard, const Value& events, int64_t time_ms)
     {
         // assert(events.IsArray())
         for (size_t i = 0; i < events.Size(); ++i)
@@ -201,8 +578,8 @@ private:
                 // assert(!strncmp("ticker", ticker["type"].GetString(), ticker["type"].GetStringLength())
                 const Value& product_id = ticker["product_id"];
 
-                decltype(m_orderbooks)::iterator key_val = m_orderbooks.find(std::string{product_id.GetString()});
-                if (key_val == m_orderbooks.end())
+                auto key_val = shard.books.find(std::string{product_id.GetString(), product_id.GetStringLength()});
+                if (key_val == shard.books.end() || !key_val->second.subscribed)
                     continue;
 
                 /**
@@ -219,15 +596,15 @@ private:
                  *     "price_percent_chg_24_h": "0.87241902500165"
                  *  }
                  */
-                orderbook_t& orderbook = key_val->second;
-                orderbook.process_ticker_update<coinbase_api>(ticker);
-                notify_event_handlers(feed_event_t::TICKER_UPDATED, orderbook);
+                book_update_t& update = shard.pipeline.begin_update(*key_val->second.book, feed_event_t::TICKER_UPDATED);
+                update.has_bar = orderbook_t::decode_bar<coinbase_api>(update.bar, ticker, time_ms);
+                shard.pipeline.commit_update();
             }
 
         }
     }
 
-    void process_l2_data_events(const Value& events)
+    void process_l2_data_events(feed_shard_t& shard, const Value& events)
     {
         // assert(events.IsArray())
         for (size_t i = 0; i < events.Size(); ++i)
@@ -238,20 +615,24 @@ private:
             const Value& type       = event["type"];
             const Value& product_id = event["product_id"];
 
-            decltype(m_orderbooks)::iterator key_val = m_orderbooks.find(std::string{product_id.GetString()});
-            if (key_val == m_orderbooks.end())
+            auto key_val = shard.books.find(std::string{product_id.GetString(), product_id.GetStringLength()});
+            if (key_val == shard.books.end() || !key_val->second.subscribed)
                 continue;
-            orderbook_t& orderbook = key_val->second;
+            shard_book_t& entry = key_val->second;
+            orderbook_t& orderbook = *entry.book;
 
-            if (!std::strncmp("update", type.GetString(), type.GetStringLength()))
-            {
-                orderbook.process_order_updates<coinbase_api>(event["updates"]);
-                notify_event_handlers(feed_event_t::ORDERS_UPDATED, orderbook);
-            }
-            else if (!std::strncmp("snapshot", type.GetString(), type.GetStringLength()))
+            const bool is_snapshot = !std::strncmp("snapshot", type.GetString(), type.GetStringLength());
+            if (is_snapshot)
+                entry.live = true;
+            if (!entry.live)
+                continue; // subscribed at runtime, waiting for the snapshot
+
+            if (is_snapshot || !std::strncmp("update", type.GetString(), type.GetStringLength()))
             {
-                orderbook.process_order_snapshot<coinbase_api>(event["updates"]);
-                notify_event_handlers(feed_event_t::ORDERS_UPDATED, orderbook);
+                book_update_t& update = shard.pipeline.begin_update(orderbook, feed_event_t::ORDERS_UPDATED);
+                update.reset = is_snapshot;
+                orderbook_t::decode_order_updates<coinbase_api>(update.levels, event["updates"]);
+                shard.pipeline.commit_update();
             }
             else
             {
@@ -260,35 +641,149 @@ private:
         }
     }
 
-    void add_subscribe_messages()
+    void process_market_trades_events(feed_shard_t& shard, const Value& events)
+    {
+        /**
+         * example market_trades event, `side` is the taker's side:
+         * {
+         *     "type": "update",
+         *     "trades": [
+         *         {
+         *             "trade_id": "000000000",
+         *             "product_id": "ETH-USD",
+         *             "price": "1260.01",
+         *             "size": "0.3",
+         *             "side": "BUY",
+         *             "time": "2019-08-14T20:42:27.265Z"
+         *         }
+         *     ]
+         * }
+         */
+        for (size_t i = 0; i < events.Size(); ++i)
+        {
+            const Value& trades = events[i]["trades"];
+            const size_t n = trades.Size();
+            if (n == 0)
+                continue;
+
+            // trades are listed newest first, the tape wants them in exchange order
+            const bool newest_first = trade_time_ms(trades[0]["time"]) > trade_time_ms(trades[n-1]["time"]);
+
+            shard_book_t* entry = nullptr;
+            book_update_t* update = nullptr;
+            std::string_view product {};
+            for (size_t j = 0; j < n; ++j)
+            {
+                const Value& trade = trades[newest_first ? n-1-j : j];
+                const Value& product_id = trade["product_id"];
+                const std::string_view id {product_id.GetString(), product_id.GetStringLength()};
+
+                // batch consecutive trades of the same product into one update
+                if (id != product)
+                {
+                    if (update)
+                        shard.pipeline.commit_update();
+                    update  = nullptr;
+                    product = id;
+
+                    auto key_val = shard.books.find(std::string{id});
+                    entry = key_val != shard.books.end() && key_val->second.subscribed ? &key_val->second : nullptr;
+                }
+                if (!entry)
+                    continue;
+
+                // the "snapshot" event sent on every (re)connect repeats recent trades, some
+                // of which were already applied
+                const int64_t trade_id = std::strtoll(trade["trade_id"].GetString(), nullptr, 10);
+                if (trade_id != 0 && trade_id <= entry->trade_id)
+                    continue;
+                entry->trade_id = std::max(entry->trade_id, trade_id);
+
+                if (!update)
+                    update = &shard.pipeline.begin_update(*entry->book, feed_event_t::TRADES_UPDATED);
+
+                const Value& side = trade["side"];
+                update->trades.push_back(trade_t{
+                        std::stold(trade["price"].GetString()),
+                        std::stold(trade["size"].GetString()),
+                        !std::strncmp("BUY", side.GetString(), side.GetStringLength()),
+                        trade_id,
+                        trade_time_ms(trade["time"]),
+                        update->recv_ns});
+            }
+            if (update)
+                shard.pipeline.commit_update();
+        }
+    }
+
+    /**
+     * Milliseconds since epoch of an RFC 3339 UTC time such as "2019-08-14T20:42:27.265Z",
+     * the fraction can have any number of digits. Returns 0 if malformed.
+     */
+    static int64_t trade_time_ms(const Value& time)
+    {
+        const char*  str = time.GetString();
+        const size_t len = time.GetStringLength();
+        if (len < 19 || str[4] != '-' || str[10] != 'T')
+            return 0;
+
+        auto number = [str](size_t pos, size_t digits) {
+            int value = 0;
+            for (size_t i = pos; i < pos + digits; ++i)
+                value = value * 10 + (str[i] - '0');
+            return value;
+        };
+
+        using namespace std::chrono;
+        const sys_days date {year{number(0, 4)} / month{static_cast<unsigned>(number(5, 2))} / day{static_cast<unsigned>(number(8, 2))}};
+        int64_t ms = (static_cast<int64_t>(date.time_since_epoch().count()) * 86400
+                      + number(11, 2) * 3600 + number(14, 2) * 60 + number(17, 2)) * 1000;
+
+        if (len > 20 && str[19] == '.')
+        {
+            int fraction = 0;
+            size_t digits = 0;
+            for (size_t i = 20; i < len && digits < 3 && std::isdigit(static_cast<unsigned char>(str[i])); ++i, ++digits)
+                fraction = fraction * 10 + (str[i] - '0');
+            for (; digits < 3; ++digits)
+                fraction *= 10;
+            ms += fraction;
+        }
+        return ms;
+    }
+
+    Document subscription_message(const char* type, const std::string& channel, const std::vector<instrument_pair_t>& products)
     {
         using namespace rapidjson;
         Document doc(Type::kObjectType);
         auto& alloc = doc.GetAllocator();
 
         Value pairs(kArrayType);
-        for (const auto& pair : m_pairs)
+        for (const auto& pair : products)
         {
             std::string pair_str {instrument_pair::to_coinbase(pair)};
             pairs.PushBack(Value().SetString(pair_str.c_str(), pair_str.length(), alloc), alloc);
         }
 
-        doc.AddMember("type", Value().SetString("subscribe"), alloc)
+        doc.AddMember("type", Value().SetString(type, alloc), alloc)
            .AddMember("product_ids", pairs, alloc)
+           .AddMember("channel", Value().SetString(channel.c_str(), channel.length(), alloc), alloc)
            .AddMember("user_id", Value().SetString(""), alloc)
            .AddMember("api_key", Value().SetString(m_api_key.c_str(), alloc), alloc);
+        time_stamp_and_sign(doc, channel, products);
+        return doc;
+    }
 
+    void add_subscribe_messages(market_feed_socket& socket, const std::vector<instrument_pair_t>& products)
+    {
+        if (products.empty())
+            return;
         for (const auto& channel : m_channels)
-        {
-            add_or_overwrite_member(doc, "channel", Value().SetString(channel.c_str(), channel.length(), alloc), alloc);
-            time_stamp_and_sign(doc, channel);
-
-            m_socket->add_opening_message_json(doc);
-        }
+            socket.add_opening_message_json(subscription_message("subscribe", channel, products));
     }
 
 
-    void time_stamp_and_sign(Document& msg, const std::string& channel)
+    void time_stamp_and_sign(Document& msg, const std::string& channel, const std::vector<instrument_pair_t>& products)
     {
         using namespace std::chrono;
         std::stringstream sig_plain;
@@ -300,10 +795,10 @@ private:
 
         sig_plain << channel;
 
-        for (int i = 0; i < m_pairs.size(); ++i)
+        for (int i = 0; i < products.size(); ++i)
         {
-            sig_plain << instrument_pair::to_coinbase(m_pairs[i]);
-            if (i+1 != m_pairs.size()) 
+            sig_plain << instrument_pair::to_coinbase(products[i]);
+            if (i+1 != products.size()) 
                 sig_plain << ",";
         }
 
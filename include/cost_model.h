@@ -0,0 +1,187 @@
+#ifndef _COST_MODEL_H
+#define _COST_MODEL_H
+
+#include "exchange_api.h"
+#include "seqlock.h"
+#include "logger.h"
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+/**
+ * What trading a pair on one venue costs and requires, see `cost_model_t`.
+ */
+struct venue_costs_t
+{
+    bool   loaded        {false}; // filled in by a successful refresh, trades are rejected until then
+    double taker_fee     {0};  // fraction of the notional
+    double price_step    {0};  // tick size, 0 when unknown
+    double qty_step      {0};  // lot size, 0 when unknown
+    double min_qty       {0};
+    double min_notional  {0};
+    double base_balance  {std::numeric_limits<double>::infinity()}; // available to sell
+    double quote_balance {std::numeric_limits<double>::infinity()}; // available to buy with
+};
+
+inline double floor_to_step(double value, double step)
+{ return step > 0 ? std::floor(value / step + 1e-9) * step : value; }
+
+inline double ceil_to_step(double value, double step)
+{ return step > 0 ? std::ceil(value / step - 1e-9) * step : value; }
+
+/**
+ * Two legs of a cross venue trade after `cost_model_t::apply`.
+ */
+struct trade_plan_t
+{
+    double quantity;   // multiple of both venues' lot sizes
+    double buy_limit;  // on the buy venue's tick grid
+    double sell_limit; // on the sell venue's tick grid
+    double net_profit; // after taker fees on both legs
+};
+
+/**
+ * Fee rates, rounding grids, minimums and balances of every (pair, venue), precomputed
+ * so an opportunity can be checked without building an order.
+ *
+ * The table is laid out like `arbitrage_engine_t`'s (MAX_VENUES entries per pair id) and
+ * each entry is published through a seqlock: `start_refresh` reloads it from the wallets
+ * on a background thread while the arbitrage thread keeps reading. Entries that were never
+ * `set` are unloaded and `apply` turns down any trade involving them.
+ */
+class cost_model_t
+{
+public:
+    static constexpr const size_t MAX_VENUES = 8;
+
+    typedef std::function<void(cost_model_t&)> refresh_t;
+
+    cost_model_t(size_t pairs)
+        : m_pairs{pairs}, m_costs{std::make_unique<seqlock<venue_costs_t>[]>(pairs * MAX_VENUES)}, m_refresher{}
+    { }
+
+    ~cost_model_t()
+    { stop_refresh(); }
+
+    cost_model_t(const cost_model_t&) = delete;
+    cost_model_t& operator=(const cost_model_t&) = delete;
+
+    size_t pairs() const
+    { return m_pairs; }
+
+    /**
+     * Mark the entry loaded with `costs`. Only ever called from one thread at a time (ie.
+     * the refresher).
+     */
+    void set(uint32_t pair_id, exchange_api_t exchange, const venue_costs_t& costs)
+    {
+        venue_costs_t loaded {costs};
+        loaded.loaded = true;
+        m_costs[index(pair_id, exchange)].store(loaded);
+    }
+
+    /**
+     * Hot path, unchecked: `pair_id` must be below `pairs()`, which the engine reading the
+     * model makes sure of when it is attached.
+     */
+    venue_costs_t get(uint32_t pair_id, exchange_api_t exchange) const
+    { return m_costs[pair_id * MAX_VENUES + static_cast<size_t>(exchange)].load(); }
+
+    /**
+     * Run `refresh` now and then every `interval` on a background thread until
+     * `stop_refresh`. Exceptions from `refresh` are logged, the previous costs stay.
+     */
+    void start_refresh(std::chrono::milliseconds interval, refresh_t refresh)
+    {
+        stop_refresh();
+        m_refresher = std::jthread([this, interval, refresh = std::move(refresh)](std::stop_token stop) {
+                std::mutex mutex;
+                std::condition_variable_any cv;
+                while (!stop.stop_requested())
+                {
+                    try {
+                        refresh(*this);
+                    } catch (const std::exception& e) {
+                        log("ERROR cost model refresh failed: {}", e.what());
+                    }
+
+                    std::unique_lock<std::mutex> lock{mutex};
+                    cv.wait_for(lock, stop, interval, [] { return false; });
+                }
+            });
+    }
+
+    void stop_refresh()
+    {
+        if (m_refresher.joinable())
+        {
+            m_refresher.request_stop();
+            m_refresher.join();
+        }
+    }
+
+    /**
+     * Fit `quantity` of a trade buying up to `buy_limit` on `buy` and selling down to
+     * `sell_limit` on `sell` to both venues' balances and lot sizes, and check it clears
+     * their minimums and still makes `min_profit` after fees. `buy_notional` and
+     * `sell_notional` are the value of the full `quantity` at the levels it sweeps, a
+     * reduced quantity is valued at the same average prices (which overstates its cost).
+     *
+     * Returns false if the trade isn't viable, `plan` is only filled in otherwise.
+     */
+    static bool apply(const venue_costs_t& buy, const venue_costs_t& sell,
+                      double quantity, double buy_limit, double sell_limit,
+                      double buy_notional, double sell_notional, double min_profit,
+                      trade_plan_t& plan)
+    {
+        if (quantity <= 0 || !buy.loaded || !sell.loaded)
+            return false;
+
+        const double buy_price  = buy_notional / quantity;
+        const double sell_price = sell_notional / quantity;
+
+        double q = std::min(quantity, std::min(sell.base_balance, buy.quote_balance / (buy_limit * (1 + buy.taker_fee))));
+        // lot sizes are powers of ten in practice, so the coarser grid lies on the finer one
+        q = floor_to_step(q, std::max(buy.qty_step, sell.qty_step));
+        q = floor_to_step(q, std::min(buy.qty_step, sell.qty_step));
+
+        const double net_profit = q * (sell_price * (1 - sell.taker_fee) - buy_price * (1 + buy.taker_fee));
+        const bool viable = (q > 0) & (q >= buy.min_qty) & (q >= sell.min_qty)
+                            & (q * buy_price >= buy.min_notional) & (q * sell_price >= sell.min_notional)
+                            & (net_profit > min_profit);
+        if (!viable)
+            return false;
+
+        plan.quantity   = q;
+        plan.buy_limit  = ceil_to_step(buy_limit, buy.price_step);
+        plan.sell_limit = floor_to_step(sell_limit, sell.price_step);
+        plan.net_profit = net_profit;
+        return true;
+    }
+
+private:
+    size_t                                     m_pairs;
+    std::unique_ptr<seqlock<venue_costs_t>[]>  m_costs;
+    std::jthread                               m_refresher;
+
+    size_t index(uint32_t pair_id, exchange_api_t exchange) const
+    {
+        const size_t venue = static_cast<size_t>(exchange);
+        if (pair_id >= m_pairs || venue >= MAX_VENUES)
+            throw std::out_of_range("cost model has no such pair or venue");
+        return pair_id * MAX_VENUES + venue;
+    }
+};
+
+#endif
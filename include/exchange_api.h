@@ -3,6 +3,10 @@
 
 #include "json.h"
 #include "logger.h"
+#include "bar_engine.h"
+#include "book_signals.h"
+#include "seqlock.h"
+#include "trade_tape.h"
 
 #include <cstring>
 
@@ -85,6 +89,12 @@ struct instrument {
         return *reinterpret_cast<const uint64_t*>(&lhs._buf) == *reinterpret_cast<const uint64_t*>(&rhs._buf);
     }
 
+    // the (up to 8 character) code packed into an integer, unique per instrument
+    uint64_t id() const
+    {
+        return *reinterpret_cast<const uint64_t*>(&_buf);
+    }
+
     private:
         uint8_t  _buf[instrument::BUF_BYTES];
 };
@@ -100,6 +110,15 @@ namespace instrument_pair {
     {
         return lhs.first == rhs.first && lhs.second == rhs.second;
     }
+
+    inline uint64_t hash(const instrument_pair_t& pair)
+    {
+        // splitmix64 finalizer over both codes
+        uint64_t h = pair.first.id() ^ (pair.second.id() * 0x9e3779b97f4a7c15ull);
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    }
 }
 
 inline bool operator==(const instrument_pair_t& lhs, const instrument_pair_t& rhs)
@@ -112,16 +131,22 @@ inline bool operator==(const instrument_pair_t& lhs, const instrument_pair_t& rh
 enum class exchange_api_t : int {
     COINBASE_ADVANCED,
     BINANCE,
-    WEBULL
+    WEBULL,
+    SYNTHETIC   // books derived from other books, see `synthetic_cross_feed`, keep last
 };
 
 namespace exchange_api {
+    // number of `exchange_api_t` values, for tables indexed by venue
+    constexpr const size_t COUNT = static_cast<size_t>(exchange_api_t::SYNTHETIC) + 1;
+
     constexpr const char* to_string(exchange_api_t id)
     {
         if (id == exchange_api_t::COINBASE_ADVANCED)
             return "Coinbase";
         if (id == exchange_api_t::BINANCE)
             return "Binance";
+        if (id == exchange_api_t::SYNTHETIC)
+            return "Synthetic";
         return "WeBull";
     }
 };
@@ -135,6 +160,8 @@ struct coinbase_api {
     static constexpr const char* GET_ORDER_PATH = "/api/v3/brokerage/orders/historical";
     static constexpr const char* GET_ACCOUNT_PATH = "/api/v3/brokerage/accounts";
     static constexpr const char* LIST_ACCOUNTS_PATH = "/api/v3/brokerage/accounts";
+    static constexpr const char* GET_PRODUCT_PATH = "/api/v3/brokerage/products";
+    static constexpr const char* TRANSACTION_SUMMARY_PATH = "/api/v3/brokerage/transaction_summary";
 };
 
 struct binance_api {
@@ -163,6 +190,14 @@ struct orderbook_t {
     typedef std::map<key_t, value_t> map_t;
     typedef std::pair<key_t, value_t> order_t;
 
+    // single decoded price level change, used to move updates between threads
+    struct level_update_t
+    {
+        double price;
+        double quantity;
+        bool   is_bid;
+    };
+
     static constexpr const size_t GUARDED_SUBSET_SIZE = 10;
     const exchange_api_t exchange;
     const instrument_pair_t pair;
@@ -182,10 +217,30 @@ struct orderbook_t {
         time_point        end;     // ending time poing for the interval
     };
 
+    /**
+     * Best bid/offer, published on its own so readers on other threads never wait on the book.
+     */
+    struct top_of_book_t
+    {
+        double  bid_price    {0};
+        double  bid_quantity {0};
+        double  ask_price    {0};
+        double  ask_quantity {0};
+        int64_t sequence     {0}; // exchange update id the quote is as of, 0 when unsequenced
+        int64_t recv_ns      {0};
+
+        bool same_quote(const top_of_book_t& other) const
+        {
+            return bid_price == other.bid_price && bid_quantity == other.bid_quantity
+                && ask_price == other.ask_price && ask_quantity == other.ask_quantity;
+        }
+    };
+
     orderbook_t(instrument_pair_t pair, exchange_api_t exchange_id)
         : exchange{exchange_id}, 
           pair {pair}, m_bid_map{}, m_ask_map{},
-          m_guarded_bids{}, m_guarded_asks{}
+          m_guarded_bids{}, m_guarded_asks{},
+          m_top{}, m_top_cache{}, m_trades{}, m_bars{}, m_signals{}
     {
         m_guarded_bids.reserve(GUARDED_SUBSET_SIZE);
         m_guarded_asks.reserve(GUARDED_SUBSET_SIZE);
@@ -200,6 +255,12 @@ struct orderbook_t {
     template <typename T, typename... Args>
     void process_ticker_update(Args&&...) requires is_exchange_api<T>;
 
+    template <typename T, typename... Args>
+    static void decode_order_updates(std::vector<level_update_t>&, Args&&...) requires is_exchange_api<T>;
+
+    template <typename T, typename... Args>
+    static bool decode_bar(bar_t&, Args&&...) requires is_exchange_api<T>;
+
 
     template <>
     void process_order_updates<coinbase_api>(const Value& updates)
@@ -225,6 +286,7 @@ struct orderbook_t {
 
         update_guarded_bids();
         update_guarded_asks();
+        update_signals();
     }
 
     template <>
@@ -263,6 +325,7 @@ struct orderbook_t {
             update_guarded_asks();
         }
 
+        update_signals();
     }
 
     template <>
@@ -278,16 +341,240 @@ struct orderbook_t {
     }
 
     template <>
-    void process_ticker_update<coinbase_api>(const Value& updates)
+    void decode_order_updates<coinbase_api>(std::vector<level_update_t>& dst, const Value& updates)
+    {
+        if (!updates.IsArray())
+            return;
+
+        for (size_t i = 0; i < updates.Size(); ++i)
+        {
+            const Value& update   = updates[i];
+            const Value& side     = update["side"];
+            const Value& price    = update["price_level"];
+            const Value& quantity = update["new_quantity"];
+
+            const double price_d    = std::stold(price.GetString());
+            const double quantity_d = std::stold(quantity.GetString());
+
+            if (!std::strncmp("bid", side.GetString(), side.GetStringLength()))
+                dst.push_back(level_update_t{price_d, quantity_d, true});
+            else if (!std::strncmp("offer", side.GetString(), side.GetStringLength()))
+                dst.push_back(level_update_t{price_d, quantity_d, false});
+        }
+    }
+
+    template <>
+    void decode_order_updates<binance_api>(std::vector<level_update_t>& dst, const Value& bids, const Value& asks)
+    {
+        if (bids.IsArray())
+        {
+            for (size_t i = 0; i < bids.Size(); ++i)
+            {
+                const Value& bid = bids[i];
+                if (!bid.IsArray()) continue;
+
+                dst.push_back(level_update_t{std::stold(bid[0].GetString()), std::stold(bid[1].GetString()), true});
+            }
+        }
+
+        if (asks.IsArray())
+        {
+            for (size_t i = 0; i < asks.Size(); ++i)
+            {
+                const Value& ask = asks[i];
+                if (!ask.IsArray()) continue;
+
+                dst.push_back(level_update_t{std::stold(ask[0].GetString()), std::stold(ask[1].GetString()), false});
+            }
+        }
+    }
+
+    /**
+     * Apply levels produced by `decode_order_updates`, only refreshes the guarded
+     * subset of the side(s) that were touched.
+     */
+    void process_level_updates(const level_update_t* levels, size_t n)
+    {
+        bool bids_touched = false;
+        bool asks_touched = false;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const level_update_t& level = levels[i];
+            if (level.is_bid)
+            {
+                update_bid(level.price, level.quantity);
+                bids_touched = true;
+            }
+            else
+            {
+                update_ask(level.price, level.quantity);
+                asks_touched = true;
+            }
+        }
+
+        if (bids_touched) update_guarded_bids();
+        if (asks_touched) update_guarded_asks();
+        if (bids_touched || asks_touched) update_signals();
+    }
+
+    /**
+     * Drop every level, used before applying a snapshot that replaces the whole book.
+     */
+    void clear()
+    {
+        m_bid_map.clear();
+        m_ask_map.clear();
+        update_guarded_bids();
+        update_guarded_asks();
+        update_signals();
+    }
+
+    /**
+     * Latest best bid/offer, safe to call from any thread.
+     */
+    top_of_book_t top_of_book() const
+    { return m_top.load(); }
+
+    /**
+     * Number of best bid/offer changes so far, a cheap way to poll for a new one.
+     */
+    uint64_t top_of_book_version() const
+    { return m_top.version(); }
+
+    /**
+     * Apply a best bid/offer quote (eg. Binance bookTicker) ahead of the depth stream.
+     * Quotes older than the current top are ignored. Returns true if the touch changed.
+     */
+    bool update_top_of_book(const top_of_book_t& quote)
+    {
+        if (quote.sequence && quote.sequence < m_top_cache.sequence)
+            return false;
+        return publish_top(quote);
+    }
+
+    /**
+     * Re-derive the top from the depth maps after updates as of `sequence`. The depth maps
+     * lag a direct quote, so the top is only taken over once they have caught up with it.
+     * Returns true if the touch changed.
+     */
+    bool sync_top_of_book(int64_t sequence, int64_t recv_ns)
+    {
+        if (sequence && sequence < m_top_cache.sequence)
+            return false;
+
+        top_of_book_t top {};
+        if (!m_bid_map.empty())
+        {
+            top.bid_price    = m_bid_map.crbegin()->first;
+            top.bid_quantity = m_bid_map.crbegin()->second;
+        }
+        if (!m_ask_map.empty())
+        {
+            top.ask_price    = m_ask_map.cbegin()->first;
+            top.ask_quantity = m_ask_map.cbegin()->second;
+        }
+        top.sequence = sequence ? sequence : m_top_cache.sequence;
+        top.recv_ns  = recv_ns;
+        return publish_top(top);
+    }
+
+    /**
+     * Executed trades and their rolling aggregates, see `trade_tape_t`.
+     */
+    trade_tape_t& trades()
+    { return m_trades; }
+
+    const trade_tape_t& trades() const
+    { return m_trades; }
+
+    /**
+     * OHLCV bars and momentum indicators, see `bar_engine_t`.
+     */
+    bar_engine_t& bars()
+    { return m_bars; }
+
+    const bar_engine_t& bars() const
+    { return m_bars; }
+
+    /**
+     * Microprice, imbalances and depth features kept up to date with the book, see
+     * `book_signal_engine_t`. `signals().latest()` is safe to call from any thread.
+     */
+    book_signal_engine_t& signals()
+    { return m_signals; }
+
+    const book_signal_engine_t& signals() const
+    { return m_signals; }
+
+    /**
+     * Last closed bar of `interval`, writer thread only (ie. event handlers).
+     */
+    ticker_t ticker(size_t interval) const
+    {
+        const bar_series_t& series = m_bars.series(interval);
+        if (!series.size())
+            return ticker_t{pair, 0, 0, 0, 0, 0, 0, {}, {}};
+
+        const bar_t& bar = series.bar(0);
+        using std::chrono::duration_cast, std::chrono::seconds, std::chrono::milliseconds;
+        return ticker_t{pair, bar.vwap(), bar.low, bar.high, bar.open, bar.close, bar.volume,
+                        ticker_t::time_point{duration_cast<seconds>(milliseconds{bar.start_ms})},
+                        ticker_t::time_point{duration_cast<seconds>(milliseconds{bar.end_ms})}};
+    }
+
+    template <>
+    void process_ticker_update<coinbase_api>(const Value& ticker, int64_t time_ms)
     {
-        // TODO: coinbase doesn't price much informaiton (like opening price/closing price) or
-        //       a configurable time window, calculate it ourselves based on local order book?
+        bar_t part;
+        if (decode_bar<coinbase_api>(part, ticker, time_ms))
+            m_bars.on_bar(part);
     }
 
     template <>
     void process_ticker_update<binance_api>(const Value& update)
     {
-        // TODO
+        bar_t part;
+        if (decode_bar<binance_api>(part, update["k"]))
+            m_bars.on_bar(part);
+    }
+
+    /**
+     * Coinbase tickers only carry the last price (and 24h statistics), each becomes a
+     * point bar at the event's `time_ms` without volume.
+     */
+    template <>
+    bool decode_bar<coinbase_api>(bar_t& dst, const Value& ticker, int64_t time_ms)
+    {
+        if (!ticker.HasMember("price"))
+            return false;
+
+        dst = bar_t{};
+        dst.start_ms = dst.end_ms = time_ms;
+        dst.open = dst.high = dst.low = dst.close = std::stod(ticker["price"].GetString());
+        return true;
+    }
+
+    /**
+     * Binance pushes the running kline every second, only closed ones are decoded so
+     * volumes are never counted twice.
+     */
+    template <>
+    bool decode_bar<binance_api>(bar_t& dst, const Value& kline)
+    {
+        if (!kline.IsObject() || !kline["x"].GetBool())
+            return false;
+
+        dst.start_ms = kline["t"].GetInt64();
+        dst.end_ms   = kline["T"].GetInt64() + 1;
+        dst.open     = std::stod(kline["o"].GetString());
+        dst.high     = std::stod(kline["h"].GetString());
+        dst.low      = std::stod(kline["l"].GetString());
+        dst.close    = std::stod(kline["c"].GetString());
+        dst.volume   = std::stod(kline["v"].GetString());
+        dst.notional = std::stod(kline["q"].GetString());
+        dst.trades   = kline["n"].GetUint64();
+        return true;
     }
 
 
@@ -337,13 +624,36 @@ struct orderbook_t {
 private:
     map_t m_bid_map;
     map_t m_ask_map;
-    //ticker_t m_ticker;
 
     std::vector<order_t>  m_guarded_bids;
     std::vector<order_t>  m_guarded_asks;
     mutable std::mutex    m_mutex_bids;
     mutable std::mutex    m_mutex_asks;
 
+    seqlock<top_of_book_t> m_top;
+    top_of_book_t          m_top_cache; // writer's copy of `m_top`
+    trade_tape_t           m_trades;
+    bar_engine_t           m_bars;
+    book_signal_engine_t   m_signals;
+
+    bool publish_top(const top_of_book_t& top)
+    {
+        const bool changed = !top.same_quote(m_top_cache);
+        m_top_cache = top;
+        if (changed)
+        {
+            m_top.store(top);
+            m_signals.on_top(top.bid_price, top.bid_quantity, top.ask_price, top.ask_quantity, top.recv_ns);
+        }
+        return changed;
+    }
+
+    // the guarded levels are only written by this thread, no need to lock them here
+    void update_signals()
+    {
+        m_signals.on_levels(m_guarded_bids.data(), m_guarded_bids.size(), m_guarded_asks.data(), m_guarded_asks.size());
+    }
+
     void update_bid(double price, double quantity)
     {
         decltype(m_bid_map)::iterator it {m_bid_map.find(price)};
@@ -425,8 +735,12 @@ typedef bool(*feed_event_handler_ptr)(const orderbook_t&, std::any& state);
 
 struct feed_event_t {
     enum event_type : int8_t {
+        NONE=0x0,
         ORDERS_UPDATED=0x1,
         TICKER_UPDATED=0x2,
+        BBO_UPDATED=0x4,    // best bid/offer changed, see `orderbook_t::top_of_book`
+        TRADES_UPDATED=0x8, // new trades on `orderbook_t::trades`
+        BARS_UPDATED=0x10,  // a bar closed on `orderbook_t::bars`
         ALL=-1,
     };
 
@@ -465,13 +779,13 @@ struct feed_event_t {
  */
 template <typename MarketFeed>
 concept is_market_feed = requires (MarketFeed mf, feed_event_handler_t handler, feed_event_t et,
-        feed_event_handler_ptr raw_handler)
+        feed_event_handler_ptr raw_handler, std::any state)
 {
     mf.start_feed();
     mf.join();
     mf.close();
     mf.register_event_handler(et, handler);
-    mf.register_raw_event_handler(et, raw_handler);
+    mf.register_raw_event_handler(et, raw_handler, state);
 };
 
 #endif
@@ -0,0 +1,156 @@
+#ifndef _FEED_ARBITER_H
+#define _FEED_ARBITER_H
+
+#include "thread_util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * Merges N redundant connections carrying the same market data into a single stream.
+ *
+ * Every frame is reduced to the stream it belongs to and a sequence number that increases
+ * monotonically within that stream (eg. the update id of a depth stream). The sequence
+ * must be assigned by the exchange for the stream as a whole, a per connection counter
+ * can't be compared across connections and restarts with every reconnect. Each stream
+ * keeps the highest sequence forwarded so far: a frame above it is forwarded, anything at
+ * or below it is a copy (or an older update) that another connection already delivered
+ * and is dropped and counted as lag for its connection. So a duplicate is never applied
+ * twice however late it arrives. Frames without a key (subscription acks, errors, ...)
+ * are always forwarded.
+ *
+ * All connections are expected to be driven by the same thread.
+ */
+class feed_arbiter
+{
+public:
+    // returns false when the frame has no key, `data[len]` is '\0'
+    typedef std::function<bool(const char* data, size_t len, uint64_t& stream, uint64_t& sequence)> key_extractor_t;
+    typedef std::function<bool(char* data, size_t len)> frame_handler_t;
+
+    struct connection_stats_t
+    {
+        std::atomic<uint64_t> frames       {0}; // keyed frames received
+        std::atomic<uint64_t> wins         {0}; // frames that arrived first and were forwarded
+        std::atomic<uint64_t> duplicates   {0};
+        std::atomic<uint64_t> lag_total_ns {0}; // how far behind the stream's latest forwarded frame the duplicates were
+        std::atomic<uint64_t> lag_max_ns   {0};
+
+        double win_rate() const
+        {
+            const uint64_t n = frames.load(std::memory_order_relaxed);
+            return n ? static_cast<double>(wins.load(std::memory_order_relaxed)) / n : 0.0;
+        }
+
+        double mean_lag_ns() const
+        {
+            const uint64_t n = duplicates.load(std::memory_order_relaxed);
+            return n ? static_cast<double>(lag_total_ns.load(std::memory_order_relaxed)) / n : 0.0;
+        }
+    };
+
+    feed_arbiter(key_extractor_t key_extractor, frame_handler_t handler)
+        : m_key_extractor{key_extractor}, m_handler{handler}, m_stats{}, m_marks{}
+    {
+        configure(1);
+    }
+
+    /**
+     * Set the number of connections and reset the statistics. Not thread-safe, call
+     * before the connections are started.
+     */
+    void configure(size_t connections)
+    {
+        if (connections == 0)
+            throw std::invalid_argument("feed_arbiter needs at least one connection");
+
+        m_stats.clear();
+        for (size_t i = 0; i < connections; ++i)
+            m_stats.emplace_back(std::make_unique<connection_stats_t>());
+        m_marks.clear();
+    }
+
+    /**
+     * Forget the highest sequence forwarded on every stream, for when all connections were
+     * lost and the streams start over. Must be called from the thread driving the connections.
+     */
+    void reset()
+    {
+        m_marks.clear();
+    }
+
+    size_t connections() const
+    { return m_stats.size(); }
+
+    const connection_stats_t& stats(size_t connection) const
+    { return *m_stats.at(connection); }
+
+    /**
+     * Called with every frame received on `connection`.
+     * Returns false if the handler asked for the connection to be closed.
+     */
+    bool on_frame(size_t connection, char* data, size_t len)
+    {
+        // nothing to arbitrate, stay out of the way
+        if (m_stats.size() == 1)
+            return m_handler(data, len);
+
+        uint64_t stream, sequence;
+        if (!m_key_extractor(data, len, stream, sequence))
+            return m_handler(data, len);
+
+        connection_stats_t& stats = *m_stats[connection];
+        stats.frames.fetch_add(1, std::memory_order_relaxed);
+
+        // a stream is only ever added once, then updated in place
+        const int64_t now = steady_now_ns();
+        auto [it, inserted] = m_marks.try_emplace(stream, mark_t{sequence, now});
+        mark_t& mark = it->second;
+        if (!inserted && sequence <= mark.sequence)
+        {
+            // a lower bound when the copy is older than the latest forwarded frame
+            const uint64_t lag = static_cast<uint64_t>(now - mark.forwarded_ns);
+            stats.duplicates.fetch_add(1, std::memory_order_relaxed);
+            stats.lag_total_ns.fetch_add(lag, std::memory_order_relaxed);
+            if (lag > stats.lag_max_ns.load(std::memory_order_relaxed))
+                stats.lag_max_ns.store(lag, std::memory_order_relaxed);
+            return true;
+        }
+
+        mark.sequence     = sequence;
+        mark.forwarded_ns = now;
+        stats.wins.fetch_add(1, std::memory_order_relaxed);
+
+        return m_handler(data, len);
+    }
+
+    static uint64_t fnv1a(const char* data, size_t len, uint64_t hash = 0xcbf29ce484222325ull)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+private:
+    struct mark_t
+    {
+        uint64_t sequence;     // highest forwarded so far
+        int64_t  forwarded_ns;
+    };
+
+    key_extractor_t m_key_extractor;
+    frame_handler_t m_handler;
+    std::vector<std::unique_ptr<connection_stats_t>> m_stats;
+    std::unordered_map<uint64_t, mark_t> m_marks; // by stream
+};
+
+#endif
@@ -0,0 +1,381 @@
+#ifndef _FEED_PIPELINE_H
+#define _FEED_PIPELINE_H
+
+#include "exchange_api.h"
+#include "spsc_queue.h"
+#include "thread_util.h"
+#include "json.h"
+#include "logger.h"
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+struct pipeline_config_t
+{
+    bool   enabled      {false}; // when false everything runs inline on the I/O thread
+    bool   parse_stage  {true};  // parse on a dedicated thread, otherwise the I/O thread parses and routes
+    size_t book_workers {1};     // number of book stage threads, books are sharded across them by pair
+    thread_placement_t parse_thread {thread_config_t{}[thread_role::PARSE]};
+    thread_placement_t book_threads {thread_config_t{}[thread_role::BOOK]}; // worker i uses book_threads.cpu(i)
+};
+
+/**
+ * Per-stage latency counters, written by the stage's thread(s) and readable from any thread.
+ */
+struct stage_stats_t
+{
+    std::atomic<uint64_t> count    {0};
+    std::atomic<uint64_t> total_ns {0};
+    std::atomic<uint64_t> max_ns   {0};
+    std::atomic<uint64_t> stalls   {0}; // times the stage had to wait on a full downstream queue
+
+    void record(int64_t ns)
+    {
+        const uint64_t val = ns > 0 ? static_cast<uint64_t>(ns) : 0;
+        count.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(val, std::memory_order_relaxed);
+        // the book workers share their stage's counters
+        uint64_t max = max_ns.load(std::memory_order_relaxed);
+        while (val > max && !max_ns.compare_exchange_weak(max, val, std::memory_order_relaxed))
+            ;
+    }
+
+    double mean_ns() const
+    {
+        const uint64_t n = count.load(std::memory_order_relaxed);
+        return n ? static_cast<double>(total_ns.load(std::memory_order_relaxed)) / n : 0.0;
+    }
+};
+
+struct raw_frame_t
+{
+    std::string payload;
+    int64_t     recv_ns;
+};
+
+/**
+ * Decoded changes for one orderbook, produced by the parse stage and applied by the book stage.
+ */
+struct book_update_t
+{
+    orderbook_t*                             book;
+    feed_event_t::event_type                 event;
+    std::vector<orderbook_t::level_update_t> levels;
+    bool                                     reset;    // clear the book before applying `levels` (snapshots)
+    int64_t                                  sequence; // exchange update id of `levels`, 0 when unsequenced
+    bool                                     has_top;  // `top` is a direct best bid/offer quote
+    orderbook_t::top_of_book_t               top;
+    std::vector<trade_t>                     trades;
+    bool                                     has_bar;  // `bar` is a kline or ticker from the exchange
+    bar_t                                    bar;
+    int64_t                                  recv_ns;
+    int64_t                                  decoded_ns;
+};
+
+/**
+ * Splits the work of a market feed into three stages:
+ *     I/O   -> reads frames off the websocket (the thread running the socket)
+ *     parse -> parses json and decodes it into `book_update_t`s
+ *     book  -> applies updates to the orderbooks and runs the feed event handlers
+ *
+ * Frames go from I/O to parse, and updates from parse to book, over SPSC rings so each
+ * stage can sit on its own core. When the pipeline is not enabled all three stages
+ * run inline on the I/O thread and no additional threads are spawned.
+ *
+ * The book stage can be split into several workers, each pair is hashed to one worker
+ * which is then the only thread that touches that pair's orderbook and runs its event
+ * handlers. Without a parse stage the I/O thread parses and only routes the decoded
+ * updates to the workers.
+ *
+ * The parse handler is invoked with each parsed message and should call `begin_update`/
+ * `commit_update` for every book it touches. The apply handler is invoked in the book
+ * stage with each committed update.
+ */
+class feed_pipeline
+{
+public:
+    typedef std::function<bool(const Document&)> parse_handler_t;
+    typedef std::function<void(book_update_t&)>  apply_handler_t;
+
+    static constexpr const size_t FRAME_QUEUE_SIZE  = 1024;
+    static constexpr const size_t UPDATE_QUEUE_SIZE = 1024;
+    static constexpr const size_t PARSE_BUFFER_SIZE = 1 << 16;
+    static constexpr const size_t IDLE_SPINS        = 1 << 10;
+
+    stage_stats_t parse_stats;
+    stage_stats_t book_stats; // aggregated over all book workers
+
+    feed_pipeline(parse_handler_t parse_handler, apply_handler_t apply_handler)
+        : parse_stats{}, book_stats{},
+          m_parse_handler{parse_handler}, m_apply_handler{apply_handler},
+          m_config{}, m_frames{nullptr}, m_workers{},
+          m_parse_thread{nullptr},
+          m_inline_update{}, m_pending_update{nullptr}, m_pending_worker{nullptr},
+          m_close_requested{false}, m_parse_buffer{nullptr}
+    { }
+
+    void configure(const pipeline_config_t& config)
+    {
+        if (running())
+            throw std::logic_error("tried to configure pipeline while it is running");
+        if (config.book_workers == 0)
+            throw std::invalid_argument("pipeline needs at least one book worker");
+        m_config = config;
+    }
+
+    bool pipelined() const
+    { return m_config.enabled; }
+
+    bool running() const
+    { return m_parse_thread || !m_workers.empty(); }
+
+    size_t book_workers() const
+    { return m_config.enabled ? m_config.book_workers : 1; }
+
+    /**
+     * Index of the book worker that owns the book for `pair`.
+     */
+    size_t worker_of(const instrument_pair_t& pair) const
+    {
+        return instrument_pair::hash(pair) % book_workers();
+    }
+
+    void start()
+    {
+        m_close_requested.store(false, std::memory_order_relaxed);
+        if (!m_config.enabled)
+            return;
+
+        if (running())
+            throw std::logic_error("pipeline started when it is already running");
+
+        if (!m_parse_buffer) m_parse_buffer = std::make_unique<char[]>(PARSE_BUFFER_SIZE);
+
+        for (size_t i = 0; i < m_config.book_workers; ++i)
+        {
+            book_worker_t& worker = *m_workers.emplace_back(std::make_unique<book_worker_t>());
+            worker.thread = std::make_unique<std::jthread>(
+                    [this, &worker, i](std::stop_token stoken) { _run_book_stage(stoken, worker, i); });
+        }
+
+        if (m_config.parse_stage)
+        {
+            if (!m_frames) m_frames = std::make_unique<spsc_queue<raw_frame_t, FRAME_QUEUE_SIZE>>();
+            m_parse_thread = std::make_unique<std::jthread>([this](std::stop_token stoken) { _run_parse_stage(stoken); });
+        }
+    }
+
+    /**
+     * Stop the stage threads once they have drained whatever is already queued.
+     * Should be called after the I/O thread has stopped producing frames.
+     */
+    void stop()
+    {
+        // parse stage has to finish first since it feeds the book stage
+        if (m_parse_thread)
+        {
+            m_parse_thread->request_stop();
+            m_parse_thread->join();
+            m_parse_thread = nullptr;
+        }
+
+        for (auto& worker : m_workers)
+            worker->thread->request_stop();
+        for (auto& worker : m_workers)
+            worker->thread->join();
+        m_workers.clear();
+    }
+
+    /**
+     * Called from the I/O thread with every websocket frame. `data[len]` must be '\0'.
+     * Returns false if the feed asked for the connection to be closed.
+     */
+    bool on_frame(char* data, size_t len)
+    {
+        if (!m_config.enabled)
+        {
+            m_current_recv_ns = steady_now_ns();
+
+            Document json;
+            json.ParseInsitu(data);
+
+            if (!m_parse_handler(json))
+                m_close_requested.store(true, std::memory_order_relaxed);
+
+            return !m_close_requested.load(std::memory_order_relaxed);
+        }
+
+        if (!m_config.parse_stage)
+        {
+            // parse here and only route the decoded updates to the book workers
+            m_current_recv_ns = steady_now_ns();
+            parse(data);
+            parse_stats.record(steady_now_ns() - m_current_recv_ns);
+
+            return !m_close_requested.load(std::memory_order_relaxed);
+        }
+
+        const int64_t now = steady_now_ns();
+        raw_frame_t* slot;
+        while (!(slot = m_frames->write_slot()))
+        {
+            // apply backpressure to the socket rather than dropping frames,
+            // a dropped frame would leave the book out of sync
+            parse_stats.stalls.fetch_add(1, std::memory_order_relaxed);
+            cpu_relax();
+        }
+
+        // assign() reuses the capacity of the slot's string
+        slot->payload.assign(data, len + 1);
+        slot->recv_ns = now;
+        m_frames->commit_write();
+
+        return !m_close_requested.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Called from the parse handler. Returns the update to be filled in for `book`,
+     * which is handed to the book stage by `commit_update`.
+     */
+    book_update_t& begin_update(orderbook_t& book, feed_event_t::event_type event)
+    {
+        book_update_t* update = &m_inline_update;
+        if (m_config.enabled)
+        {
+            m_pending_worker = m_workers[worker_of(book.pair)].get();
+            while (!(update = m_pending_worker->updates.write_slot()))
+            {
+                book_stats.stalls.fetch_add(1, std::memory_order_relaxed);
+                cpu_relax();
+            }
+        }
+
+        update->book     = &book;
+        update->event    = event;
+        update->recv_ns  = m_current_recv_ns;
+        update->reset    = false;
+        update->sequence = 0;
+        update->has_top  = false;
+        update->has_bar  = false;
+        update->levels.clear();
+        update->trades.clear();
+        m_pending_update = update;
+
+        return *update;
+    }
+
+    void commit_update()
+    {
+        if (!m_pending_update)
+            throw std::logic_error("commit_update called without begin_update");
+
+        book_update_t* update = m_pending_update;
+        m_pending_update = nullptr;
+        update->decoded_ns = steady_now_ns();
+
+        if (!m_config.enabled)
+        {
+            m_apply_handler(*update);
+            book_stats.record(steady_now_ns() - update->decoded_ns);
+            return;
+        }
+
+        m_pending_worker->updates.commit_write();
+    }
+
+private:
+    parse_handler_t m_parse_handler;
+    apply_handler_t m_apply_handler;
+    pipeline_config_t m_config;
+
+    struct book_worker_t
+    {
+        spsc_queue<book_update_t, UPDATE_QUEUE_SIZE> updates;
+        std::unique_ptr<std::jthread>                thread;
+    };
+
+    std::unique_ptr<spsc_queue<raw_frame_t, FRAME_QUEUE_SIZE>> m_frames;
+    std::vector<std::unique_ptr<book_worker_t>> m_workers;
+    std::unique_ptr<std::jthread> m_parse_thread;
+
+    book_update_t     m_inline_update;
+    book_update_t*    m_pending_update;
+    book_worker_t*    m_pending_worker;
+    int64_t           m_current_recv_ns {0};
+    std::atomic<bool> m_close_requested;
+
+    // arena for the parsed json so the parse stage doesn't allocate per message
+    std::unique_ptr<char[]> m_parse_buffer;
+
+    void _run_parse_stage(const std::stop_token& stoken)
+    {
+        apply_thread_placement(m_config.parse_thread);
+
+        size_t idle = 0;
+        while (true)
+        {
+            raw_frame_t* frame = m_frames->read_slot();
+            if (!frame)
+            {
+                if (stoken.stop_requested())
+                    break;
+                if (++idle < IDLE_SPINS) cpu_relax();
+                else std::this_thread::yield();
+                continue;
+            }
+            idle = 0;
+
+            m_current_recv_ns = frame->recv_ns;
+            parse(frame->payload.data());
+            m_frames->commit_read();
+
+            parse_stats.record(steady_now_ns() - m_current_recv_ns);
+        }
+    }
+
+    void parse(char* data)
+    {
+        rapidjson::MemoryPoolAllocator<> alloc {m_parse_buffer.get(), PARSE_BUFFER_SIZE};
+        Document json {&alloc};
+        json.ParseInsitu(data);
+
+        if (!m_parse_handler(json))
+            m_close_requested.store(true, std::memory_order_relaxed);
+    }
+
+    void _run_book_stage(const std::stop_token& stoken, book_worker_t& worker, size_t index)
+    {
+        apply_thread_placement(m_config.book_threads, index);
+
+        size_t idle = 0;
+        while (true)
+        {
+            book_update_t* update = worker.updates.read_slot();
+            if (!update)
+            {
+                // the producer (parse stage or I/O thread) is done before stop is
+                // requested here, so an empty queue means there is nothing left to drain
+                if (stoken.stop_requested())
+                    break;
+                if (++idle < IDLE_SPINS) cpu_relax();
+                else std::this_thread::yield();
+                continue;
+            }
+            idle = 0;
+
+            m_apply_handler(*update);
+            book_stats.record(steady_now_ns() - update->decoded_ns);
+
+            worker.updates.commit_read();
+        }
+    }
+};
+
+#endif
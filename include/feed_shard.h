@@ -0,0 +1,306 @@
+#ifndef _FEED_SHARD_H
+#define _FEED_SHARD_H
+
+#include "exchange_api.h"
+#include "feed_pipeline.h"
+#include "feed_arbiter.h"
+#include "market_socket.h"
+#include "thread_util.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+struct shard_config_t
+{
+    size_t              max_streams_per_connection {0}; // 0 for no limit
+    double              max_rate_per_connection    {0}; // messages per second, 0 for no limit
+    std::vector<double> pair_rates;                     // measured messages per second of each of the feed's pairs, in order
+};
+
+/**
+ * Split `pairs` into the fewest connections that respect the limits in `config`, each pair
+ * carrying `streams_per_pair` streams/subscriptions. Pairs are spread heaviest first onto
+ * the least loaded connection so the message rate ends up roughly even.
+ */
+inline std::vector<std::vector<instrument_pair_t>> plan_shards(const std::vector<instrument_pair_t>& pairs,
+        size_t streams_per_pair, const shard_config_t& config)
+{
+    if (pairs.empty())
+        return {{}};
+
+    std::vector<double> rates {config.pair_rates};
+    if (rates.size() != pairs.size())
+        rates.assign(pairs.size(), 1.0);
+
+    const size_t pairs_per_shard = config.max_streams_per_connection
+        ? std::max<size_t>(1, config.max_streams_per_connection / std::max<size_t>(1, streams_per_pair))
+        : pairs.size();
+
+    size_t shards = (pairs.size() + pairs_per_shard - 1) / pairs_per_shard;
+    if (config.max_rate_per_connection > 0 && config.pair_rates.size() == pairs.size())
+    {
+        const double total = std::accumulate(rates.begin(), rates.end(), 0.0);
+        shards = std::max(shards, static_cast<size_t>(std::ceil(total / config.max_rate_per_connection)));
+    }
+    shards = std::clamp<size_t>(shards, 1, pairs.size());
+
+    std::vector<size_t> order(pairs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&rates](size_t lhs, size_t rhs) { return rates[lhs] > rates[rhs]; });
+
+    std::vector<std::vector<instrument_pair_t>> plan(shards);
+    std::vector<double> load(shards, 0.0);
+    for (size_t i : order)
+    {
+        size_t best = shards;
+        for (size_t s = 0; s < plan.size(); ++s)
+        {
+            if (plan[s].size() >= pairs_per_shard)
+                continue;
+            if (best == shards || load[s] < load[best])
+                best = s;
+        }
+
+        if (best == shards)
+        {
+            // every connection is full
+            best = plan.size();
+            plan.emplace_back();
+            load.push_back(0.0);
+        }
+
+        plan[best].push_back(pairs[i]);
+        load[best] += rates[i];
+    }
+
+    return plan;
+}
+
+/**
+ * Depth diff received while its book was waiting on a snapshot.
+ */
+struct buffered_diff_t
+{
+    int64_t                                  first_id; // first and final exchange update id it covers
+    int64_t                                  final_id;
+    std::vector<orderbook_t::level_update_t> levels;
+};
+
+/**
+ * A book as seen by the thread parsing a shard's frames.
+ */
+struct shard_book_t
+{
+    std::unique_ptr<orderbook_t> book;
+    bool    subscribed {true};
+    bool    live       {false}; // snapshot applied, updates are published
+    bool    warming    {false}; // its snapshot is still being fetched (runtime subscription or resync)
+    int64_t sequence   {0};     // exchange sequence number the snapshot was taken at
+    int64_t applied    {0};     // final update id of the last diff applied on top of it
+    int64_t trade_id   {0};     // last trade published, trades replayed up to it are dropped
+    std::vector<buffered_diff_t> buffered; // diffs received while warming, replayed on top of the snapshot
+};
+
+/**
+ * Pair set change handed from the subscribing thread (or a warm-up task) to the thread
+ * parsing the shard's frames.
+ */
+struct subscription_change_t
+{
+    enum kind_t { ADD, REMOVE, SNAPSHOT };
+
+    kind_t            kind;
+    instrument_pair_t pair;
+    std::string       payload; // SNAPSHOT only
+};
+
+/**
+ * One connection's worth of a market feed: a subset of its pairs with their own sockets
+ * (redundant copies of the same subscription), arbiter, pipeline and I/O thread. Every
+ * pair's book belongs to exactly one shard, so shards never touch each other's state.
+ */
+struct feed_shard_t
+{
+    typedef std::function<void(market_feed_socket&, size_t connection)> socket_setup_t;
+
+    feed_shard_t(size_t index, const std::vector<instrument_pair_t>& pairs,
+            feed_pipeline::parse_handler_t parse_handler, feed_pipeline::apply_handler_t apply_handler,
+            feed_arbiter::key_extractor_t key_extractor)
+        : index{index}, initial_pairs{pairs}, pipeline{parse_handler, apply_handler},
+          arbiter{key_extractor, std::bind(&feed_pipeline::on_frame, &pipeline, std::placeholders::_1, std::placeholders::_2)},
+          sockets{}, reactor{nullptr}, own_io_context{nullptr}, thread{nullptr}, resync{true},
+          books{}, m_mutex{}, m_pairs{pairs}, m_changes{}, m_has_changes{false}
+    { }
+
+    const size_t                                     index;
+    const std::vector<instrument_pair_t>             initial_pairs;  // pairs the connections were opened with
+    feed_pipeline                                    pipeline;
+    feed_arbiter                                     arbiter;
+    std::vector<std::unique_ptr<market_feed_socket>> sockets;
+    asio::io_context*                                reactor;        // set when the sockets run on a reactor_pool
+    std::unique_ptr<asio::io_context>                own_io_context; // shared by redundant sockets when not on a reactor
+    std::unique_ptr<std::jthread>                    thread;
+    std::atomic<bool>                                resync;         // books need a fresh snapshot
+    std::unordered_map<std::string, shard_book_t>    books;          // only touched by the thread parsing the frames
+
+    /**
+     * Pairs currently subscribed on the shard's connections.
+     */
+    std::vector<instrument_pair_t> pairs() const
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        return m_pairs;
+    }
+
+    size_t pair_count() const
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        return m_pairs.size();
+    }
+
+    /**
+     * Queue a change for the parsing thread, ADD and REMOVE also update `pairs()`.
+     */
+    void push_change(subscription_change_t change)
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        if (change.kind == subscription_change_t::ADD)
+            m_pairs.push_back(change.pair);
+        else if (change.kind == subscription_change_t::REMOVE)
+            std::erase(m_pairs, change.pair);
+        m_changes.push_back(std::move(change));
+        m_has_changes.store(true, std::memory_order_release);
+    }
+
+    /**
+     * Move the queued changes into `changes`, cheap when there are none.
+     */
+    bool take_changes(std::vector<subscription_change_t>& changes)
+    {
+        if (!m_has_changes.load(std::memory_order_acquire))
+            return false;
+
+        std::lock_guard<std::mutex> lock{m_mutex};
+        changes.swap(m_changes);
+        m_changes.clear();
+        m_has_changes.store(false, std::memory_order_relaxed);
+        return !changes.empty();
+    }
+
+    void create_sockets(const std::string& uri, size_t connections, socket_setup_t setup)
+    {
+        asio::io_context* io_context = reactor;
+        own_io_context = nullptr;
+        if (!io_context && connections > 1)
+        {
+            own_io_context = std::make_unique<asio::io_context>();
+            io_context = own_io_context.get();
+        }
+
+        sockets.clear();
+        arbiter.configure(connections);
+        for (size_t i = 0; i < connections; ++i)
+        {
+            auto& socket = sockets.emplace_back(std::make_unique<market_feed_socket>(uri,
+                    raw_message_handler_t{std::bind(&feed_arbiter::on_frame, &arbiter, i, std::placeholders::_1, std::placeholders::_2)},
+                    io_context));
+            setup(*socket, i);
+        }
+    }
+
+    void start(const thread_placement_t& placement, const busy_poll_config_t& busy_poll)
+    {
+        if (sockets.empty())
+            throw std::logic_error("feed shard started without sockets");
+
+        resync = true;
+        pipeline.start();
+        if (reactor)
+        {
+            // the reactor's thread drives the connections
+            connect_async();
+            return;
+        }
+
+        thread = std::make_unique<std::jthread>([this, placement, busy_poll]() {
+                apply_thread_placement(placement, index);
+                if (own_io_context)
+                {
+                    connect_async();
+                    run_io_context(*own_io_context, busy_poll);
+                }
+                else
+                {
+                    std::error_code ec;
+                    if (!sockets[0]->connect(ec))
+                        log("ERROR failed to connect to {}: {}", sockets[0]->uri, ec.message());
+                }
+                pipeline.stop();
+            });
+    }
+
+    void close()
+    {
+        for (auto& socket : sockets)
+            socket->close();
+    }
+
+    void join()
+    {
+        if (thread)
+        {
+            thread->join();
+            thread = nullptr;
+        }
+        else if (!sockets.empty())
+        {
+            for (auto& socket : sockets)
+                socket->wait_closed();
+            pipeline.stop();
+        }
+    }
+
+    /**
+     * Whether a connection other than `connection` is still delivering. Only meaningful
+     * on the shard's I/O thread.
+     */
+    bool any_open_except(size_t connection) const
+    {
+        for (size_t i = 0; i < sockets.size(); ++i)
+        {
+            if (i != connection && sockets[i]->is_open())
+                return true;
+        }
+        return false;
+    }
+
+private:
+    mutable std::mutex                 m_mutex;
+    std::vector<instrument_pair_t>     m_pairs;
+    std::vector<subscription_change_t> m_changes;
+    std::atomic<bool>                  m_has_changes;
+
+    void connect_async()
+    {
+        for (auto& socket : sockets)
+        {
+            std::error_code ec;
+            if (!socket->connect_async(ec))
+                log("ERROR failed to connect to {}: {}", socket->uri, ec.message());
+        }
+    }
+};
+
+#endif
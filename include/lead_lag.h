@@ -0,0 +1,271 @@
+#ifndef _LEAD_LAG_H
+#define _LEAD_LAG_H
+
+#include "exchange_api.h"
+#include "seqlock.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+
+
+struct lead_lag_config_t
+{
+    std::chrono::milliseconds bucket {100};  // mids are sampled on this grid, returns are per bucket
+    size_t lags                      {10};   // buckets each way, at most `lead_lag_stats_t::MAX_LAGS`
+    double half_life                 {3000}; // in buckets, older samples weigh half as much every this many
+    double spread_min_bps            {-50};  // histogram range of the mid to mid spread, outliers go to the end bins
+    double spread_max_bps            {50};
+};
+
+/**
+ * What `lead_lag_monitor_t` publishes after every bucket.
+ */
+struct lead_lag_stats_t
+{
+    static constexpr const size_t MAX_LAGS = 16;
+
+    // correlation of the two venues' mid returns, `correlation[lags + k]` pairs a return of
+    // the first venue with the second venue's return k buckets earlier (k > 0) or later (k < 0)
+    std::array<double, 2 * MAX_LAGS + 1> correlation;
+    size_t                               lags;
+    int                                  best_lag;    // lag with the strongest correlation, > 0 when the second venue leads
+    int64_t                              bucket_ms;
+    double                               spread_mean; // (second mid - first mid) / first mid, in bps
+    double                               spread_stdev;
+    double                               spread_p05;
+    double                               spread_p25;
+    double                               spread_p50;
+    double                               spread_p75;
+    double                               spread_p95;
+    uint64_t                             buckets;     // sampled so far
+
+    double at_lag(int k) const
+    { return correlation[static_cast<size_t>(static_cast<int>(lags) + k)]; }
+};
+
+/**
+ * Which of two venues leads the other's price moves, and how the spread between them is
+ * distributed, computed online from both feeds' best bid/offer.
+ *
+ * Both mids are sampled on a fixed time grid so the busier venue doesn't dominate. On
+ * every bucket the log mid returns go into exponentially weighted moments: the means and
+ * variances of each series and, for every lag, the mean product of one venue's return with
+ * the other's `lag` buckets apart, kept in a small ring. The mid to mid spread goes into a
+ * fixed bin histogram whose weights grow geometrically instead of decaying, so aging old
+ * samples is a single multiply (the bins are rescaled once the weight gets large).
+ *
+ * A quote costs a compare and a store, a bucket O(lags) and the published quantiles a walk
+ * over the bins. Feed it from both feeds' `BBO_UPDATED` through `feed_event_handler`
+ * (serialized), read `stats()` from anywhere.
+ */
+class lead_lag_monitor_t
+{
+public:
+    static constexpr const size_t SPREAD_BINS = 256;
+
+    lead_lag_monitor_t(exchange_api_t first, exchange_api_t second, const lead_lag_config_t& config = {})
+        : first{first}, second{second}, m_config{config},
+          m_bucket_ns{std::chrono::duration_cast<std::chrono::nanoseconds>(config.bucket).count()},
+          m_alpha{1 - std::exp2(-1 / config.half_life)}, m_mutex{},
+          m_mid{}, m_sampled{}, m_bucket_end{0}, m_returns{}, m_head{0},
+          m_mean{}, m_square{}, m_cross{}, m_spread{0}, m_spread_square{0},
+          m_bins{}, m_weight{1}, m_total{0}, m_buckets{0}, m_published{}
+    {
+        if (config.lags > lead_lag_stats_t::MAX_LAGS)
+            throw std::invalid_argument("too many lead/lag lags");
+        if (m_bucket_ns <= 0 || config.half_life <= 0 || config.spread_max_bps <= config.spread_min_bps)
+            throw std::invalid_argument("invalid lead/lag config");
+    }
+
+    const exchange_api_t first;
+    const exchange_api_t second;
+
+    bool feed_event_handler(const orderbook_t& book)
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        if (book.exchange == first)
+            on_quote(0, book.top_of_book());
+        else if (book.exchange == second)
+            on_quote(1, book.top_of_book());
+        return true;
+    }
+
+    /**
+     * Take in the best bid/offer of the first (0) or second (1) venue. One writer only.
+     */
+    void on_quote(size_t venue, const orderbook_t::top_of_book_t& top)
+    {
+        if (top.bid_quantity <= 0 || top.ask_quantity <= 0)
+            return;
+
+        if (top.recv_ns >= m_bucket_end)
+            close_buckets(top.recv_ns);
+        m_mid[venue & 1] = (top.bid_price + top.ask_price) / 2;
+    }
+
+    lead_lag_stats_t stats() const
+    { return m_published.load(); }
+
+private:
+    static constexpr const size_t RING = lead_lag_stats_t::MAX_LAGS + 1;
+
+    lead_lag_config_t m_config;
+    int64_t           m_bucket_ns;
+    double            m_alpha;       // weight of the newest sample
+    std::mutex        m_mutex;
+
+    double            m_mid[2];      // latest mid of each venue, 0 until quoted
+    double            m_sampled[2];  // mids at the previous bucket
+    int64_t           m_bucket_end;
+    std::array<std::array<double, 2>, RING> m_returns; // last returns of both venues
+    size_t            m_head;        // ring slot of the newest returns
+
+    double            m_mean[2];
+    double            m_square[2];
+    std::array<double, 2 * lead_lag_stats_t::MAX_LAGS + 1> m_cross; // mean of first(t) * second(t - lag)
+
+    double            m_spread;      // weighted mean and mean square
+    double            m_spread_square;
+    std::array<double, SPREAD_BINS> m_bins;
+    double            m_weight;      // weight of the next spread sample
+    double            m_total;
+
+    uint64_t          m_buckets;
+    seqlock<lead_lag_stats_t> m_published;
+
+    void close_buckets(int64_t now_ns)
+    {
+        if (m_bucket_end == 0)
+        {
+            m_bucket_end = now_ns - now_ns % m_bucket_ns + m_bucket_ns;
+            return;
+        }
+
+        // after a gap the mids were flat, but only the last `lags` buckets of it matter
+        const int64_t missed = (now_ns - m_bucket_end) / m_bucket_ns + 1;
+        const int64_t count  = std::min<int64_t>(missed, static_cast<int64_t>(m_config.lags) + 1);
+        for (int64_t i = 0; i < count; ++i)
+            sample();
+        m_bucket_end += missed * m_bucket_ns;
+        publish();
+    }
+
+    void sample()
+    {
+        if (m_mid[0] <= 0 || m_mid[1] <= 0)
+            return;
+        if (m_sampled[0] <= 0)
+        {
+            m_sampled[0] = m_mid[0];
+            m_sampled[1] = m_mid[1];
+            return;
+        }
+
+        const double x = std::log(m_mid[0] / m_sampled[0]);
+        const double y = std::log(m_mid[1] / m_sampled[1]);
+        m_sampled[0] = m_mid[0];
+        m_sampled[1] = m_mid[1];
+
+        m_head = (m_head + 1) % RING;
+        m_returns[m_head] = {x, y};
+        ++m_buckets;
+
+        const double a = m_alpha;
+        m_mean[0]   += a * (x - m_mean[0]);
+        m_mean[1]   += a * (y - m_mean[1]);
+        m_square[0] += a * (x * x - m_square[0]);
+        m_square[1] += a * (y * y - m_square[1]);
+
+        const size_t lags = m_config.lags;
+        const size_t seen = m_buckets - 1; // earlier returns in the ring
+        for (size_t k = 0; k <= lags && k <= seen; ++k)
+        {
+            const auto& past = m_returns[(m_head + RING - k) % RING];
+            // second venue k buckets earlier, and first venue k buckets earlier
+            m_cross[lags + k] += a * (x * past[1] - m_cross[lags + k]);
+            if (k)
+                m_cross[lags - k] += a * (past[0] * y - m_cross[lags - k]);
+        }
+
+        const double spread = (m_mid[1] - m_mid[0]) / m_mid[0] * 1e4;
+        m_spread        += a * (spread - m_spread);
+        m_spread_square += a * (spread * spread - m_spread_square);
+        add_spread(spread);
+    }
+
+    void add_spread(double spread)
+    {
+        const double width = (m_config.spread_max_bps - m_config.spread_min_bps) / SPREAD_BINS;
+        const double pos   = (spread - m_config.spread_min_bps) / width;
+        const size_t bin   = pos <= 0 ? 0 : std::min(static_cast<size_t>(pos), SPREAD_BINS - 1);
+        m_bins[bin] += m_weight;
+        m_total     += m_weight;
+
+        // weights grow by 1 / (1 - alpha) per sample, which ages the older ones relatively
+        m_weight /= 1 - m_alpha;
+        if (m_weight > 1e100)
+        {
+            for (double& b : m_bins)
+                b /= m_weight;
+            m_total /= m_weight;
+            m_weight = 1;
+        }
+    }
+
+    double spread_quantile(double q) const
+    {
+        const double width  = (m_config.spread_max_bps - m_config.spread_min_bps) / SPREAD_BINS;
+        const double target = q * m_total;
+        double cumulative = 0;
+        for (size_t i = 0; i < SPREAD_BINS; ++i)
+        {
+            if (cumulative + m_bins[i] >= target && m_bins[i] > 0)
+                return m_config.spread_min_bps + (i + (target - cumulative) / m_bins[i]) * width;
+            cumulative += m_bins[i];
+        }
+        return m_config.spread_max_bps;
+    }
+
+    void publish()
+    {
+        lead_lag_stats_t stats {};
+        stats.lags      = m_config.lags;
+        stats.bucket_ms = m_bucket_ns / 1'000'000;
+        stats.buckets   = m_buckets;
+
+        const double var_x = m_square[0] - m_mean[0] * m_mean[0];
+        const double var_y = m_square[1] - m_mean[1] * m_mean[1];
+        const double norm  = std::sqrt(var_x * var_y);
+        double strongest = 0;
+        for (int k = -static_cast<int>(m_config.lags); k <= static_cast<int>(m_config.lags); ++k)
+        {
+            const size_t i = static_cast<size_t>(static_cast<int>(m_config.lags) + k);
+            const double c = norm > 0 ? (m_cross[i] - m_mean[0] * m_mean[1]) / norm : 0.0;
+            stats.correlation[i] = c;
+            if (std::abs(c) > strongest)
+            {
+                strongest      = std::abs(c);
+                stats.best_lag = k;
+            }
+        }
+
+        stats.spread_mean  = m_spread;
+        stats.spread_stdev = std::sqrt(std::max(m_spread_square - m_spread * m_spread, 0.0));
+        if (m_total > 0)
+        {
+            stats.spread_p05 = spread_quantile(0.05);
+            stats.spread_p25 = spread_quantile(0.25);
+            stats.spread_p50 = spread_quantile(0.50);
+            stats.spread_p75 = spread_quantile(0.75);
+            stats.spread_p95 = spread_quantile(0.95);
+        }
+        m_published.store(stats);
+    }
+};
+
+#endif
@@ -0,0 +1,365 @@
+#ifndef _MARKET_MAKER_H
+#define _MARKET_MAKER_H
+
+#include "cost_model.h"
+#include "exchange_api.h"
+#include "feed_pipeline.h"
+#include "thread_util.h"
+#include "wallet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+struct market_maker_config_t
+{
+    double quote_size      {0};  // base quantity quoted on each side
+    double half_spread_bps {5};  // distance of each quote from the reservation price
+    double skew_bps        {0};  // reservation price shift per unit of inventory, against the position
+    double max_inventory   {0};  // don't quote the side that would take the position past this, 0 for no limit
+    double price_step      {0};  // tick size, quotes are rounded away from the touch
+    double qty_step        {0};  // lot size
+    double requote_ticks   {1};  // leave a resting order alone while it is within this many ticks of its target
+    int64_t cancel_retry_ns {100000000}; // wait before retrying a failed cancel, doubled on every further failure
+};
+
+/**
+ * Order the market maker wants sent, see `market_maker_t::set_handler`.
+ */
+struct quote_action_t
+{
+    enum type_t { PLACE, CANCEL };
+
+    type_t          type;
+    order_request_t order;      // side, price and quantity of the quote to place, or side of the one to cancel
+    std::string     order_id;   // order to cancel
+    int64_t         trigger_ns; // receive time of the book change that led to it
+};
+
+/**
+ * Quotes both sides of one pair on one venue around the microprice, skewed against the
+ * inventory, and keeps the resting orders in line with those targets.
+ *
+ * Targets are only recomputed when the touch changes (the book's top of book version
+ * moves) or when our own orders change (acks and fills), and a side is only touched when
+ * its resting order has drifted more than `requote_ticks` from its target, would cross,
+ * or has the wrong size. So a busy book costs a version check per event, and the actions
+ * are the minimal cancel/place pairs needed to get back in line. Our own quantity is taken
+ * out of the touch before the microprice is computed so we don't chase our own quotes.
+ *
+ * Each side has at most one order in flight at a time: a side waiting on the gateway is
+ * left alone and re-evaluated against the latest touch as soon as its ack comes back.
+ * A quote is only replaced once the cancel of the resting one is confirmed, so there is
+ * never more than one order per side on the book. A failed cancel leaves the side holding
+ * the old order, no longer counted as quoting, and the cancel is retried with a backoff
+ * until it goes through or `on_fill` reports the order fully filled.
+ *
+ * The engine does no I/O, actions go to the handler and the results come back through
+ * `on_placed`, `on_cancelled` and `on_fill`. There is one writer, see `MarketMakerTrader`
+ * for running it against a feed and a wallet.
+ */
+class market_maker_t
+{
+public:
+    typedef std::function<void(const quote_action_t&)> handler_t;
+
+    struct stats_t
+    {
+        stage_stats_t reaction; // book receive time to action handed to the gateway
+        stage_stats_t decision; // time spent deciding, when the touch or our orders changed
+        uint64_t      skipped   {0}; // book events without a change to the touch
+        uint64_t      placed    {0};
+        uint64_t      cancelled {0};
+        uint64_t      cancel_failures {0};
+    };
+
+    stats_t stats;
+
+    market_maker_t(exchange_api_t exchange, const instrument_pair_t& pair, const market_maker_config_t& config = {})
+        : stats{}, exchange{exchange}, pair{pair}, m_config{config}, m_handler{},
+          m_top{}, m_version{~uint64_t{0}}, m_book{nullptr}, m_inventory{0}, m_halted{false},
+          m_sides{}, m_levels{}
+    {
+        m_levels.reserve(orderbook_t::GUARDED_SUBSET_SIZE);
+    }
+
+    const exchange_api_t    exchange;
+    const instrument_pair_t pair;
+
+    void set_handler(handler_t handler)
+    { m_handler = std::move(handler); }
+
+    double inventory() const
+    { return m_inventory; }
+
+    void set_inventory(double inventory)
+    { m_inventory = inventory; }
+
+    /**
+     * Take in the book's touch, returns the number of actions issued.
+     */
+    size_t on_book(const orderbook_t& book)
+    {
+        const uint64_t version = book.top_of_book_version();
+        if (version == m_version && &book == m_book)
+        {
+            ++stats.skipped;
+            return 0;
+        }
+        m_version = version;
+        m_book    = &book;
+        m_top     = book.top_of_book();
+        return decide(m_top.recv_ns);
+    }
+
+    /**
+     * Gateway result of a PLACE action, nullopt if the order was rejected.
+     */
+    size_t on_placed(SIDE side, const std::optional<order_status>& status)
+    {
+        working_t& w = m_sides[index(side)];
+        --w.in_flight;
+        if (status && status->status != STATUS::FAILED && status->status != STATUS::CANCELLED)
+            w.order_id = status->order_id;
+        else
+            w.live = false;
+        if (status && status->status == STATUS::FILLED)
+            apply_fill(side, w.quantity, w.order_id);
+        return decide(m_top.recv_ns);
+    }
+
+    /**
+     * Gateway result of a CANCEL action. A failed cancel usually means the order filled,
+     * which `on_fill` accounts for, until then the order is taken to still be resting.
+     */
+    size_t on_cancelled(SIDE side, bool ok)
+    {
+        working_t& w = m_sides[index(side)];
+        --w.in_flight;
+        if (ok || w.quantity <= m_config.qty_step * 0.5)
+        {
+            w.order_id.clear();
+            w.failures = 0;
+        }
+        else
+        {
+            ++stats.cancel_failures;
+            w.retry_ns = steady_now_ns() + (m_config.cancel_retry_ns << std::min<uint32_t>(w.failures, 6));
+            ++w.failures;
+        }
+        return decide(m_top.recv_ns);
+    }
+
+    /**
+     * One of our quotes traded `quantity`. Without an `order_id` the fill is taken to be
+     * on the current quote of that side.
+     */
+    size_t on_fill(SIDE side, double quantity, const std::string& order_id = {})
+    {
+        apply_fill(side, quantity, order_id);
+        return decide(m_top.recv_ns);
+    }
+
+    /**
+     * Pull both quotes and stop quoting until `resume`.
+     */
+    size_t halt()
+    {
+        m_halted = true;
+        return decide(steady_now_ns());
+    }
+
+    size_t resume()
+    {
+        m_halted = false;
+        return decide(steady_now_ns());
+    }
+
+    /**
+     * True while some action hasn't been acknowledged yet.
+     */
+    bool in_flight() const
+    { return m_sides[0].in_flight || m_sides[1].in_flight; }
+
+    bool quoting(SIDE side) const
+    { return m_sides[index(side)].live; }
+
+    double quote_price(SIDE side) const
+    { return m_sides[index(side)].price; }
+
+private:
+    // a side holds an order while `order_id` is set, it is only counted as quoting while `live`
+    struct working_t
+    {
+        double      price     {0};
+        double      quantity  {0};
+        std::string order_id  {};
+        bool        live      {false};
+        uint32_t    in_flight {0};
+        uint32_t    failures  {0}; // failed cancels of `order_id` in a row
+        int64_t     retry_ns  {0}; // when to retry the cancel after the last failure
+    };
+
+    market_maker_config_t             m_config;
+    handler_t                         m_handler;
+    orderbook_t::top_of_book_t        m_top;
+    uint64_t                          m_version;
+    const orderbook_t*                m_book;
+    double                            m_inventory;
+    bool                              m_halted;
+    working_t                         m_sides[2]; // BUY, SELL
+    std::vector<orderbook_t::order_t> m_levels;   // scratch copy of guarded levels
+
+    static size_t index(SIDE side)
+    { return side == SIDE::BUY ? 0 : 1; }
+
+    /**
+     * Best price and size of one side of the market without our own order on it.
+     */
+    std::pair<double, double> market_touch(bool bids, double price, double quantity)
+    {
+        const working_t& own = m_sides[bids ? 0 : 1];
+        if (!own.live || own.price != price || !m_book)
+            return {price, quantity};
+        if (quantity - own.quantity > m_config.qty_step * 0.5)
+            return {price, quantity - own.quantity};
+
+        // we are the whole best level, the market is the next one
+        if (bids)
+            m_book->copy_guarded_bids(m_levels);
+        else
+            m_book->copy_guarded_asks(m_levels);
+        for (const auto& [level_price, level_quantity] : m_levels)
+            if (bids ? level_price < price : level_price > price)
+                return {level_price, level_quantity};
+        return {0, 0};
+    }
+
+    void apply_fill(SIDE side, double quantity, const std::string& order_id)
+    {
+        m_inventory += side == SIDE::BUY ? quantity : -quantity;
+
+        // fills of an order we already replaced only move the inventory
+        working_t& w = m_sides[index(side)];
+        if ((!w.live && w.order_id.empty()) || (!order_id.empty() && order_id != w.order_id))
+            return;
+        w.quantity -= quantity;
+        if (w.quantity <= m_config.qty_step * 0.5)
+        {
+            w.live = false;
+            // a pending ack settles an order in flight
+            if (!w.in_flight)
+            {
+                w.order_id.clear();
+                w.failures = 0;
+            }
+        }
+    }
+
+    size_t decide(int64_t trigger_ns)
+    {
+        const int64_t start = steady_now_ns();
+
+        double bid_price = 0, bid_quantity = 0, ask_price = 0, ask_quantity = 0;
+        if (!m_halted && m_top.bid_quantity > 0 && m_top.ask_quantity > 0)
+        {
+            const auto [bid, bid_size] = market_touch(true, m_top.bid_price, m_top.bid_quantity);
+            const auto [ask, ask_size] = market_touch(false, m_top.ask_price, m_top.ask_quantity);
+            if (bid > 0 && ask > 0 && bid_size > 0 && ask_size > 0)
+            {
+                const double micro       = (bid * ask_size + ask * bid_size) / (bid_size + ask_size);
+                const double reservation = micro * (1 - m_config.skew_bps * 1e-4 * m_inventory);
+                const double half_spread = m_config.half_spread_bps * 1e-4;
+                const double step        = m_config.price_step;
+
+                // post only: stay behind the other side's touch
+                bid_price = floor_to_step(reservation * (1 - half_spread), step);
+                if (bid_price >= ask)
+                    bid_price = step > 0 ? ask - step : 0;
+                ask_price = ceil_to_step(reservation * (1 + half_spread), step);
+                if (ask_price <= bid)
+                    ask_price = step > 0 ? bid + step : 0;
+
+                bid_quantity = m_config.quote_size;
+                ask_quantity = m_config.quote_size;
+                if (m_config.max_inventory > 0)
+                {
+                    bid_quantity = std::min(bid_quantity, m_config.max_inventory - m_inventory);
+                    ask_quantity = std::min(ask_quantity, m_config.max_inventory + m_inventory);
+                }
+                bid_quantity = floor_to_step(std::max(bid_quantity, 0.0), m_config.qty_step);
+                ask_quantity = floor_to_step(std::max(ask_quantity, 0.0), m_config.qty_step);
+            }
+        }
+
+        size_t actions = sync(SIDE::BUY, bid_price, bid_quantity, trigger_ns)
+                       + sync(SIDE::SELL, ask_price, ask_quantity, trigger_ns);
+
+        const int64_t now = steady_now_ns();
+        stats.decision.record(now - start);
+        if (actions)
+            stats.reaction.record(now - trigger_ns);
+        return actions;
+    }
+
+    size_t sync(SIDE side, double price, double quantity, int64_t trigger_ns)
+    {
+        working_t& w = m_sides[index(side)];
+        if (w.in_flight)
+            return 0;
+
+        const bool want = price > 0 && quantity > 0;
+        if (w.live)
+        {
+            const double tolerance = m_config.price_step > 0 ? m_config.requote_ticks * m_config.price_step * (1 + 1e-9) : 0;
+            const bool   in_line   = want && std::abs(w.price - price) <= tolerance
+                                   && std::abs(w.quantity - quantity) <= m_config.qty_step * 0.5
+                                   && (side == SIDE::BUY ? w.price < m_top.ask_price : w.price > m_top.bid_price);
+            if (in_line)
+                return 0;
+            // the replacement goes out once the cancel is confirmed
+            cancel(side, w, trigger_ns);
+            return w.in_flight;
+        }
+        if (!w.order_id.empty())
+        {
+            // an earlier cancel failed, the order may still be resting
+            if (steady_now_ns() < w.retry_ns)
+                return 0;
+            cancel(side, w, trigger_ns);
+            return w.in_flight;
+        }
+        if (!want)
+            return 0;
+
+        place(side, w, price, quantity, trigger_ns);
+        return w.in_flight;
+    }
+
+    void cancel(SIDE side, working_t& w, int64_t trigger_ns)
+    {
+        w.live = false;
+        ++w.in_flight;
+        ++stats.cancelled;
+        if (m_handler)
+            m_handler(quote_action_t{quote_action_t::CANCEL, order_request_t{exchange, pair, side, w.price, w.quantity}, w.order_id, trigger_ns});
+    }
+
+    void place(SIDE side, working_t& w, double price, double quantity, int64_t trigger_ns)
+    {
+        w.live     = true;
+        w.price    = price;
+        w.quantity = quantity;
+        ++w.in_flight;
+        ++stats.placed;
+        if (m_handler)
+            m_handler(quote_action_t{quote_action_t::PLACE, order_request_t{exchange, pair, side, price, quantity}, {}, trigger_ns});
+    }
+};
+
+#endif
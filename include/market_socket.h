@@ -4,24 +4,152 @@
 #include "json.h"
 #include "logger.h"
 #include "config.h"
+#include "thread_util.h"
+#include "ws_client.h"
 
 #include <asio.hpp>
 #include <websocketpp/config/asio_client.hpp>
 #include <websocketpp/client.hpp>
 
+#include <sys/socket.h>
+
 #include <string_view>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cerrno>
+#include <system_error>
 
 
 using client          = websocketpp::client<websocketpp::config::asio_tls_client>;
 using ssl_context_ptr = std::shared_ptr<asio::ssl::context>;
 
+// invoked with the raw payload of every message, `data[len]` is guaranteed to be '\0'
+typedef std::function<bool(char* data, size_t len)> raw_message_handler_t;
+
+/**
+ * Websocket implementation behind `market_feed_socket`. The lean client avoids the per
+ * message allocations and copies of websocketpp, see `ws_client`.
+ */
+enum class ws_transport_t : int {
+    WEBSOCKETPP,
+    LEAN
+};
+
+struct busy_poll_config_t
+{
+    bool   enabled         {false};
+    size_t spin_budget     {1 << 14}; // empty poll() passes before blocking in run_one()
+    int    so_busy_poll_us {50};      // SO_BUSY_POLL on the socket, 0 to leave the kernel default
+};
+
+struct reconnect_config_t
+{
+    bool                      enabled            {true};
+    std::chrono::milliseconds heartbeat_interval {5000};  // ping when nothing was received for this long
+    std::chrono::milliseconds stall_timeout      {15000}; // drop the connection when still nothing was received
+    std::chrono::milliseconds backoff_min        {100};
+    std::chrono::milliseconds backoff_max        {10000};
+    size_t                    max_attempts       {0};     // consecutive failed attempts before giving up, 0 for no limit
+};
+
+/**
+ * Connection health counters, written by the I/O thread and readable from any thread.
+ * Recovery time is measured from losing the connection to the first frame on the new one.
+ */
+struct reconnect_stats_t
+{
+    std::atomic<uint64_t> disconnects       {0};
+    std::atomic<uint64_t> reconnects        {0};
+    std::atomic<uint64_t> stalls            {0}; // connections dropped by the stall detector
+    std::atomic<uint64_t> resumed_sessions  {0}; // TLS handshakes that reused a previous session
+    std::atomic<int64_t>  last_recovery_ns  {0};
+    std::atomic<int64_t>  max_recovery_ns   {0};
+    std::atomic<int64_t>  total_recovery_ns {0};
+};
+
+/**
+ * TLS context shared by every market feed socket. Reusing one context keeps the client
+ * session cache around so reconnects can resume the previous session instead of doing
+ * a full handshake.
+ */
+inline ssl_context_ptr shared_tls_context()
+{
+    static ssl_context_ptr ctx_ptr = []() {
+        ssl_context_ptr ctx = std::make_shared<asio::ssl::context>(asio::ssl::context::tls_client);
+        SSL_CTX_set_session_cache_mode(ctx->native_handle(), SSL_SESS_CACHE_CLIENT);
+        /* TODO: more TLS configuration here */
+        return ctx;
+    }();
+    return ctx_ptr;
+}
+
+/**
+ * Run `io_context` until it runs out of work. With busy polling the calling thread spins
+ * on `poll()` instead of sleeping in epoll between frames, only blocking once `spin_budget`
+ * passes in a row found nothing to do. Meant for a thread with a core to itself.
+ */
+inline void run_io_context(asio::io_context& io_context, const busy_poll_config_t& config)
+{
+    if (!config.enabled)
+    {
+        io_context.run();
+        return;
+    }
+
+    size_t idle = 0;
+    while (!io_context.stopped())
+    {
+        if (io_context.poll())
+        {
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < config.spin_budget)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        idle = 0;
+        if (!io_context.run_one())
+            break;
+    }
+}
+
 
 struct market_feed_socket
 {
-    market_feed_socket(const std::string& uri, std::function<bool(const Document&)> on_message)
-        : uri {uri}, m_client{}, m_con_ptr {nullptr}, m_on_message_hdlr {on_message}, 
+    typedef std::function<void()> reconnect_handler_t;
+
+    reconnect_stats_t stats;
+
+    /**
+     * When `io_context` is provided the socket runs on that (externally owned and run)
+     * context and should be started with `connect_async`, otherwise the socket owns its
+     * context and `connect` runs it on the calling thread.
+     */
+    market_feed_socket(const std::string& uri, std::function<bool(const Document&)> on_message,
+            asio::io_context* io_context = nullptr)
+        : market_feed_socket(uri, raw_message_handler_t{}, io_context)
+    {
+        m_on_message_hdlr = on_message;
+    }
+
+    market_feed_socket(const std::string& uri, raw_message_handler_t on_raw_message,
+            asio::io_context* io_context = nullptr)
+        : stats{}, uri {uri}, m_client{}, m_con_ptr {nullptr}, m_on_message_hdlr {},
+        m_on_raw_message_hdlr {on_raw_message},
         m_opening_msgs{}, m_headers {},
-        m_io_context {}
+        m_own_io_context {io_context ? nullptr : std::make_unique<asio::io_context>()},
+        m_io_context {io_context ? *io_context : *m_own_io_context},
+        m_state_mutex{}, m_state_cv{}, m_closed{true}, m_busy_poll{},
+        m_reconnect{}, m_reconnect_hdlr{}, m_heartbeat_timer{m_io_context}, m_reconnect_timer{m_io_context},
+        m_rng{std::random_device{}()}, m_stopping{false}, m_attempts{0}, m_last_rx_ns{0}, m_dropped_ns{0},
+        m_tls_session{nullptr}, m_transport{ws_transport_t::WEBSOCKETPP}, m_lean{nullptr}
     {
         using namespace std::placeholders;
 
@@ -37,7 +165,52 @@ struct market_feed_socket
 
         m_client.set_message_handler(std::bind(&market_feed_socket::on_message, this, _1, _2));
         m_client.set_open_handler(std::bind(&market_feed_socket::on_open, this, _1));
-        m_client.set_tls_init_handler(std::bind(&market_feed_socket::mock_tls_init_handler, this, _1));
+        m_client.set_close_handler(std::bind(&market_feed_socket::on_closed, this, _1));
+        m_client.set_fail_handler(std::bind(&market_feed_socket::on_closed, this, _1));
+        m_client.set_pong_handler(std::bind(&market_feed_socket::on_pong, this, _1, _2));
+        m_client.set_tls_init_handler(std::bind(&market_feed_socket::tls_init_handler, this, _1));
+        m_client.set_tcp_pre_init_handler(std::bind(&market_feed_socket::on_tcp_pre_init, this, _1));
+        m_client.set_tcp_post_init_handler(std::bind(&market_feed_socket::on_tcp_post_init, this, _1));
+    }
+
+    ~market_feed_socket()
+    {
+        if (m_tls_session)
+            SSL_SESSION_free(m_tls_session);
+    }
+
+    /**
+     * Spin on the io_context instead of blocking in `connect`, and ask the kernel to busy
+     * poll the socket. Must be called before connecting.
+     */
+    void set_busy_poll(const busy_poll_config_t& config)
+    {
+        m_busy_poll = config;
+    }
+
+    /**
+     * Pick the websocket implementation. Must be called before connecting.
+     */
+    void set_transport(ws_transport_t transport)
+    {
+        m_transport = transport;
+    }
+
+    /**
+     * Configure heartbeats, stall detection and reconnect backoff. Must be called before connecting.
+     */
+    void set_reconnect(const reconnect_config_t& config)
+    {
+        m_reconnect = config;
+    }
+
+    /**
+     * `handler` is invoked on the I/O thread right before every reconnect attempt, eg. to
+     * refresh signed opening messages or to schedule a book resync.
+     */
+    void set_reconnect_handler(reconnect_handler_t handler)
+    {
+        m_reconnect_hdlr = handler;
     }
 
     void add_opening_message_json(const Document& json)
@@ -45,14 +218,19 @@ struct market_feed_socket
         m_opening_msgs.push_back(to_string<Document>(json));
     }
 
+    void clear_opening_messages()
+    {
+        m_opening_msgs.clear();
+    }
+
     std::error_code send_json(const Document& json)
     {
-        if(!m_con_ptr)
+        if(!has_connection())
             throw std::logic_error("tried to send payload when connection is null");
 
         std::string msg {to_string<Document>(json)};
         log("sending: {}\n", msg);
-        return m_con_ptr->send(msg);
+        return send_frame(msg);
     }
 
     void add_header(const std::string& key, const std::string& value)
@@ -64,47 +242,110 @@ struct market_feed_socket
     {
         // close connection from thread running io_context event loop
         asio::post(m_io_context, [&]() {
-                if(!m_con_ptr) return;
+                m_stopping = true;
+                m_heartbeat_timer.cancel();
+                m_reconnect_timer.cancel();
+
+                if(!has_connection())
+                {
+                    // waiting to reconnect, there is no connection to close
+                    set_closed();
+                    return;
+                }
                 log("closing socket ...");
-                m_con_ptr->close(websocketpp::close::status::normal, "OK");
+                if (m_lean)
+                {
+                    m_lean->close();
+                    return;
+                }
+                std::error_code ec;
+                m_con_ptr->close(websocketpp::close::status::normal, "OK", ec);
+                if (ec)
+                    log("ERROR failed to close {}: {}", uri, ec.message());
             });
     }
 
+    /**
+     * Run `fn` on the I/O thread, eg. to send or change the opening messages of a live connection.
+     */
+    void post(std::function<void()> fn)
+    {
+        asio::post(m_io_context, std::move(fn));
+    }
+
     bool connect(std::error_code &ec)
     {
-        m_con_ptr = m_client.get_connection(uri, ec);
-        if (ec) {
+        if (!m_own_io_context)
+            throw std::logic_error("connect called on socket with a shared io_context, use connect_async");
+
+        m_io_context.restart();
+        if (!connect_async(ec))
+            return false;
+
+        run_io_context(m_io_context, m_busy_poll);
+
+        m_con_ptr = nullptr;
+
+        return  true;
+    }
+
+    /**
+     * Start connecting without running the io_context, the connection is then
+     * driven by whichever thread runs the context. With reconnects enabled the socket
+     * only counts as closed once `close` is called or the attempts run out.
+     */
+    bool connect_async(std::error_code &ec)
+    {
+        m_stopping = false;
+        m_attempts = 0;
+        m_dropped_ns = 0;
+
+        if (!open_connection(ec))
             return false;
-        }
 
-        for (const auto& [key, value] : m_headers)
         {
-            m_con_ptr->append_header(key, value);
+            std::lock_guard<std::mutex> lock{m_state_mutex};
+            m_closed = false;
         }
 
-        m_client.connect(m_con_ptr);
-        m_client.run();
-
-        m_con_ptr = nullptr;
+        if (m_reconnect.enabled)
+            arm_heartbeat();
 
         return  true;
     }
 
+    /**
+     * Whether the websocket is currently open. Only meaningful on the I/O thread.
+     */
+    bool is_open() const
+    {
+        if (m_lean)
+            return m_lean->is_open();
+        return m_con_ptr && m_con_ptr->get_state() == websocketpp::session::state::open;
+    }
 
-    ssl_context_ptr mock_tls_init_handler(websocketpp::connection_hdl hdl)
+    /**
+     * Block until the connection started by `connect_async` has closed or failed.
+     */
+    void wait_closed()
     {
-        ssl_context_ptr ctx_ptr = std::make_shared<asio::ssl::context>(asio::ssl::context::tls);
-        /* TODO: more TLS configuration here */
-        return ctx_ptr;
+        std::unique_lock<std::mutex> lock{m_state_mutex};
+        m_state_cv.wait(lock, [this]() { return m_closed; });
+    }
+
+
+    ssl_context_ptr tls_init_handler(websocketpp::connection_hdl hdl)
+    {
+        return shared_tls_context();
     }
 
     std::error_code send(const std::string& msg)
     {
-        if(!m_con_ptr)
+        if(!has_connection())
             throw std::logic_error("tried to send payload when connection is null");
 
         log("sending message: {}", msg);
-        return m_con_ptr->send(msg);
+        return send_frame(msg);
     }
 
 
@@ -114,9 +355,276 @@ private:
     client m_client;
     client::connection_ptr m_con_ptr;
     std::function<bool(const Document&)> m_on_message_hdlr;
+    raw_message_handler_t m_on_raw_message_hdlr;
     std::vector<std::string> m_opening_msgs;
     std::vector<std::pair<std::string, std::string>> m_headers;
-    asio::io_context m_io_context;
+    std::unique_ptr<asio::io_context> m_own_io_context;
+    asio::io_context& m_io_context;
+
+    std::mutex              m_state_mutex;
+    std::condition_variable m_state_cv;
+    bool                    m_closed;
+
+    busy_poll_config_t      m_busy_poll;
+
+    // everything below is only touched from the I/O thread
+    reconnect_config_t      m_reconnect;
+    reconnect_handler_t     m_reconnect_hdlr;
+    asio::steady_timer      m_heartbeat_timer;
+    asio::steady_timer      m_reconnect_timer;
+    std::minstd_rand        m_rng;
+    bool                    m_stopping;
+    size_t                  m_attempts;
+    int64_t                 m_last_rx_ns;
+    int64_t                 m_dropped_ns; // when the connection was lost, 0 while healthy
+    SSL_SESSION*            m_tls_session;
+
+    ws_transport_t             m_transport;
+    std::unique_ptr<ws_client> m_lean;
+
+    bool has_connection() const
+    {
+        if (m_lean)
+            return m_lean->state() != ws_client::state_t::CLOSED;
+        return m_con_ptr != nullptr;
+    }
+
+    std::error_code send_frame(const std::string& msg)
+    {
+        if (m_lean)
+            return m_lean->send_text(msg);
+        return m_con_ptr->send(msg);
+    }
+
+    bool open_connection(std::error_code& ec)
+    {
+        if (m_transport == ws_transport_t::LEAN)
+        {
+            if (!m_lean)
+            {
+                using namespace std::placeholders;
+                m_lean = std::make_unique<ws_client>(m_io_context, shared_tls_context());
+                m_lean->set_handlers(std::bind(&market_feed_socket::init_socket, this, _1, _2),
+                        std::bind(&market_feed_socket::on_lean_open, this, _1),
+                        std::bind(&market_feed_socket::on_lean_message, this, _1, _2),
+                        [this]() { m_last_rx_ns = steady_now_ns(); },
+                        std::bind(&market_feed_socket::on_lean_closed, this, _1, _2));
+            }
+            return m_lean->connect(uri, m_headers, ec);
+        }
+
+        m_con_ptr = m_client.get_connection(uri, ec);
+        if (ec) {
+            m_con_ptr = nullptr;
+            return false;
+        }
+
+        for (const auto& [key, value] : m_headers)
+        {
+            m_con_ptr->append_header(key, value);
+        }
+
+        m_client.connect(m_con_ptr);
+        return true;
+    }
+
+    void set_closed()
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_state_mutex};
+            m_closed = true;
+        }
+        m_state_cv.notify_all();
+    }
+
+    void arm_heartbeat()
+    {
+        m_heartbeat_timer.expires_after(m_reconnect.heartbeat_interval);
+        m_heartbeat_timer.async_wait([this](const std::error_code& ec) {
+                if (ec || m_stopping) return;
+                check_heartbeat();
+                arm_heartbeat();
+            });
+    }
+
+    void check_heartbeat()
+    {
+        if (!is_open())
+            return;
+
+        using namespace std::chrono;
+        const nanoseconds idle {steady_now_ns() - m_last_rx_ns};
+        std::error_code ec;
+
+        if (idle >= m_reconnect.stall_timeout)
+        {
+            log("ERROR no data from {} for {:d}ms, dropping connection", uri, duration_cast<milliseconds>(idle).count());
+            stats.stalls.fetch_add(1, std::memory_order_relaxed);
+            // a stalled peer won't answer a close handshake, shut the socket down so the
+            // pending read fails and the connection is torn down right away
+            if (m_lean)
+                m_lean->abort();
+            else
+                m_con_ptr->get_raw_socket().close(ec);
+        }
+        else if (idle >= m_reconnect.heartbeat_interval)
+        {
+            if (m_lean)
+                m_lean->ping();
+            else
+                m_con_ptr->ping("", ec);
+            if (ec)
+                log("ERROR failed to ping {}: {}", uri, ec.message());
+        }
+    }
+
+    void schedule_reconnect()
+    {
+        if (!m_dropped_ns)
+        {
+            m_dropped_ns = steady_now_ns();
+            stats.disconnects.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // exponential backoff with jitter so many sockets don't reconnect in lock step
+        // doubling stops at the cap, so the product can't overflow
+        std::chrono::milliseconds max_delay {m_reconnect.backoff_min};
+        for (size_t i = 0; i < m_attempts && max_delay < m_reconnect.backoff_max; ++i)
+            max_delay *= 2;
+        max_delay = std::min<std::chrono::milliseconds>(max_delay, m_reconnect.backoff_max);
+        std::uniform_int_distribution<int64_t> jitter {max_delay.count() / 2, max_delay.count()};
+        const std::chrono::milliseconds delay {jitter(m_rng)};
+        ++m_attempts;
+
+        log("reconnecting to {} in {:d}ms (attempt {:d})", uri, delay.count(), m_attempts);
+        m_reconnect_timer.expires_after(delay);
+        m_reconnect_timer.async_wait([this](const std::error_code& ec) {
+                if (ec || m_stopping) return;
+
+                if (m_reconnect_hdlr)
+                    m_reconnect_hdlr();
+
+                std::error_code con_ec;
+                if (!open_connection(con_ec))
+                {
+                    log("ERROR failed to reconnect to {}: {}", uri, con_ec.message());
+                    on_connection_lost();
+                }
+            });
+    }
+
+    void on_connection_lost()
+    {
+        const bool give_up = m_reconnect.max_attempts && m_attempts >= m_reconnect.max_attempts;
+        if (m_stopping || !m_reconnect.enabled || give_up)
+        {
+            if (give_up)
+                log("ERROR giving up on {} after {:d} attempts", uri, m_attempts);
+            m_stopping = true;
+            m_heartbeat_timer.cancel();
+            m_reconnect_timer.cancel();
+            set_closed();
+            return;
+        }
+
+        schedule_reconnect();
+    }
+
+    void on_closed(websocketpp::connection_hdl hdl)
+    {
+        save_tls_session(m_client.get_con_from_hdl(hdl)->get_socket().native_handle());
+        m_con_ptr = nullptr;
+        on_connection_lost();
+    }
+
+    void on_lean_closed(SSL* ssl, const std::error_code& ec)
+    {
+        save_tls_session(ssl);
+        on_connection_lost();
+    }
+
+    void on_lean_open(SSL* ssl)
+    {
+        on_tls_established(ssl);
+        on_connection_open();
+    }
+
+    bool on_lean_message(char* data, size_t len)
+    {
+        if (on_frame(data, len))
+            return true;
+
+        // the lean client closes the connection itself
+        m_stopping = true;
+        return false;
+    }
+
+    void on_pong(websocketpp::connection_hdl hdl, std::string payload)
+    {
+        m_last_rx_ns = steady_now_ns();
+    }
+
+    void on_tcp_pre_init(websocketpp::connection_hdl hdl)
+    {
+        client::connection_ptr con = m_client.get_con_from_hdl(hdl);
+        init_socket(con->get_socket().lowest_layer(), con->get_socket().native_handle());
+    }
+
+    void save_tls_session(SSL* ssl)
+    {
+        if (!ssl)
+            return;
+
+        SSL_SESSION* session = SSL_get1_session(ssl);
+        if (!session)
+            return;
+        if (!SSL_SESSION_is_resumable(session))
+        {
+            SSL_SESSION_free(session);
+            return;
+        }
+
+        if (m_tls_session)
+            SSL_SESSION_free(m_tls_session);
+        m_tls_session = session;
+    }
+
+    void on_tcp_post_init(websocketpp::connection_hdl hdl)
+    {
+        on_tls_established(m_client.get_con_from_hdl(hdl)->get_socket().native_handle());
+    }
+
+    void on_tls_established(SSL* ssl)
+    {
+        if (SSL_session_reused(ssl))
+            stats.resumed_sessions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Connected but not yet handshaking: the last point to offer a session to resume,
+     * and where the socket options get applied.
+     */
+    void init_socket(asio::ip::tcp::socket::lowest_layer_type& socket, SSL* ssl)
+    {
+        if (m_tls_session)
+            SSL_set_session(ssl, m_tls_session);
+
+        std::error_code ec;
+        socket.set_option(asio::ip::tcp::no_delay(true), ec);
+        if (ec)
+            log("ERROR failed to set TCP_NODELAY on {}: {}", uri, ec.message());
+
+#ifdef SO_BUSY_POLL
+        if (m_busy_poll.enabled && m_busy_poll.so_busy_poll_us > 0)
+        {
+            // raising it above net.core.busy_read needs CAP_NET_ADMIN, polling the loop still works without it
+            // asio has no public option type for it, set it on the descriptor directly
+            const int us = m_busy_poll.so_busy_poll_us;
+            if (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) != 0)
+                log("ERROR failed to set SO_BUSY_POLL on {}: {}", uri, std::error_code{errno, std::system_category()}.message());
+        }
+#endif
+    }
 
     void on_message(websocketpp::connection_hdl hdl, client::message_ptr msg)
     {
@@ -124,27 +632,67 @@ private:
         if (!payload.ends_with('\0'))
             payload.push_back('\0');
 
+        if (!on_frame(payload.data(), payload.size() - 1))
+            close_on_request(hdl);
+    }
+
+    /**
+     * Common handling of every received message, `data[len]` is '\0'.
+     * Returns false if the handler asked for the connection to be closed.
+     */
+    bool on_frame(char* data, size_t len)
+    {
+        m_last_rx_ns = steady_now_ns();
+        if (m_dropped_ns)
+        {
+            // first frame since the connection was lost, data is flowing again
+            const int64_t recovery = m_last_rx_ns - m_dropped_ns;
+            m_dropped_ns = 0;
+            stats.reconnects.fetch_add(1, std::memory_order_relaxed);
+            stats.last_recovery_ns.store(recovery, std::memory_order_relaxed);
+            stats.total_recovery_ns.fetch_add(recovery, std::memory_order_relaxed);
+            if (recovery > stats.max_recovery_ns.load(std::memory_order_relaxed))
+                stats.max_recovery_ns.store(recovery, std::memory_order_relaxed);
+            log("reconnected to {} after {:d}us", uri, recovery / 1000);
+        }
+
 #ifdef MESSAGE_PAYLOAD_LOG
-        log("> {}", payload);
+        log("> {}", std::string_view{data, len});
 #endif
 
+        if (m_on_raw_message_hdlr)
+            return m_on_raw_message_hdlr(data, len);
+
         Document json;
-        json.ParseInsitu(payload.data());
+        json.ParseInsitu(data);
 
-        if (!m_on_message_hdlr(json))
-        {
-            m_client.get_con_from_hdl(hdl)->close(websocketpp::close::status::normal, "OK");
-        }
+        return m_on_message_hdlr(json);
+    }
+
+    void close_on_request(websocketpp::connection_hdl hdl)
+    {
+        // the handler asked for the connection to go away (eg. an error response),
+        // reconnecting would most likely just get the same answer
+        m_stopping = true;
+        m_client.get_con_from_hdl(hdl)->close(websocketpp::close::status::normal, "OK");
     }
 
     void on_open(websocketpp::connection_hdl hdl)
     {
+        on_connection_open();
+    }
+
+    void on_connection_open()
+    {
+        m_attempts = 0;
+        m_last_rx_ns = steady_now_ns();
+
         if (m_opening_msgs.size() == 0)
             return;
         for (const auto& msg : m_opening_msgs)
         {
             log("sending opening message: {}", msg);
-            std::error_code ec = m_client.get_con_from_hdl(hdl)->send(msg);
+            std::error_code ec = send_frame(msg);
             if (ec) {
                 throw std::runtime_error("failed to send opening message: " + ec.message());
             }
@@ -159,5 +707,4 @@ private:
 
 
 
-#endif
-
+#endif
\ No newline at end of file
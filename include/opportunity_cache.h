@@ -0,0 +1,137 @@
+#ifndef _OPPORTUNITY_CACHE_H
+#define _OPPORTUNITY_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+
+/**
+ * Identity of an opportunity: the same pair crossed between the same two venues at the
+ * same prices. The side is given by which venue buys.
+ */
+struct opportunity_key_t
+{
+    uint32_t pair_id;
+    uint16_t buy_venue;
+    uint16_t sell_venue;
+    double   buy_price;
+    double   sell_price;
+
+    bool operator==(const opportunity_key_t& other) const
+    {
+        return pair_id == other.pair_id && buy_venue == other.buy_venue && sell_venue == other.sell_venue
+            && buy_price == other.buy_price && sell_price == other.sell_price;
+    }
+
+    uint64_t hash() const
+    {
+        uint64_t buy, sell;
+        std::memcpy(&buy, &buy_price, sizeof(buy));
+        std::memcpy(&sell, &sell_price, sizeof(sell));
+        // splitmix64 finalizer over the packed fields
+        uint64_t h = (uint64_t{pair_id} << 32 | uint64_t{buy_venue} << 16 | sell_venue)
+                     ^ (buy * 0x9e3779b97f4a7c15ull) ^ (sell * 0xc2b2ae3d27d4eb4full);
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    }
+};
+
+/**
+ * Remembers recently reported opportunities so the same one isn't acted on again while
+ * its orders are likely still in flight.
+ *
+ * `admit` lets an opportunity through at most once per `cooldown_ns`, however often it is
+ * seen in between. An opportunity not seen for `ttl_ns` is forgotten, so it counts as new
+ * when it comes back.
+ *
+ * Open addressing over a fixed power of two table: a key lives in one of the `PROBES`
+ * slots after its hash, a new key takes an expired slot there or else evicts the least
+ * recently seen one. A lookup reads a few adjacent cache lines and nothing is allocated
+ * after construction. Not thread-safe.
+ */
+class opportunity_cache_t
+{
+public:
+    static constexpr const size_t PROBES = 4;
+
+    opportunity_cache_t(size_t capacity, int64_t cooldown_ns, int64_t ttl_ns)
+        : m_mask{0}, m_cooldown_ns{cooldown_ns}, m_ttl_ns{ttl_ns < cooldown_ns ? cooldown_ns : ttl_ns},
+          m_slots{}, m_suppressed{0}
+    {
+        if (capacity == 0)
+            throw std::invalid_argument("opportunity cache needs a capacity");
+
+        size_t size = PROBES;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_slots.resize(size + PROBES); // probes never wrap around
+    }
+
+    /**
+     * Returns true if the opportunity should be acted on at `now_ns`, false while it is
+     * cooling down.
+     */
+    bool admit(const opportunity_key_t& key, int64_t now_ns)
+    {
+        const uint64_t hash = key.hash() | 1; // 0 marks an empty slot
+        slot_t* first  = &m_slots[hash & m_mask];
+        slot_t* victim = first;
+        for (slot_t* slot = first; slot != first + PROBES; ++slot)
+        {
+            const bool live = slot->hash && now_ns - slot->seen_ns < m_ttl_ns;
+            if (live && slot->hash == hash && slot->key == key)
+            {
+                slot->seen_ns = now_ns;
+                if (now_ns - slot->admitted_ns < m_cooldown_ns)
+                {
+                    ++m_suppressed;
+                    return false;
+                }
+                slot->admitted_ns = now_ns;
+                return true;
+            }
+
+            if (!live)
+                victim = slot;
+            else if (victim->hash && now_ns - victim->seen_ns < m_ttl_ns && slot->seen_ns < victim->seen_ns)
+                victim = slot;
+        }
+
+        victim->hash        = hash;
+        victim->key         = key;
+        victim->seen_ns     = now_ns;
+        victim->admitted_ns = now_ns;
+        return true;
+    }
+
+    void clear()
+    { std::fill(m_slots.begin(), m_slots.end(), slot_t{}); }
+
+    /**
+     * Opportunities turned down so far.
+     */
+    uint64_t suppressed() const
+    { return m_suppressed; }
+
+private:
+    struct slot_t
+    {
+        uint64_t          hash        {0};
+        opportunity_key_t key         {};
+        int64_t           seen_ns     {0};
+        int64_t           admitted_ns {0};
+    };
+
+    size_t              m_mask;
+    int64_t             m_cooldown_ns;
+    int64_t             m_ttl_ns;
+    std::vector<slot_t> m_slots;
+    uint64_t            m_suppressed;
+};
+
+#endif
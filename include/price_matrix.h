@@ -0,0 +1,263 @@
+#ifndef _PRICE_MATRIX_H
+#define _PRICE_MATRIX_H
+
+#include "exchange_api.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRICE_MATRIX_HAS_AVX2_KERNEL
+#endif
+
+
+/**
+ * Pair whose best bid on `sell_venue` is above the best offer on `buy_venue`.
+ */
+struct crossed_venues_t
+{
+    uint32_t pair_id;
+    uint32_t buy_venue;
+    uint32_t sell_venue;
+    double   buy_price;
+    double   sell_price;
+    double   quantity; // top of book size available on both legs
+};
+
+/**
+ * Best bid/offer of every (pair, venue) as structure-of-arrays matrices, so a single
+ * pass can look for crossed venues over the whole universe instead of one book event at
+ * a time.
+ *
+ * Each matrix is stored venue by venue with the pairs contiguous (padded to a multiple of
+ * four), so the kernel takes the max bid and min ask across venues for four pairs per
+ * AVX2 instruction and only goes back to the individual venues of the pairs that cross.
+ * The AVX2 kernel is picked at runtime when the CPU has it, otherwise (and on non-x86)
+ * a scalar kernel with the same results is used.
+ *
+ * The matrix is owned by one thread. Books on other threads are attached with `attach`
+ * and pulled in by `poll`, which only copies the quotes whose version moved and marks
+ * their pairs dirty for `scan_dirty`.
+ */
+class price_matrix_t
+{
+public:
+    enum class kernel_t { SCALAR, AVX2 };
+
+    price_matrix_t(size_t pairs, size_t venues)
+        : m_pairs{pairs}, m_stride{(pairs + 3) & ~size_t{3}}, m_venues{venues},
+          m_bid(m_stride * venues, 0.0), m_bid_qty(m_stride * venues, 0.0),
+          m_ask(m_stride * venues, std::numeric_limits<double>::infinity()), m_ask_qty(m_stride * venues, 0.0),
+          m_dirty((m_stride + 63) / 64, 0), m_books(pairs * venues), m_kernel{best_kernel()}
+    {
+        if (venues == 0 || venues > 32)
+            throw std::invalid_argument("price matrix supports 1 to 32 venues");
+    }
+
+    size_t pairs() const
+    { return m_pairs; }
+
+    size_t venues() const
+    { return m_venues; }
+
+    kernel_t kernel() const
+    { return m_kernel; }
+
+    /**
+     * Force a kernel, eg. to compare them. Falls back to scalar if AVX2 isn't available.
+     */
+    void set_kernel(kernel_t kernel)
+    { m_kernel = kernel == kernel_t::AVX2 ? best_kernel() : kernel_t::SCALAR; }
+
+    void update(size_t pair, size_t venue, const orderbook_t::top_of_book_t& top)
+    {
+        const size_t i = index(pair, venue);
+        m_bid[i]     = top.bid_quantity > 0 ? top.bid_price : 0.0;
+        m_bid_qty[i] = top.bid_quantity;
+        m_ask[i]     = top.ask_quantity > 0 ? top.ask_price : std::numeric_limits<double>::infinity();
+        m_ask_qty[i] = top.ask_quantity;
+        m_dirty[pair / 64] |= uint64_t{1} << (pair % 64);
+    }
+
+    /**
+     * Follow `book`'s best bid/offer in the (pair, venue) cell, see `poll`. The book must
+     * outlive the matrix.
+     */
+    void attach(size_t pair, size_t venue, const orderbook_t& book)
+    {
+        index(pair, venue);
+        m_books[pair * m_venues + venue] = book_ref_t{&book, ~uint64_t{0}};
+    }
+
+    /**
+     * Copy the quotes of attached books that changed since the last poll, returns how many.
+     */
+    size_t poll()
+    {
+        size_t changed = 0;
+        for (size_t pair = 0; pair < m_pairs; ++pair)
+        {
+            for (size_t venue = 0; venue < m_venues; ++venue)
+            {
+                book_ref_t& ref = m_books[pair * m_venues + venue];
+                if (!ref.book)
+                    continue;
+                const uint64_t version = ref.book->top_of_book_version();
+                if (version == ref.version)
+                    continue;
+                ref.version = version;
+                update(pair, venue, ref.book->top_of_book());
+                ++changed;
+            }
+        }
+        return changed;
+    }
+
+    /**
+     * Append every crossed (pair, buy venue, sell venue) to `out`, returns how many. Only
+     * crossings of at least `min_spread_bps` of the buy price count.
+     */
+    size_t scan(std::vector<crossed_venues_t>& out, double min_spread_bps = 0) const
+    {
+        const double factor = 1 + min_spread_bps * 1e-4;
+        return m_kernel == kernel_t::AVX2 ? scan_blocks_avx2(0, m_stride, out, factor)
+                                          : scan_blocks_scalar(0, m_stride, out, factor);
+    }
+
+    /**
+     * Like `scan` but only over the pairs updated since the last `scan_dirty`.
+     */
+    size_t scan_dirty(std::vector<crossed_venues_t>& out, double min_spread_bps = 0)
+    {
+        const double factor = 1 + min_spread_bps * 1e-4;
+        size_t found = 0;
+        for (size_t w = 0; w < m_dirty.size(); ++w)
+        {
+            uint64_t bits = m_dirty[w];
+            m_dirty[w] = 0;
+            // whole blocks of four pairs holding a dirty one
+            while (bits)
+            {
+                const size_t block = static_cast<size_t>(__builtin_ctzll(bits)) & ~size_t{3};
+                bits &= ~(uint64_t{0xf} << block);
+                const size_t begin = w * 64 + block;
+                found += m_kernel == kernel_t::AVX2 ? scan_blocks_avx2(begin, begin + 4, out, factor)
+                                                    : scan_blocks_scalar(begin, begin + 4, out, factor);
+            }
+        }
+        return found;
+    }
+
+private:
+    struct book_ref_t
+    {
+        const orderbook_t* book    {nullptr};
+        uint64_t           version {0};
+    };
+
+    size_t                  m_pairs;
+    size_t                  m_stride;  // pairs rounded up to a multiple of four
+    size_t                  m_venues;
+    std::vector<double>     m_bid;     // [venue * stride + pair], 0 when empty
+    std::vector<double>     m_bid_qty;
+    std::vector<double>     m_ask;     // +inf when empty
+    std::vector<double>     m_ask_qty;
+    std::vector<uint64_t>   m_dirty;   // bit per pair
+    std::vector<book_ref_t> m_books;   // [pair * venues + venue]
+    kernel_t                m_kernel;
+
+    size_t index(size_t pair, size_t venue) const
+    {
+        if (pair >= m_pairs || venue >= m_venues)
+            throw std::out_of_range("price matrix has no such pair or venue");
+        return venue * m_stride + pair;
+    }
+
+    static kernel_t best_kernel()
+    {
+#ifdef PRICE_MATRIX_HAS_AVX2_KERNEL
+        if (__builtin_cpu_supports("avx2"))
+            return kernel_t::AVX2;
+#endif
+        return kernel_t::SCALAR;
+    }
+
+    /**
+     * Report the crossings of a pair already known to have max bid > min ask * factor.
+     */
+    size_t report(size_t pair, std::vector<crossed_venues_t>& out, double factor) const
+    {
+        size_t found = 0;
+        for (size_t buy = 0; buy < m_venues; ++buy)
+        {
+            const double ask = m_ask[buy * m_stride + pair];
+            for (size_t sell = 0; sell < m_venues; ++sell)
+            {
+                const double bid = m_bid[sell * m_stride + pair];
+                if (sell == buy || bid <= ask * factor)
+                    continue;
+                const double buy_qty  = m_ask_qty[buy * m_stride + pair];
+                const double sell_qty = m_bid_qty[sell * m_stride + pair];
+                out.push_back(crossed_venues_t{static_cast<uint32_t>(pair), static_cast<uint32_t>(buy),
+                        static_cast<uint32_t>(sell), ask, bid, buy_qty < sell_qty ? buy_qty : sell_qty});
+                ++found;
+            }
+        }
+        return found;
+    }
+
+    size_t scan_blocks_scalar(size_t begin, size_t end, std::vector<crossed_venues_t>& out, double factor) const
+    {
+        size_t found = 0;
+        for (size_t pair = begin; pair < end && pair < m_pairs; ++pair)
+        {
+            double max_bid = 0;
+            double min_ask = std::numeric_limits<double>::infinity();
+            for (size_t venue = 0; venue < m_venues; ++venue)
+            {
+                max_bid = std::max(max_bid, m_bid[venue * m_stride + pair]);
+                min_ask = std::min(min_ask, m_ask[venue * m_stride + pair]);
+            }
+            if (max_bid > min_ask * factor)
+                found += report(pair, out, factor);
+        }
+        return found;
+    }
+
+#ifdef PRICE_MATRIX_HAS_AVX2_KERNEL
+    __attribute__((target("avx2")))
+    size_t scan_blocks_avx2(size_t begin, size_t end, std::vector<crossed_venues_t>& out, double factor) const
+    {
+        const __m256d scale = _mm256_set1_pd(factor);
+        size_t found = 0;
+        for (size_t pair = begin; pair < end; pair += 4)
+        {
+            __m256d max_bid = _mm256_loadu_pd(&m_bid[pair]);
+            __m256d min_ask = _mm256_loadu_pd(&m_ask[pair]);
+            for (size_t venue = 1; venue < m_venues; ++venue)
+            {
+                max_bid = _mm256_max_pd(max_bid, _mm256_loadu_pd(&m_bid[venue * m_stride + pair]));
+                min_ask = _mm256_min_pd(min_ask, _mm256_loadu_pd(&m_ask[venue * m_stride + pair]));
+            }
+            int crossed = _mm256_movemask_pd(_mm256_cmp_pd(max_bid, _mm256_mul_pd(min_ask, scale), _CMP_GT_OQ));
+            while (crossed)
+            {
+                const size_t lane = static_cast<size_t>(__builtin_ctz(crossed));
+                crossed &= crossed - 1;
+                if (pair + lane < m_pairs)
+                    found += report(pair + lane, out, factor);
+            }
+        }
+        return found;
+    }
+#else
+    size_t scan_blocks_avx2(size_t begin, size_t end, std::vector<crossed_venues_t>& out, double factor) const
+    { return scan_blocks_scalar(begin, end, out, factor); }
+#endif
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef _REACTOR_POOL_H
+#define _REACTOR_POOL_H
+
+#include "config.h"
+#include "market_socket.h"
+#include "thread_util.h"
+#include "logger.h"
+
+#include <asio.hpp>
+
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/**
+ * Small set of asio io_contexts, each run by one thread, that market feed sockets can
+ * share instead of every feed running its own context on its own thread.
+ *
+ * Sockets are assigned to a reactor explicitly by index, so which connections share a
+ * thread (and which core that thread sits on) is decided by the caller.
+ */
+class reactor_pool
+{
+public:
+    reactor_pool(size_t reactors, const thread_placement_t& placement = thread_config_t{}[thread_role::REACTOR])
+        : m_reactors{}, m_placement{placement}, m_busy_poll{}
+    {
+        if (reactors == 0)
+            throw std::invalid_argument("reactor_pool needs at least one reactor");
+
+        for (size_t i = 0; i < reactors; ++i)
+            m_reactors.emplace_back(std::make_unique<reactor_t>());
+    }
+
+    ~reactor_pool()
+    {
+        stop();
+    }
+
+    asio::io_context& context(size_t index)
+    {
+        return m_reactors.at(index)->io_context;
+    }
+
+    size_t size() const
+    { return m_reactors.size(); }
+
+    /**
+     * Have the reactor threads spin instead of sleeping in epoll, see `run_io_context`.
+     * Must be called before `start`.
+     */
+    void set_busy_poll(const busy_poll_config_t& config)
+    {
+        m_busy_poll = config;
+    }
+
+    void start()
+    {
+        for (size_t i = 0; i < m_reactors.size(); ++i)
+        {
+            reactor_t& reactor = *m_reactors[i];
+            if (reactor.thread)
+                throw std::logic_error("reactor_pool started when it is already running");
+
+            reactor.io_context.restart();
+            reactor.work_guard = std::make_unique<work_guard_t>(reactor.io_context.get_executor());
+            reactor.thread = std::make_unique<std::jthread>([this, &reactor, i]() {
+                    apply_thread_placement(m_placement, i);
+                    run_io_context(reactor.io_context, m_busy_poll);
+                });
+        }
+    }
+
+    /**
+     * Let the reactors finish their outstanding work (eg. sockets closing) and join them.
+     */
+    void join()
+    {
+        for (auto& reactor : m_reactors)
+            reactor->work_guard = nullptr;
+
+        for (auto& reactor : m_reactors)
+        {
+            if (!reactor->thread) continue;
+            reactor->thread->join();
+            reactor->thread = nullptr;
+        }
+    }
+
+    /**
+     * Stop the reactors immediately, abandoning any outstanding work.
+     */
+    void stop()
+    {
+        for (auto& reactor : m_reactors)
+            reactor->io_context.stop();
+        join();
+    }
+
+private:
+    typedef asio::executor_work_guard<asio::io_context::executor_type> work_guard_t;
+
+    struct reactor_t
+    {
+        asio::io_context              io_context;
+        std::unique_ptr<work_guard_t> work_guard;
+        std::unique_ptr<std::jthread> thread;
+    };
+
+    std::vector<std::unique_ptr<reactor_t>> m_reactors;
+    thread_placement_t                      m_placement;
+    busy_poll_config_t                      m_busy_poll;
+};
+
+#endif
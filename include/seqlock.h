@@ -0,0 +1,88 @@
+#ifndef _SEQLOCK_H
+#define _SEQLOCK_H
+
+#include "thread_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * Single writer, many reader publication of a small trivially copyable value. Readers
+ * never block the writer, they retry whenever a write overlapped their copy.
+ *
+ * The value is kept in relaxed atomic words so the overlapping copy is well defined.
+ */
+template <typename T>
+class seqlock
+{
+    static_assert(std::is_trivially_copyable_v<T>, "seqlock requires a trivially copyable type");
+
+    static constexpr const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+public:
+    seqlock()
+        : m_seq{0}, m_words{}
+    {
+        store(T{});
+    }
+
+    seqlock(const seqlock&) = delete;
+    seqlock& operator=(const seqlock&) = delete;
+
+    /**
+     * Only ever called from one thread at a time.
+     */
+    void store(const T& value)
+    {
+        uint64_t buf[WORDS] {};
+        std::memcpy(buf, &value, sizeof(T));
+
+        const uint64_t seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < WORDS; ++i)
+            m_words[i].store(buf[i], std::memory_order_relaxed);
+
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    T load() const
+    {
+        uint64_t buf[WORDS];
+        for (;;)
+        {
+            const uint64_t before = m_seq.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                cpu_relax();
+                continue;
+            }
+
+            for (size_t i = 0; i < WORDS; ++i)
+                buf[i] = m_words[i].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_seq.load(std::memory_order_relaxed) == before)
+                break;
+        }
+
+        T value;
+        std::memcpy(&value, buf, sizeof(T));
+        return value;
+    }
+
+    /**
+     * Number of stores so far, cheap way for a reader to tell whether anything changed.
+     */
+    uint64_t version() const
+    { return m_seq.load(std::memory_order_acquire) >> 1; }
+
+private:
+    alignas(64) std::atomic<uint64_t> m_seq;
+    std::atomic<uint64_t>             m_words[WORDS];
+};
+
+#endif
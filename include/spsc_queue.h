@@ -0,0 +1,123 @@
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+constexpr const size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * Bounded single-producer/single-consumer ring buffer.
+ *
+ * Slots are constructed once and reused, so the producer writes into the slot
+ * in place (`write_slot`/`commit_write`) and the consumer reads it in place
+ * (`read_slot`/`commit_read`). For slot types that own memory (eg. std::string,
+ * std::vector) this means no allocations once the slot capacities have warmed up.
+ *
+ * N must be a power of two.
+ */
+template <typename T, size_t N>
+class spsc_queue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "spsc_queue size must be a power of two");
+    static constexpr const size_t MASK = N - 1;
+
+public:
+    spsc_queue()
+        : m_head{0}, m_tail{0}, m_cached_head{0}, m_cached_tail{0}, m_slots{}
+    {}
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    /**
+     * Producer side. Returns pointer to the next free slot or nullptr if the queue is full.
+     * The slot is only made visible to the consumer after `commit_write()`.
+     */
+    T* write_slot()
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cached_head == N)
+        {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail - m_cached_head == N)
+                return nullptr;
+        }
+
+        return &m_slots[tail & MASK];
+    }
+
+    void commit_write()
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    template <typename U>
+    bool try_push(U&& item)
+    {
+        T* slot = write_slot();
+        if (!slot)
+            return false;
+
+        *slot = std::forward<U>(item);
+        commit_write();
+        return true;
+    }
+
+    /**
+     * Consumer side. Returns pointer to the oldest slot or nullptr if the queue is empty.
+     * The slot is handed back to the producer after `commit_read()`.
+     */
+    T* read_slot()
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cached_tail)
+        {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cached_tail)
+                return nullptr;
+        }
+
+        return &m_slots[head & MASK];
+    }
+
+    void commit_read()
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool try_pop(T& item)
+    {
+        T* slot = read_slot();
+        if (!slot)
+            return false;
+
+        item = std::move(*slot);
+        commit_read();
+        return true;
+    }
+
+    size_t size_approx() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity()
+    { return N; }
+
+private:
+    // consumer owned
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head;
+    // producer owned
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail;
+    // producer's copy of the consumer index and vice-versa, avoids
+    // bouncing the other cache line on every operation
+    alignas(CACHE_LINE_SIZE) size_t m_cached_head;
+    alignas(CACHE_LINE_SIZE) size_t m_cached_tail;
+
+    alignas(CACHE_LINE_SIZE) std::array<T, N> m_slots;
+};
+
+#endif
@@ -0,0 +1,752 @@
+#ifndef _STRATEGY_CORO_H
+#define _STRATEGY_CORO_H
+
+#include "exchange_api.h"
+#include "wallet.h"
+#include "thread_util.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/**
+ * Coroutine layer for writing strategies as straight-line code:
+ *
+ *     coro_task<void> two_legs(orderbook_t& a, orderbook_t& b)
+ *     {
+ *         while (true)
+ *         {
+ *             const book_snapshot_t& book = co_await coro::book_changed(a.pair);
+ *             ...
+ *             std::optional<order_status> ack = co_await coro::submit(order);
+ *             co_await coro::timeout(5ms);
+ *         }
+ *     }
+ *
+ *     scheduler.spawn(two_legs(a, b));
+ *     scheduler.run();
+ *
+ * Everything runs on the single thread calling `coro_scheduler::run()`. Orders are sent
+ * from a separate gateway thread so the blocking REST calls never stall the scheduler.
+ * Coroutine frames created while the scheduler runs come from its pool and the awaiters
+ * live inside the frames, so awaiting never allocates.
+ */
+
+
+/**
+ * Free-list of fixed size blocks for coroutine frames, owned by a `coro_scheduler`. Each
+ * frame starts with a header naming the pool it came from, so it always goes back to that
+ * pool. Frames that don't fit in a block, or are created without a pool, use the global
+ * allocator. Not thread-safe: a pooled frame must be destroyed on the thread that created
+ * it, which holds since every coroutine runs on its scheduler's thread.
+ */
+class coro_frame_pool
+{
+public:
+    static constexpr const size_t BLOCK_SIZE   = 1024;
+    static constexpr const size_t CHUNK_BLOCKS = 64;
+
+    coro_frame_pool()
+        : m_free{nullptr}, m_chunks{}
+    {}
+
+    coro_frame_pool(const coro_frame_pool&) = delete;
+    coro_frame_pool& operator=(const coro_frame_pool&) = delete;
+
+    static void* allocate(coro_frame_pool* pool, size_t size)
+    {
+        header_t* header;
+        if (pool && size <= BLOCK_SIZE - sizeof(header_t))
+        {
+            if (!pool->m_free)
+                pool->grow();
+            header = std::exchange(pool->m_free, pool->m_free->next);
+        }
+        else
+        {
+            header = static_cast<header_t*>(::operator new(sizeof(header_t) + size));
+            pool   = nullptr;
+        }
+
+        header->pool = pool;
+        return header + 1;
+    }
+
+    static void deallocate(void* ptr)
+    {
+        header_t* header = static_cast<header_t*>(ptr) - 1;
+        coro_frame_pool* pool = header->pool;
+        if (!pool)
+        {
+            ::operator delete(header);
+            return;
+        }
+
+        header->next = pool->m_free;
+        pool->m_free = header;
+    }
+
+private:
+    // in front of every frame, or linking the free blocks
+    union alignas(std::max_align_t) header_t
+    {
+        coro_frame_pool* pool;
+        header_t*        next;
+    };
+
+    struct alignas(std::max_align_t) block_t
+    {
+        std::byte data[BLOCK_SIZE];
+    };
+
+    header_t* m_free;
+    std::vector<std::unique_ptr<block_t[]>> m_chunks;
+
+    void grow()
+    {
+        block_t* chunk = m_chunks.emplace_back(std::make_unique<block_t[]>(CHUNK_BLOCKS)).get();
+        for (size_t i = 0; i < CHUNK_BLOCKS; ++i)
+        {
+            header_t* header = reinterpret_cast<header_t*>(&chunk[i]);
+            header->next = m_free;
+            m_free = header;
+        }
+    }
+};
+
+
+template <typename T = void>
+class coro_task;
+
+class coro_scheduler;
+
+// a spawned task finished on `sched`'s thread, see `coro_scheduler::forget`
+void coro_detached_done(coro_scheduler* sched, std::coroutine_handle<> handle);
+
+struct coro_promise_base
+{
+    std::coroutine_handle<> continuation {};
+    std::exception_ptr      exception    {};
+    bool                    detached     {false};
+    coro_scheduler*         scheduler    {nullptr}; // owning scheduler once detached
+
+    // frames created on a scheduler's thread come from its pool, see below
+    static void* operator new(size_t size);
+
+    static void operator delete(void* ptr)
+    { coro_frame_pool::deallocate(ptr); }
+
+    struct final_awaiter
+    {
+        bool await_ready() noexcept
+        { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            coro_promise_base& promise = handle.promise();
+            if (promise.continuation)
+                return promise.continuation;
+
+            if (promise.detached)
+            {
+                // nobody is left to observe the exception of a spawned task
+                if (promise.exception)
+                {
+                    try { std::rethrow_exception(promise.exception); }
+                    catch (const std::exception& e) { log("ERROR strategy coroutine threw: {}", e.what()); }
+                    catch (...) { log("ERROR strategy coroutine threw unknown exception"); }
+                }
+                coro_detached_done(promise.scheduler, handle);
+                handle.destroy();
+            }
+
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept
+    { return {}; }
+
+    final_awaiter final_suspend() noexcept
+    { return {}; }
+
+    void unhandled_exception() noexcept
+    { exception = std::current_exception(); }
+};
+
+/**
+ * Lazily started coroutine. Either `co_await` it from another coroutine or hand it to
+ * `coro_scheduler::spawn`.
+ */
+template <typename T>
+class coro_task
+{
+public:
+    struct promise_type : coro_promise_base
+    {
+        std::optional<T> value {};
+
+        coro_task get_return_object()
+        { return coro_task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+
+        template <typename U>
+        void return_value(U&& val)
+        { value.emplace(std::forward<U>(val)); }
+    };
+
+    coro_task(coro_task&& other) noexcept
+        : m_handle{std::exchange(other.m_handle, nullptr)}
+    {}
+
+    coro_task(const coro_task&) = delete;
+
+    ~coro_task()
+    {
+        if (m_handle) m_handle.destroy();
+    }
+
+    bool await_ready() const noexcept
+    { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        m_handle.promise().continuation = caller;
+        return m_handle;
+    }
+
+    T await_resume()
+    {
+        promise_type& promise = m_handle.promise();
+        if (promise.exception)
+            std::rethrow_exception(promise.exception);
+        return std::move(*promise.value);
+    }
+
+    std::coroutine_handle<promise_type> release()
+    { return std::exchange(m_handle, nullptr); }
+
+private:
+    explicit coro_task(std::coroutine_handle<promise_type> handle)
+        : m_handle{handle}
+    {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template <>
+class coro_task<void>
+{
+public:
+    struct promise_type : coro_promise_base
+    {
+        coro_task get_return_object()
+        { return coro_task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+
+        void return_void()
+        {}
+    };
+
+    coro_task(coro_task&& other) noexcept
+        : m_handle{std::exchange(other.m_handle, nullptr)}
+    {}
+
+    coro_task(const coro_task&) = delete;
+
+    ~coro_task()
+    {
+        if (m_handle) m_handle.destroy();
+    }
+
+    bool await_ready() const noexcept
+    { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        m_handle.promise().continuation = caller;
+        return m_handle;
+    }
+
+    void await_resume()
+    {
+        if (m_handle.promise().exception)
+            std::rethrow_exception(m_handle.promise().exception);
+    }
+
+    std::coroutine_handle<promise_type> release()
+    { return std::exchange(m_handle, nullptr); }
+
+private:
+    explicit coro_task(std::coroutine_handle<promise_type> handle)
+        : m_handle{handle}
+    {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+
+/**
+ * Copy of a book taken on the scheduler thread when it wakes the coroutines waiting on it,
+ * the feed thread keeps updating the book itself meanwhile.
+ */
+struct book_snapshot_t
+{
+    exchange_api_t                    exchange;
+    instrument_pair_t                 pair;
+    orderbook_t::top_of_book_t        top;
+    std::vector<orderbook_t::order_t> bids; // guarded levels, best first
+    std::vector<orderbook_t::order_t> asks;
+};
+
+/**
+ * Single-threaded scheduler resuming coroutines on book changes, order acks and timers.
+ *
+ * `spawn`, `notify_book_changed`, `stop` and order completions may come from any thread;
+ * everything else, including running the coroutines, happens on the thread inside `run()`.
+ */
+class coro_scheduler
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    struct book_awaiter
+    {
+        coro_scheduler&          sched;
+        uint64_t                 key;
+        const book_snapshot_t*   book   {nullptr};
+        std::coroutine_handle<>  handle {};
+        book_awaiter*            next   {nullptr};
+
+        bool await_ready() const noexcept
+        { return false; }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            handle = h;
+            book_awaiter*& head = sched.m_book_waiters[key];
+            next = head;
+            head = this;
+        }
+
+        const book_snapshot_t& await_resume() const noexcept
+        { return *book; }
+    };
+
+    struct order_awaiter
+    {
+        coro_scheduler&             sched;
+        order_request_t             order;
+        std::optional<order_status> result {};
+        std::coroutine_handle<>     handle {};
+        order_awaiter*              next   {nullptr};
+
+        bool await_ready() const noexcept
+        { return false; }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            handle = h;
+            sched.enqueue_order(this);
+        }
+
+        std::optional<order_status> await_resume()
+        { return std::move(result); }
+    };
+
+    struct timer_awaiter
+    {
+        coro_scheduler&   sched;
+        clock::time_point deadline;
+
+        bool await_ready() const noexcept
+        { return deadline <= clock::now(); }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            sched.m_timers.push_back(timer_t{deadline, h});
+            std::push_heap(sched.m_timers.begin(), sched.m_timers.end(), timer_t::later);
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    coro_scheduler()
+        : m_ready{}, m_resuming{}, m_timers{}, m_book_waiters{}, m_snapshots{}, m_tasks{}, m_changed_swap{}, m_gateways{}, m_frames{},
+          m_mutex{}, m_cv{}, m_changed_books{}, m_spawned{}, m_completed{nullptr}, m_stop{false}, m_notified{false},
+          m_gateway_mutex{}, m_gateway_cv{}, m_gateway_head{nullptr}, m_gateway_tail{nullptr},
+          m_gateway_thread{nullptr}, m_placement{},
+          m_gateway_placement{thread_config_t{}[thread_role::ORDER_GATEWAY]}
+    {
+        m_ready.reserve(64);
+        m_resuming.reserve(64);
+        m_timers.reserve(64);
+        m_changed_books.reserve(16);
+        m_changed_swap.reserve(16);
+    }
+
+    /**
+     * Destroys the coroutines that are still suspended (or were never started), so their
+     * frames are freed and their locals' destructors run. Must not run concurrently with
+     * `run()`.
+     */
+    ~coro_scheduler()
+    {
+        stop_gateway();
+
+        // destroying a spawned task destroys the tasks it is awaiting along with it
+        for (void* address : m_tasks)
+            std::coroutine_handle<>::from_address(address).destroy();
+        for (std::coroutine_handle<> handle : m_spawned)
+            handle.destroy();
+    }
+
+    void set_order_gateway(exchange_api_t exchange, order_gateway_t gateway)
+    {
+        m_gateways.at(static_cast<size_t>(exchange)) = std::move(gateway);
+    }
+
+    /**
+     * `scheduler` is applied to the thread calling `run()` when it starts, and `gateway`
+     * to the order gateway thread. Must be called before `run()`.
+     */
+    void set_thread_placement(const thread_placement_t& scheduler, const thread_placement_t& gateway)
+    {
+        m_placement = scheduler;
+        m_gateway_placement = gateway;
+    }
+
+    /**
+     * Take ownership of `task` and start it on the next iteration of `run()`. Thread-safe.
+     */
+    void spawn(coro_task<void>&& task)
+    {
+        auto handle = task.release();
+        handle.promise().detached  = true;
+        handle.promise().scheduler = this;
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_spawned.push_back(handle);
+            m_notified = true;
+        }
+        m_cv.notify_one();
+    }
+
+    /**
+     * Wake up the coroutines waiting on `book.pair`. Thread-safe, changes to the same
+     * book are coalesced until the scheduler gets to them.
+     */
+    void notify_book_changed(const orderbook_t& book)
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            for (const orderbook_t* changed : m_changed_books)
+                if (changed == &book) return;
+            m_changed_books.push_back(&book);
+            m_notified = true;
+        }
+        m_cv.notify_one();
+    }
+
+    template <typename MarketFeed>
+    void attach_to_feed(const feed_event_t& event, MarketFeed& mf) requires is_market_feed<MarketFeed>
+    {
+        mf.register_raw_event_handler(event, &coro_scheduler::_feed_handler, std::make_any<coro_scheduler*>(this));
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_stop = true;
+        }
+        m_cv.notify_one();
+    }
+
+    /**
+     * Run coroutines on the calling thread until `stop()` is called. Suspended coroutines
+     * stay suspended and carry on if `run()` is called again.
+     */
+    void run()
+    {
+        s_current = this;
+        apply_thread_placement(m_placement);
+        start_gateway();
+
+        while (true)
+        {
+            order_awaiter* completed = nullptr;
+            {
+                std::unique_lock<std::mutex> lock{m_mutex};
+                if (m_ready.empty() && !m_notified && !m_stop)
+                {
+                    if (m_timers.empty())
+                        m_cv.wait(lock, [this]() { return m_notified || m_stop; });
+                    else
+                        m_cv.wait_until(lock, m_timers.front().deadline, [this]() { return m_notified || m_stop; });
+                }
+
+                if (m_stop)
+                    break;
+
+                m_notified = false;
+                for (std::coroutine_handle<> handle : m_spawned)
+                    m_tasks.insert(handle.address());
+                m_ready.insert(m_ready.end(), m_spawned.begin(), m_spawned.end());
+                m_spawned.clear();
+                m_changed_books.swap(m_changed_swap);
+                completed = std::exchange(m_completed, nullptr);
+            }
+
+            for (const orderbook_t* book : m_changed_swap)
+                wake_book_waiters(*book);
+            m_changed_swap.clear();
+
+            for (; completed; completed = completed->next)
+                m_ready.push_back(completed->handle);
+
+            const clock::time_point now = clock::now();
+            while (!m_timers.empty() && m_timers.front().deadline <= now)
+            {
+                std::pop_heap(m_timers.begin(), m_timers.end(), timer_t::later);
+                m_ready.push_back(m_timers.back().handle);
+                m_timers.pop_back();
+            }
+
+            // coroutines resumed here may make others ready, those run next iteration
+            m_resuming.swap(m_ready);
+            for (std::coroutine_handle<> handle : m_resuming)
+                handle.resume();
+            m_resuming.clear();
+        }
+
+        stop_gateway();
+        s_current = nullptr;
+
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_stop = false;
+    }
+
+    /**
+     * Scheduler running on the current thread, nullptr outside of `run()`.
+     */
+    static coro_scheduler* current()
+    { return s_current; }
+
+    coro_frame_pool& frame_pool()
+    { return m_frames; }
+
+    /**
+     * Spawned task `handle` ran to completion, scheduler thread only.
+     */
+    void forget(std::coroutine_handle<> handle)
+    { m_tasks.erase(handle.address()); }
+
+    book_awaiter book_changed(const instrument_pair_t& pair)
+    { return book_awaiter{*this, instrument_pair::hash(pair)}; }
+
+    order_awaiter submit(const order_request_t& order)
+    { return order_awaiter{*this, order}; }
+
+    template <typename Rep, typename Period>
+    timer_awaiter timeout(std::chrono::duration<Rep, Period> duration)
+    { return timer_awaiter{*this, clock::now() + duration}; }
+
+private:
+    struct timer_t
+    {
+        clock::time_point       deadline;
+        std::coroutine_handle<> handle;
+
+        static bool later(const timer_t& lhs, const timer_t& rhs)
+        { return lhs.deadline > rhs.deadline; }
+    };
+
+    // scheduler thread only
+    std::vector<std::coroutine_handle<>>             m_ready;
+    std::vector<std::coroutine_handle<>>             m_resuming;
+    std::vector<timer_t>                             m_timers;
+    std::unordered_map<uint64_t, book_awaiter*>      m_book_waiters;
+    std::unordered_map<uint64_t, book_snapshot_t>    m_snapshots;    // handed to the waiters woken last
+    std::unordered_set<void*>                        m_tasks;        // spawned tasks that haven't finished
+    std::vector<const orderbook_t*>                  m_changed_swap;
+    std::array<order_gateway_t, exchange_api::COUNT> m_gateways;
+    coro_frame_pool                                  m_frames;
+
+    // shared with feed, gateway and spawning threads
+    std::mutex                           m_mutex;
+    std::condition_variable              m_cv;
+    std::vector<const orderbook_t*>      m_changed_books;
+    std::vector<std::coroutine_handle<>> m_spawned;
+    order_awaiter*                       m_completed;
+    bool                                 m_stop;
+    bool                                 m_notified;
+
+    // order gateway
+    std::mutex                    m_gateway_mutex;
+    std::condition_variable_any   m_gateway_cv;
+    order_awaiter*                m_gateway_head;
+    order_awaiter*                m_gateway_tail;
+    std::unique_ptr<std::jthread> m_gateway_thread;
+
+    thread_placement_t m_placement;
+    thread_placement_t m_gateway_placement;
+
+    static inline thread_local coro_scheduler* s_current = nullptr;
+
+    void wake_book_waiters(const orderbook_t& book)
+    {
+        const uint64_t key = instrument_pair::hash(book.pair);
+        auto it = m_book_waiters.find(key);
+        if (it == m_book_waiters.end() || !it->second)
+            return;
+
+        // only the thread-safe parts of the book are read, the feed thread may be updating it
+        book_snapshot_t& snapshot = m_snapshots.try_emplace(key, book_snapshot_t{book.exchange, book.pair, {}, {}, {}}).first->second;
+        snapshot.exchange = book.exchange;
+        snapshot.top      = book.top_of_book();
+        book.copy_guarded_bids(snapshot.bids);
+        book.copy_guarded_asks(snapshot.asks);
+
+        book_awaiter* waiter = std::exchange(it->second, nullptr);
+        for (; waiter; waiter = waiter->next)
+        {
+            waiter->book = &snapshot;
+            m_ready.push_back(waiter->handle);
+        }
+    }
+
+    void enqueue_order(order_awaiter* order)
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_gateway_mutex};
+            if (m_gateway_tail) m_gateway_tail->next = order;
+            else m_gateway_head = order;
+            m_gateway_tail = order;
+        }
+        m_gateway_cv.notify_one();
+    }
+
+    void complete_order(order_awaiter* order)
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            order->next = m_completed;
+            m_completed = order;
+            m_notified = true;
+        }
+        m_cv.notify_one();
+    }
+
+    void start_gateway()
+    {
+        if (m_gateway_thread)
+            return;
+        m_gateway_thread = std::make_unique<std::jthread>([this](std::stop_token stoken) { _run_gateway(stoken); });
+    }
+
+    void stop_gateway()
+    {
+        if (!m_gateway_thread)
+            return;
+        m_gateway_thread->request_stop();
+        m_gateway_thread->join();
+        m_gateway_thread = nullptr;
+    }
+
+    void _run_gateway(const std::stop_token& stoken)
+    {
+        apply_thread_placement(m_gateway_placement);
+
+        while (true)
+        {
+            order_awaiter* order = nullptr;
+            {
+                std::unique_lock<std::mutex> lock{m_gateway_mutex};
+                if (!m_gateway_cv.wait(lock, stoken, [this]() { return m_gateway_head != nullptr; }))
+                    return;
+
+                order = m_gateway_head;
+                m_gateway_head = order->next;
+                if (!m_gateway_head) m_gateway_tail = nullptr;
+                order->next = nullptr;
+            }
+
+            const order_gateway_t& gateway = m_gateways.at(static_cast<size_t>(order->order.exchange));
+            if (!gateway)
+            {
+                log("ERROR no order gateway set for {}", exchange_api::to_string(order->order.exchange));
+            }
+            else
+            {
+                try {
+                    order->result = gateway(order->order);
+                } catch (const std::exception& e) {
+                    log("ERROR order gateway for {} threw: {}", exchange_api::to_string(order->order.exchange), e.what());
+                }
+            }
+
+            complete_order(order);
+        }
+    }
+
+    static bool _feed_handler(const orderbook_t& book, std::any& this_ptr)
+    {
+        std::any_cast<coro_scheduler*>(this_ptr)->notify_book_changed(book);
+        return true;
+    }
+};
+
+
+inline void coro_detached_done(coro_scheduler* sched, std::coroutine_handle<> handle)
+{
+    if (sched)
+        sched->forget(handle);
+}
+
+inline void* coro_promise_base::operator new(size_t size)
+{
+    // coroutines created before `run()`, or on other threads, aren't pooled
+    coro_scheduler* sched = coro_scheduler::current();
+    return coro_frame_pool::allocate(sched ? &sched->frame_pool() : nullptr, size);
+}
+
+
+namespace coro {
+    inline coro_scheduler& current_scheduler()
+    {
+        coro_scheduler* sched = coro_scheduler::current();
+        if (!sched)
+            throw std::logic_error("coroutine awaited outside of coro_scheduler::run()");
+        return *sched;
+    }
+
+    // resumes with a snapshot of the book whose change woke the coroutine, valid until
+    // the coroutine suspends again
+    inline coro_scheduler::book_awaiter book_changed(const instrument_pair_t& pair)
+    { return current_scheduler().book_changed(pair); }
+
+    // resumes once the gateway has submitted the order, with nullopt if it failed
+    inline coro_scheduler::order_awaiter submit(const order_request_t& order)
+    { return current_scheduler().submit(order); }
+
+    template <typename Rep, typename Period>
+    coro_scheduler::timer_awaiter timeout(std::chrono::duration<Rep, Period> duration)
+    { return current_scheduler().timeout(duration); }
+}
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef _STRATEGY_EXECUTOR_H
+#define _STRATEGY_EXECUTOR_H
+
+#include "exchange_api.h"
+#include "thread_util.h"
+#include "logger.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+struct executor_config_t
+{
+    size_t             workers   {1};
+    thread_placement_t placement {thread_config_t{}[thread_role::STRATEGY]}; // worker i uses placement.cpu(i)
+};
+
+/**
+ * Runs strategy evaluations off the feed threads on a pool of workers with per-worker
+ * deques and work stealing.
+ *
+ * Strategies register evaluators for a pair, and book events for that pair only enqueue
+ * a lightweight "evaluate pair" task. While a pair's task is still pending, further events
+ * for it are coalesced into that task, so a hot pair is evaluated against the latest book
+ * at most once per worker pickup instead of once per event. Each pair's evaluators are
+ * never run concurrently with each other: events arriving while they run mark the pair
+ * dirty and the worker running it queues one more pass once it is done.
+ *
+ * Workers pop their own deque LIFO and steal FIFO from the other workers when idle.
+ */
+class strategy_executor
+{
+public:
+    typedef std::function<void(const instrument_pair_t&)> evaluator_t;
+
+    struct stats_t
+    {
+        std::atomic<uint64_t> scheduled {0};
+        std::atomic<uint64_t> coalesced {0};
+        std::atomic<uint64_t> executed  {0};
+        std::atomic<uint64_t> stolen    {0};
+    };
+
+    stats_t stats;
+
+    strategy_executor(const executor_config_t& config = {})
+        : stats{}, m_config{config}, m_slots{}, m_slot_index{}, m_workers{},
+          m_submit_counter{0}, m_queued{0}, m_running{false}
+    {
+        if (m_config.workers == 0)
+            throw std::invalid_argument("strategy_executor needs at least one worker");
+    }
+
+    ~strategy_executor()
+    {
+        stop();
+    }
+
+    /**
+     * Register an evaluator to be run whenever `pair` is scheduled. Must be called before `start`.
+     */
+    void register_evaluator(const instrument_pair_t& pair, evaluator_t evaluator)
+    {
+        if (m_running)
+            throw std::logic_error("register_evaluator called while executor is running");
+
+        const uint64_t key = instrument_pair::hash(pair);
+        auto it = m_slot_index.find(key);
+        if (it == m_slot_index.end())
+        {
+            it = m_slot_index.emplace(key, m_slots.size()).first;
+            m_slots.emplace_back(std::make_unique<pair_slot_t>(pair));
+        }
+
+        m_slots[it->second]->evaluators.emplace_back(std::move(evaluator));
+    }
+
+    /**
+     * Register a raw handler on `mf` that schedules the pair of every matching event.
+     */
+    template <typename MarketFeed>
+    void attach_to_feed(const feed_event_t& event, MarketFeed& mf) requires is_market_feed<MarketFeed>
+    {
+        mf.register_raw_event_handler(event, &strategy_executor::_feed_handler, std::make_any<strategy_executor*>(this));
+    }
+
+    void start()
+    {
+        if (m_running)
+            throw std::logic_error("strategy_executor started when it is already running");
+
+        // the deques outlive `stop()` since feed handlers may still be scheduling, they
+        // are only rebuilt when evaluators for new pairs were registered meanwhile
+        if (m_workers.empty() || m_workers[0]->ring.size() != m_slots.size() + 1)
+        {
+            m_workers.clear();
+            for (size_t i = 0; i < m_config.workers; ++i)
+            {
+                // with coalescing each slot is queued at most once, so this capacity can never overflow
+                m_workers.emplace_back(std::make_unique<worker_t>(m_slots.size() + 1));
+            }
+        }
+        for (auto& worker : m_workers)
+            worker->reset();
+        for (auto& slot : m_slots)
+            slot->state.store(IDLE, std::memory_order_relaxed);
+        m_queued.store(0, std::memory_order_relaxed);
+
+        m_running.store(true, std::memory_order_release);
+        for (size_t i = 0; i < m_config.workers; ++i)
+        {
+            m_workers[i]->thread = std::make_unique<std::jthread>(
+                    [this, i](std::stop_token stoken) { _run(stoken, i); });
+        }
+    }
+
+    /**
+     * Join the workers, pairs scheduled from now on are dropped. Whatever was still queued
+     * is discarded by the next `start`.
+     */
+    void stop()
+    {
+        if (!m_running.exchange(false, std::memory_order_acq_rel))
+            return;
+
+        for (auto& worker : m_workers)
+            worker->thread->request_stop();
+
+        // wake up any sleeping workers so they see the stop request
+        m_queued.fetch_add(1, std::memory_order_release);
+        m_queued.notify_all();
+
+        for (auto& worker : m_workers)
+        {
+            worker->thread->join();
+            worker->thread = nullptr;
+        }
+    }
+
+    /**
+     * Schedule evaluation of `pair`. Thread-safe, cheap enough to call from feed handlers.
+     * Returns false if there are no evaluators registered for the pair.
+     */
+    bool schedule(const instrument_pair_t& pair)
+    {
+        auto it = m_slot_index.find(instrument_pair::hash(pair));
+        if (it == m_slot_index.end())
+            return false;
+
+        schedule_slot(it->second);
+        return true;
+    }
+
+    size_t pairs() const
+    { return m_slots.size(); }
+
+private:
+    enum slot_state_t : uint32_t
+    {
+        IDLE,
+        QUEUED,        // on a worker's deque
+        RUNNING,       // evaluators running
+        RUNNING_DIRTY  // evaluators running and scheduled again meanwhile
+    };
+
+    struct pair_slot_t
+    {
+        pair_slot_t(const instrument_pair_t& pair)
+            : pair{pair}, state{IDLE}, evaluators{}
+        {}
+
+        const instrument_pair_t   pair;
+        std::atomic<uint32_t>     state;
+        std::vector<evaluator_t>  evaluators;
+    };
+
+    /**
+     * Bounded deque of slot indices. The owner pushes/pops at the back, thieves take from the front.
+     * Contention is limited to the owner and an occasional thief so a spinlock is enough here.
+     */
+    struct worker_t
+    {
+        worker_t(size_t capacity)
+            : ring(capacity), head{0}, tail{0}, lock{}, thread{nullptr}
+        {}
+
+        std::vector<uint32_t>         ring;
+        size_t                        head;
+        size_t                        tail;
+        std::atomic_flag              lock;
+        std::unique_ptr<std::jthread> thread;
+
+        void acquire()
+        {
+            while (lock.test_and_set(std::memory_order_acquire))
+                cpu_relax();
+        }
+
+        void release()
+        { lock.clear(std::memory_order_release); }
+
+        void reset()
+        {
+            acquire();
+            head = tail = 0;
+            release();
+        }
+
+        void push_back(uint32_t slot)
+        {
+            acquire();
+            ring[tail % ring.size()] = slot;
+            ++tail;
+            release();
+        }
+
+        bool pop_back(uint32_t& slot)
+        {
+            acquire();
+            const bool found = tail != head;
+            if (found)
+                slot = ring[--tail % ring.size()];
+            release();
+            return found;
+        }
+
+        bool pop_front(uint32_t& slot)
+        {
+            acquire();
+            const bool found = tail != head;
+            if (found)
+                slot = ring[head++ % ring.size()];
+            release();
+            return found;
+        }
+    };
+
+    static constexpr const size_t IDLE_SPINS = 1 << 8;
+
+    executor_config_t m_config;
+    std::vector<std::unique_ptr<pair_slot_t>> m_slots;
+    std::unordered_map<uint64_t, size_t>      m_slot_index;
+    std::vector<std::unique_ptr<worker_t>>    m_workers;
+    std::atomic<size_t>                       m_submit_counter;
+    // bumped on every enqueue, idle workers wait on it changing
+    std::atomic<uint32_t>                     m_queued;
+    std::atomic<bool>                         m_running;
+
+    // executor and index of the worker running on this thread, -1 for non-worker threads
+    static inline thread_local const strategy_executor* s_worker_owner = nullptr;
+    static inline thread_local int                      s_worker_index = -1;
+
+    void schedule_slot(size_t index)
+    {
+        stats.scheduled.fetch_add(1, std::memory_order_relaxed);
+
+        pair_slot_t& slot = *m_slots[index];
+        uint32_t state = slot.state.load(std::memory_order_acquire);
+        for (;;)
+        {
+            if (state == QUEUED || state == RUNNING_DIRTY)
+            {
+                // already queued, the pending pass will see the latest book
+                stats.coalesced.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            // a running pair is queued again by its worker once done
+            const uint32_t next = state == RUNNING ? RUNNING_DIRTY : QUEUED;
+            if (slot.state.compare_exchange_weak(state, next, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                if (next == QUEUED)
+                    enqueue(index);
+                return;
+            }
+        }
+    }
+
+    void enqueue(size_t index)
+    {
+        if (!m_running.load(std::memory_order_acquire))
+        {
+            m_slots[index]->state.store(IDLE, std::memory_order_relaxed);
+            return;
+        }
+
+        // workers keep their own tasks local, other threads (including workers of other
+        // executors) spread them round-robin
+        const size_t target = s_worker_owner == this ? static_cast<size_t>(s_worker_index)
+            : m_submit_counter.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+        m_workers[target]->push_back(static_cast<uint32_t>(index));
+        m_queued.fetch_add(1, std::memory_order_release);
+        m_queued.notify_one();
+    }
+
+    bool steal(size_t self, uint32_t& slot)
+    {
+        const size_t n = m_workers.size();
+        for (size_t i = 1; i < n; ++i)
+        {
+            if (m_workers[(self + i) % n]->pop_front(slot))
+            {
+                stats.stolen.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_slot(uint32_t index)
+    {
+        pair_slot_t& slot = *m_slots[index];
+        // only the worker that popped the slot moves it out of QUEUED
+        slot.state.store(RUNNING, std::memory_order_release);
+
+        for (auto& evaluator : slot.evaluators)
+            evaluator(slot.pair);
+
+        stats.executed.fetch_add(1, std::memory_order_relaxed);
+
+        uint32_t state = RUNNING;
+        if (slot.state.compare_exchange_strong(state, IDLE, std::memory_order_acq_rel, std::memory_order_acquire))
+            return;
+
+        // scheduled while running, evaluate once more against the latest book
+        slot.state.store(QUEUED, std::memory_order_release);
+        enqueue(index);
+    }
+
+    void _run(const std::stop_token& stoken, size_t self)
+    {
+        apply_thread_placement(m_config.placement, self);
+        s_worker_owner = this;
+        s_worker_index = static_cast<int>(self);
+
+        worker_t& worker = *m_workers[self];
+        size_t idle = 0;
+        while (!stoken.stop_requested())
+        {
+            const uint32_t seen = m_queued.load(std::memory_order_acquire);
+            // stop() bumps `m_queued` after requesting the stop, so waiting on a value read
+            // after the bump would never wake up
+            if (stoken.stop_requested())
+                break;
+
+            uint32_t slot;
+            if (worker.pop_back(slot) || steal(self, slot))
+            {
+                idle = 0;
+                run_slot(slot);
+                continue;
+            }
+
+            if (++idle < IDLE_SPINS)
+            {
+                cpu_relax();
+                continue;
+            }
+
+            // nothing queued since we last looked, sleep until something is
+            m_queued.wait(seen, std::memory_order_acquire);
+        }
+
+        s_worker_owner = nullptr;
+        s_worker_index = -1;
+    }
+
+    static bool _feed_handler(const orderbook_t& book, std::any& this_ptr)
+    {
+        strategy_executor* _this = std::any_cast<strategy_executor*>(this_ptr);
+        _this->schedule(book.pair);
+        return true;
+    }
+};
+
+#endif
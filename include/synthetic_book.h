@@ -0,0 +1,286 @@
+#ifndef _SYNTHETIC_BOOK_H
+#define _SYNTHETIC_BOOK_H
+
+#include "exchange_api.h"
+#include "thread_util.h"
+
+#include <algorithm>
+#include <any>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+
+/**
+ * Implied book of a cross pair X/Y derived from two legs that share a currency Q, eg.
+ * ETH-BTC from ETH-USD and BTC-USD. Either leg may be quoted either way round (X/Q or Q/X,
+ * Y/Q or Q/Y).
+ *
+ * The synthetic bid sells X for Q on the first leg and buys Y with that Q on the second,
+ * the synthetic ask goes the other way. Each side is built by walking both legs' guarded
+ * levels in Q notional, like a merge of two sorted lists, so it holds up to `depth` levels
+ * that could actually be traded through both legs (before fees).
+ *
+ * Attach it to the feed(s) of the legs: on a leg's book event the leg's top levels are
+ * compared with the ones last seen and nothing happens unless they changed. Otherwise the
+ * synthetic levels are rebuilt, only the levels that differ are applied to the synthetic
+ * `orderbook_t`, and its handlers get the same `ORDERS_UPDATED` / `BBO_UPDATED` events a
+ * market feed would fire. It satisfies `is_market_feed`, so traders attach to it as to any
+ * other feed; it has no thread of its own, events are fired on the thread of the leg
+ * event that caused them.
+ *
+ * The book's venue is `exchange_api_t::SYNTHETIC`, so consumers keyed on the venue keep
+ * it apart from a native book of the same pair. To compare the two, attach the native
+ * feed and this one side by side, eg. both to an `arbitrage_engine_t` where they fill
+ * separate venue slots of the pair, or to a `price_matrix_t` under different venue
+ * indices. Opportunities on the synthetic venue have to be executed through the legs.
+ */
+class synthetic_cross_feed
+{
+public:
+    synthetic_cross_feed(const instrument_pair_t& cross,
+                         const instrument_pair_t& first_leg, const instrument_pair_t& second_leg,
+                         size_t depth = orderbook_t::GUARDED_SUBSET_SIZE)
+        : m_book{cross, exchange_api_t::SYNTHETIC}, m_depth{depth}, m_mutex{}, m_legs{},
+          m_bids{}, m_asks{}, m_updates{}, m_handlers{}, m_raw_handlers{}
+    {
+        if (depth == 0)
+            throw std::invalid_argument("synthetic book needs at least one level");
+
+        // the first leg holds the cross' base, the second its quote
+        m_legs[0] = make_leg(first_leg, cross.first);
+        m_legs[1] = make_leg(second_leg, cross.second);
+        if (!(m_legs[0].common == m_legs[1].common))
+            throw std::invalid_argument("synthetic book legs don't share a currency");
+
+        m_bids.reserve(depth);
+        m_asks.reserve(depth);
+        m_updates.reserve(depth * 4);
+    }
+
+    synthetic_cross_feed(const synthetic_cross_feed&) = delete;
+    synthetic_cross_feed& operator=(const synthetic_cross_feed&) = delete;
+
+    const orderbook_t& book() const
+    { return m_book; }
+
+    /**
+     * Follow the legs' books on `mf`, must be called before `mf.start_feed()`.
+     */
+    template <typename MarketFeed>
+    void attach_to_feed(MarketFeed& mf) requires is_market_feed<MarketFeed>
+    {
+        const auto mask = static_cast<feed_event_t::event_type>(feed_event_t::ORDERS_UPDATED | feed_event_t::BBO_UPDATED);
+        for (const leg_t& leg : m_legs)
+            mf.register_raw_event_handler(feed_event_t(leg.pair, mask), &synthetic_cross_feed::_feed_handler,
+                                          std::make_any<synthetic_cross_feed*>(this));
+    }
+
+    /**
+     * Take in a new state of one of the legs, returns true if the synthetic book changed.
+     */
+    bool on_leg(const orderbook_t& book)
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+
+        leg_t* leg = nullptr;
+        for (leg_t& l : m_legs)
+            if (l.pair == book.pair)
+                leg = &l;
+        if (!leg)
+            return false;
+
+        book.copy_guarded_bids(leg->scratch);
+        const bool bids_changed = take(leg->bids, leg->scratch);
+        book.copy_guarded_asks(leg->scratch);
+        const bool asks_changed = take(leg->asks, leg->scratch);
+        if (!bids_changed && !asks_changed)
+            return false;
+
+        // sell X for Q then Q for Y, and buy X with Q bought with Y
+        m_updates.clear();
+        build(m_legs[0], true, m_legs[1], false, m_bids, true);
+        build(m_legs[0], false, m_legs[1], true, m_asks, false);
+        if (m_updates.empty())
+            return false;
+
+        m_book.process_level_updates(m_updates.data(), m_updates.size());
+        const bool top_changed = m_book.sync_top_of_book(0, book.top_of_book().recv_ns);
+
+        const int mask = feed_event_t::ORDERS_UPDATED | (top_changed ? feed_event_t::BBO_UPDATED : 0);
+        notify_event_handlers(static_cast<feed_event_t::event_type>(mask));
+        return true;
+    }
+
+    // the legs' feeds drive the book, there is nothing to run
+    void start_feed()
+    { }
+
+    void join()
+    { }
+
+    void close()
+    { }
+
+    void register_event_handler(const feed_event_t& ev, feed_event_handler_t handler)
+    {
+        m_handlers.emplace_back(ev, handler);
+    }
+
+    void register_raw_event_handler(const feed_event_t& ev, feed_event_handler_ptr handler, std::any state)
+    {
+        m_raw_handlers.emplace_back(ev, handler, std::move(state));
+    }
+
+private:
+    typedef orderbook_t::order_t level_t;
+
+    struct leg_t
+    {
+        instrument_pair_t    pair {instrument(""), instrument("")};
+        instrument           common {""}; // Q
+        bool                 inverted {false}; // quoted as Q/X rather than X/Q
+        std::vector<level_t> bids {};     // as last seen on the leg's book
+        std::vector<level_t> asks {};
+        std::vector<level_t> scratch {};
+    };
+
+    orderbook_t          m_book;
+    size_t               m_depth;
+    std::mutex           m_mutex;
+    leg_t                m_legs[2];
+    std::vector<level_t> m_bids;    // synthetic levels applied to `m_book`
+    std::vector<level_t> m_asks;
+    std::vector<orderbook_t::level_update_t> m_updates;
+
+    std::vector<std::tuple<feed_event_t, feed_event_handler_t>>             m_handlers;
+    std::vector<std::tuple<feed_event_t, feed_event_handler_ptr, std::any>> m_raw_handlers;
+
+    static leg_t make_leg(const instrument_pair_t& pair, const instrument& currency)
+    {
+        leg_t leg;
+        leg.pair = pair;
+        if (pair.first == currency)
+            leg.common = pair.second;
+        else if (pair.second == currency)
+        {
+            leg.common   = pair.first;
+            leg.inverted = true;
+        }
+        else
+            throw std::invalid_argument("synthetic book leg doesn't trade the cross' currency");
+
+        leg.bids.reserve(orderbook_t::GUARDED_SUBSET_SIZE);
+        leg.asks.reserve(orderbook_t::GUARDED_SUBSET_SIZE);
+        leg.scratch.reserve(orderbook_t::GUARDED_SUBSET_SIZE);
+        return leg;
+    }
+
+    static bool take(std::vector<level_t>& dst, const std::vector<level_t>& levels)
+    {
+        if (dst == levels)
+            return false;
+        dst = levels;
+        return true;
+    }
+
+    /**
+     * Level `i` of the leg's currency sold for Q (`sell`) or bought with Q, as the price in
+     * Q and the Q notional it takes.
+     */
+    static std::pair<double, double> level(const leg_t& leg, bool sell, size_t i)
+    {
+        // selling X on X/Q hits the bids, on Q/X it buys Q from the asks
+        const std::vector<level_t>& levels = sell != leg.inverted ? leg.bids : leg.asks;
+        if (i >= levels.size() || levels[i].first <= 0)
+            return {0, 0};
+        const auto [price, quantity] = levels[i];
+        return leg.inverted ? std::pair<double, double>{1 / price, quantity} : std::pair<double, double>{price, price * quantity};
+    }
+
+    /**
+     * Rebuild one synthetic side into `side` from `base` (X, sold when `sell_base`) and
+     * `quote` (Y), queueing the changes against the previous levels in `m_updates`.
+     */
+    void build(const leg_t& base, bool sell_base, const leg_t& quote, bool sell_quote,
+               std::vector<level_t>& side, bool is_bid)
+    {
+        // levels are small, keep the previous ones on the stack to diff against
+        level_t previous[orderbook_t::GUARDED_SUBSET_SIZE * 2];
+        const size_t previous_count = std::min(side.size(), std::size(previous));
+        std::copy(side.begin(), side.begin() + previous_count, previous);
+        side.clear();
+
+        size_t i = 0, j = 0;
+        auto [x_price, x_left] = level(base, sell_base, 0);
+        auto [y_price, y_left] = level(quote, sell_quote, 0);
+        while (side.size() < m_depth && x_left > 0 && y_left > 0)
+        {
+            const double notional = x_left < y_left ? x_left : y_left;
+            const double price    = x_price / y_price;
+            const double quantity = notional / x_price;
+            if (!side.empty() && side.back().first == price)
+                side.back().second += quantity;
+            else
+                side.emplace_back(price, quantity);
+
+            x_left -= notional;
+            y_left -= notional;
+            if (x_left <= 0)
+                std::tie(x_price, x_left) = level(base, sell_base, ++i);
+            if (y_left <= 0)
+                std::tie(y_price, y_left) = level(quote, sell_quote, ++j);
+        }
+
+        // removed levels first, then new and resized ones
+        for (size_t k = 0; k < previous_count; ++k)
+        {
+            const double price = previous[k].first;
+            bool kept = false;
+            for (const level_t& l : side)
+                kept |= l.first == price;
+            if (!kept)
+                m_updates.push_back(orderbook_t::level_update_t{price, 0, is_bid});
+        }
+        for (const level_t& l : side)
+        {
+            bool same = false;
+            for (size_t k = 0; k < previous_count; ++k)
+                same |= previous[k] == l;
+            if (!same)
+                m_updates.push_back(orderbook_t::level_update_t{l.first, l.second, is_bid});
+        }
+    }
+
+    void notify_event_handlers(feed_event_t::event_type mask)
+    {
+        const instrument_pair_t& source_pair{m_book.pair};
+        for (auto& [ev, handler_ptr, state] : m_raw_handlers)
+        {
+            if (!(mask & ev.update_mask) || source_pair != ev.product_pair)
+                continue;
+
+            if (!handler_ptr(m_book, state))
+                return;
+        }
+
+        for (auto& [ev, callable] : m_handlers)
+        {
+            if (!(mask & ev.update_mask) || source_pair != ev.product_pair)
+                continue;
+
+            if (!callable(m_book))
+                return;
+        }
+    }
+
+    static bool _feed_handler(const orderbook_t& book, std::any& this_ptr)
+    {
+        std::any_cast<synthetic_cross_feed*>(this_ptr)->on_leg(book);
+        return true;
+    }
+};
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef _THREAD_QUEUE_H
 #define _THREAD_QUEUE_H
 
+#include "thread_util.h"
+
 #include <thread>
 #include <queue>
 #include <mutex>
@@ -18,13 +20,16 @@ class thread_queue
         std::queue<ItemT> m_queue;
         std::mutex m_mutex;
         std::stop_source m_stop_source;
+        thread_placement_t m_placement;
 
         void _run(const std::stop_token& stoken)
         {
+            apply_thread_placement(m_placement);
+
             while (!stoken.stop_requested())
             {
                 ItemT item;
-                if (!m_queue.pop_from_queue(item))
+                if (!pop_from_queue(item))
                     continue;
 
                 m_callable(std::move(item));
@@ -67,9 +72,10 @@ class thread_queue
         }
 
 
-        void run()
+        void run(const thread_placement_t& placement = {})
         {
-            m_thread_ptr = std::make_unique<>(&thread_queue<ItemT>::_run, this, m_stop_source.get_token());
+            m_placement = placement;
+            m_thread_ptr = std::make_unique<std::jthread>(&thread_queue<ItemT>::_run, this, m_stop_source.get_token());
         }
 
         void join()
@@ -0,0 +1,173 @@
+#ifndef _THREAD_UTIL_H
+#define _THREAD_UTIL_H
+
+#include "logger.h"
+
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Pin the calling thread to `cpu`. A negative cpu leaves the affinity untouched.
+ * Returns false if the affinity could not be set (eg. cpu out of range).
+ */
+inline bool pin_current_thread(int cpu)
+{
+    if (cpu < 0)
+        return true;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err)
+    {
+        log("ERROR failed to pin thread to cpu {:d}: error {:d}", cpu, err);
+        return false;
+    }
+    return true;
+#else
+    // thread affinity is only a hint on OSX, ignore it
+    return false;
+#endif
+}
+
+/**
+ * Where and how an internal thread should run.
+ *
+ * Threads of a role that has several instances (eg. book workers) get `cpus[i % cpus.size()]`
+ * and the name suffixed with their index (also when there is just one).
+ */
+struct thread_placement_t
+{
+    std::vector<int> cpus;                // cores to pin to, empty leaves affinity untouched
+    int              policy   {SCHED_OTHER};
+    int              priority {0};        // only used with SCHED_FIFO/SCHED_RR
+    int              nice     {0};        // only used with SCHED_OTHER, 0 leaves it untouched
+    std::string      name;                // shows up in top/perf, truncated to 15 characters
+
+    int cpu(size_t index) const
+    { return cpus.empty() ? -1 : cpus[index % cpus.size()]; }
+};
+
+enum class thread_role : int {
+    FEED,
+    PARSE,
+    BOOK,
+    STRATEGY,
+    ORDER_GATEWAY,
+    REACTOR,
+    COUNT
+};
+
+/**
+ * Placement for every kind of internal thread, hand the relevant entry to each component.
+ */
+struct thread_config_t
+{
+    std::array<thread_placement_t, static_cast<size_t>(thread_role::COUNT)> roles;
+
+    thread_config_t()
+        : roles{}
+    {
+        (*this)[thread_role::FEED].name          = "feed";
+        (*this)[thread_role::PARSE].name         = "parse";
+        (*this)[thread_role::BOOK].name          = "book";
+        (*this)[thread_role::STRATEGY].name      = "strategy";
+        (*this)[thread_role::ORDER_GATEWAY].name = "order-gw";
+        (*this)[thread_role::REACTOR].name       = "reactor";
+    }
+
+    thread_placement_t& operator[](thread_role role)
+    { return roles[static_cast<size_t>(role)]; }
+
+    const thread_placement_t& operator[](thread_role role) const
+    { return roles[static_cast<size_t>(role)]; }
+};
+
+/**
+ * Apply `placement` to the calling thread, `index` picks the core/name for roles with
+ * several threads. Failures (eg. SCHED_FIFO without CAP_SYS_NICE) are logged and the
+ * thread keeps running with whatever could be applied.
+ */
+inline bool apply_thread_placement(const thread_placement_t& placement, size_t index = 0)
+{
+    bool ok = pin_current_thread(placement.cpu(index));
+
+#ifdef __linux__
+    if (!placement.name.empty())
+    {
+        // every thread of the role gets the suffix, truncated names keep it
+        const std::string suffix {"-" + std::to_string(index)};
+        std::string name {placement.name.substr(0, 15 - std::min<size_t>(suffix.length(), 15)) + suffix};
+        name.resize(std::min<size_t>(name.length(), 15));
+        pthread_setname_np(pthread_self(), name.c_str());
+    }
+
+    if (placement.policy == SCHED_FIFO || placement.policy == SCHED_RR)
+    {
+        sched_param param {};
+        param.sched_priority = placement.priority;
+        const int err = pthread_setschedparam(pthread_self(), placement.policy, &param);
+        if (err)
+        {
+            log("ERROR failed to set scheduling policy {:d} (priority {:d}) for thread {}: error {:d}",
+                    placement.policy, placement.priority, placement.name, err);
+            ok = false;
+        }
+    }
+    else if (placement.nice != 0)
+    {
+        // on linux niceness is per thread when given the thread id
+        const pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+        if (setpriority(PRIO_PROCESS, tid, placement.nice))
+        {
+            log("ERROR failed to set niceness {:d} for thread {}", placement.nice, placement.name);
+            ok = false;
+        }
+    }
+#endif
+
+    return ok;
+}
+
+/**
+ * Hint to the cpu that we are in a spin-wait loop.
+ */
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+inline int64_t steady_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline int64_t wall_clock_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef _TRADE_TAPE_H
+#define _TRADE_TAPE_H
+
+#include "seqlock.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+
+/**
+ * Single executed trade.
+ */
+struct trade_t
+{
+    double  price;
+    double  quantity;
+    bool    is_buy;   // the taker bought, ie. lifted the offer
+    int64_t trade_id;
+    int64_t time_ms;  // exchange trade time
+    int64_t recv_ns;
+};
+
+/**
+ * Aggregates over the trades of the last `window_ms` milliseconds of exchange time.
+ */
+struct trade_window_t
+{
+    int64_t  window_ms   {0};
+    uint64_t trades      {0};
+    double   buy_volume  {0};
+    double   sell_volume {0};
+    double   notional    {0};     // sum of price * quantity
+    bool     truncated   {false}; // the tape wrapped before the window expired its oldest trades
+
+    double volume() const
+    { return buy_volume + sell_volume; }
+
+    double vwap() const
+    { return volume() > 0 ? notional / volume() : 0.0; }
+
+    // -1 when only sells hit the bids, 1 when only buys lifted the offers
+    double imbalance() const
+    { return volume() > 0 ? (buy_volume - sell_volume) / volume() : 0.0; }
+
+    // trades per second
+    double rate() const
+    { return window_ms > 0 ? trades * 1000.0 / window_ms : 0.0; }
+};
+
+/**
+ * What `trade_tape_t` publishes after every batch of trades.
+ */
+struct trade_flow_t
+{
+    static constexpr const size_t MAX_WINDOWS = 4;
+
+    std::array<trade_window_t, MAX_WINDOWS> windows;
+    size_t                                  window_count;
+    trade_t                                 last;
+    uint64_t                                total_trades;
+};
+
+struct trade_tape_config_t
+{
+    bool enabled    {false};
+    bool aggregated {true};   // Binance only, aggTrade rather than trade
+    std::vector<std::chrono::milliseconds> windows {std::chrono::seconds{1}, std::chrono::seconds{10}, std::chrono::seconds{60}};
+};
+
+/**
+ * Last `TAPE_SIZE` trades of a pair in a ring buffer, plus rolling aggregates over a few
+ * time windows maintained incrementally: each trade is added to every window once and
+ * subtracted once when it falls out of it (or off the tape).
+ *
+ * Windows expire their trades against the newest trade time on `add`, and on `advance`
+ * against that time plus however long ago the newest trade was received, so the aggregates
+ * also decay while the pair isn't trading. Only exchange timestamps and the local steady
+ * clock are compared, the local wall clock's skew to the exchange doesn't matter.
+ *
+ * There is one writer, the thread applying the pair's book updates. The ring is only
+ * meant to be read from that thread (ie. from event handlers), `flow()` can be read from
+ * anywhere.
+ */
+class trade_tape_t
+{
+public:
+    static constexpr const size_t TAPE_SIZE = 1 << 12;
+
+    trade_tape_t()
+        : m_ring{}, m_head{0}, m_tails{}, m_flow{}, m_published{}
+    {
+        m_flow.window_count = 0;
+        m_flow.total_trades = 0;
+        m_flow.last         = trade_t{};
+    }
+
+    trade_tape_t(const trade_tape_t&) = delete;
+    trade_tape_t& operator=(const trade_tape_t&) = delete;
+
+    /**
+     * Set the aggregation windows and drop every trade. Not thread-safe.
+     */
+    void configure(const std::vector<std::chrono::milliseconds>& windows)
+    {
+        if (windows.size() > trade_flow_t::MAX_WINDOWS)
+            throw std::invalid_argument("too many trade windows");
+
+        m_head = 0;
+        m_flow = trade_flow_t{};
+        m_flow.window_count = windows.size();
+        for (size_t i = 0; i < windows.size(); ++i)
+        {
+            if (windows[i].count() <= 0)
+                throw std::invalid_argument("trade window must be positive");
+            m_flow.windows[i].window_ms = windows[i].count();
+            m_tails[i] = 0;
+        }
+        m_published.store(m_flow);
+    }
+
+    /**
+     * Append `n` trades, in exchange order, and publish the new aggregates.
+     */
+    void add(const trade_t* trades, size_t n)
+    {
+        if (m_ring.empty())
+            m_ring.resize(TAPE_SIZE);
+
+        for (size_t i = 0; i < n; ++i)
+            add(trades[i]);
+
+        m_published.store(m_flow);
+    }
+
+    /**
+     * Expire the trades that fell out of their windows by `now_ns` (`steady_now_ns()`, on
+     * the clock of the trades' `recv_ns`), publishing only if some did. Returns true if the
+     * aggregates changed.
+     */
+    bool advance(int64_t now_ns)
+    {
+        if (m_head == 0)
+            return false;
+
+        // exchange time now, as far as the newest trade tells
+        const trade_t& last = m_flow.last;
+        const int64_t now_ms = last.time_ms + std::max<int64_t>(now_ns - last.recv_ns, 0) / 1000000;
+
+        bool expired = false;
+        for (size_t w = 0; w < m_flow.window_count; ++w)
+            expired |= expire(w, now_ms);
+
+        if (expired)
+            m_published.store(m_flow);
+        return expired;
+    }
+
+    trade_flow_t flow() const
+    { return m_published.load(); }
+
+    /**
+     * Number of trades on the tape, writer thread only.
+     */
+    size_t size() const
+    { return m_head < TAPE_SIZE ? m_head : TAPE_SIZE; }
+
+    /**
+     * `i`-th most recent trade, 0 being the last one. Writer thread only.
+     */
+    const trade_t& recent(size_t i) const
+    { return m_ring[(m_head - 1 - i) & (TAPE_SIZE - 1)]; }
+
+private:
+    std::vector<trade_t> m_ring;
+    uint64_t             m_head;  // absolute index of the next trade
+    std::array<uint64_t, trade_flow_t::MAX_WINDOWS> m_tails; // absolute index of each window's oldest trade
+    trade_flow_t         m_flow;  // writer's copy of `m_published`
+    seqlock<trade_flow_t> m_published;
+
+    void add(const trade_t& trade)
+    {
+        if (m_head >= TAPE_SIZE)
+        {
+            // the oldest trade is about to be overwritten, take it out of windows still holding it
+            const uint64_t oldest = m_head - TAPE_SIZE;
+            for (size_t w = 0; w < m_flow.window_count; ++w)
+            {
+                if (m_tails[w] != oldest)
+                    continue;
+                remove(m_flow.windows[w], m_ring[oldest & (TAPE_SIZE - 1)]);
+                m_flow.windows[w].truncated = true;
+                ++m_tails[w];
+            }
+        }
+
+        m_ring[m_head & (TAPE_SIZE - 1)] = trade;
+        ++m_head;
+
+        for (size_t w = 0; w < m_flow.window_count; ++w)
+        {
+            trade_window_t& window = m_flow.windows[w];
+            window.trades += 1;
+            (trade.is_buy ? window.buy_volume : window.sell_volume) += trade.quantity;
+            window.notional += trade.price * trade.quantity;
+            expire(w, trade.time_ms);
+        }
+
+        m_flow.last = trade;
+        m_flow.total_trades += 1;
+    }
+
+    /**
+     * Take the trades at least `window_ms` older than `now_ms` out of window `w`.
+     */
+    bool expire(size_t w, int64_t now_ms)
+    {
+        trade_window_t& window = m_flow.windows[w];
+        uint64_t& tail = m_tails[w];
+        const uint64_t start = tail;
+        while (tail < m_head && now_ms - m_ring[tail & (TAPE_SIZE - 1)].time_ms >= window.window_ms)
+        {
+            remove(window, m_ring[tail & (TAPE_SIZE - 1)]);
+            ++tail;
+            // trades lost to the wrap would have expired by now as well
+            window.truncated = false;
+        }
+        return tail != start;
+    }
+
+    static void remove(trade_window_t& window, const trade_t& trade)
+    {
+        if (--window.trades == 0)
+        {
+            // start over from exact zeros so rounding errors don't accumulate
+            window.buy_volume  = 0;
+            window.sell_volume = 0;
+            window.notional    = 0;
+            return;
+        }
+        (trade.is_buy ? window.buy_volume : window.sell_volume) -= trade.quantity;
+        window.notional -= trade.price * trade.quantity;
+    }
+};
+
+#endif
@@ -1,25 +1,175 @@
 #ifndef _TRADER_H
 #define _TRADER_H
 
+#include "arbitrage_engine.h"
 #include "exchange_api.h"
+#include "market_maker.h"
 #include "thread_queue.h"
+#include "thread_util.h"
 #include "logger.h"
 
+#include <condition_variable>
+#include <deque>
 #include <mutex>
+#include <thread>
 
+/**
+ * Cross exchange arbitrage on top of `arbitrage_engine_t`. Attach it to each feed's
+ * `BBO_UPDATED` events, opportunities are passed to the handler on the feed thread
+ * that found them.
+ */
 template <typename MarketFeed>
     requires is_market_feed<MarketFeed>
 class ArbritrageTrader 
 {
+public:
+    ArbritrageTrader<>(instrument_pair_t product_pair, const arbitrage_config_t& config = {})
+        : m_mutex{}, m_engine{config}
+    {
+        m_engine.add_pair(product_pair);
+    }
+
+    void set_opportunity_handler(arbitrage_engine_t::handler_t handler)
+    { m_engine.set_handler(std::move(handler)); }
+
+    arbitrage_engine_t& engine()
+    { return m_engine; }
 
+    bool feed_event_handler(const orderbook_t& book)
+    {
+        // books of different exchanges come from different feed threads
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_engine.on_book(book);
+        return true;
+    }
+
+private:
+    std::mutex         m_mutex;
+    arbitrage_engine_t m_engine;
+};
 
+/**
+ * Market making on one venue with `market_maker_t`. Attach it to the venue's feed on
+ * `BBO_UPDATED`: requotes are decided on the feed thread and handed to a gateway thread
+ * that runs the blocking wallet calls one at a time and feeds the results back to the
+ * engine, so the feed never waits on the exchange.
+ */
+template <typename MarketFeed>
+    requires is_market_feed<MarketFeed>
+class MarketMakerTrader
+{
 public:
-    ArbritrageTrader<>(instrument_pair_t product_pair)
-    {}
+    stage_stats_t ack_stats; // book receive time to the gateway's answer
+
+    MarketMakerTrader<>(exchange_api_t exchange, instrument_pair_t product_pair,
+                        order_gateway_t place, cancel_gateway_t cancel,
+                        const market_maker_config_t& config = {})
+        : ack_stats{}, m_mutex{}, m_cv{}, m_engine{exchange, product_pair, config},
+          m_place{std::move(place)}, m_cancel{std::move(cancel)}, m_actions{}, m_gateway{},
+          m_placement{thread_config_t{}[thread_role::ORDER_GATEWAY]}
+    {
+        // called with `m_mutex` held
+        m_engine.set_handler([this](const quote_action_t& action) {
+                m_actions.push_back(action);
+                m_cv.notify_one();
+            });
+    }
+
+    ~MarketMakerTrader()
+    { stop(); }
+
+    /**
+     * Only safe to use before `start` or after `stop`.
+     */
+    market_maker_t& engine()
+    { return m_engine; }
+
+    void set_thread_placement(const thread_placement_t& gateway)
+    { m_placement = gateway; }
+
+    void start()
+    {
+        m_gateway = std::jthread([this](std::stop_token stop) { run(stop); });
+    }
+
+    /**
+     * Pull the quotes, wait for the gateway to get through the cancels and stop it.
+     */
+    void stop()
+    {
+        if (!m_gateway.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_engine.halt();
+            m_gateway.request_stop();
+        }
+        m_cv.notify_one();
+        m_gateway.join();
+    }
 
     bool feed_event_handler(const orderbook_t& book)
     {
+        if (book.exchange != m_engine.exchange || !instrument_pair::same(book.pair, m_engine.pair))
+            return true;
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_engine.on_book(book);
+        return true;
+    }
+
+    /**
+     * Report a fill of one of the quotes, eg. from the user data stream.
+     */
+    void on_fill(SIDE side, double quantity, const std::string& order_id = {})
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_engine.on_fill(side, quantity, order_id);
+    }
+
+private:
+    std::mutex                 m_mutex;
+    std::condition_variable    m_cv;
+    market_maker_t             m_engine;
+    order_gateway_t            m_place;
+    cancel_gateway_t           m_cancel;
+    std::deque<quote_action_t> m_actions;
+    std::jthread               m_gateway;
+    thread_placement_t         m_placement;
+
+    void run(std::stop_token stop)
+    {
+        apply_thread_placement(m_placement);
 
+        std::unique_lock<std::mutex> lock{m_mutex};
+        while (true)
+        {
+            // keep going after a stop until the cancels issued by `stop` are through
+            m_cv.wait(lock, [&]() { return !m_actions.empty() || stop.stop_requested(); });
+            if (m_actions.empty())
+                return;
+
+            quote_action_t action = std::move(m_actions.front());
+            m_actions.pop_front();
+            lock.unlock();
+
+            std::optional<order_status> placed;
+            bool cancelled = false;
+            try {
+                if (action.type == quote_action_t::PLACE)
+                    placed = m_place(action.order);
+                else
+                    cancelled = m_cancel(action.order_id);
+            } catch (const std::exception& e) {
+                log("ERROR market maker gateway for {} threw: {}", exchange_api::to_string(action.order.exchange), e.what());
+            }
+
+            lock.lock();
+            ack_stats.record(steady_now_ns() - action.trigger_ns);
+            if (action.type == quote_action_t::PLACE)
+                m_engine.on_placed(action.order.side, placed);
+            else
+                m_engine.on_cancelled(action.order.side, cancelled);
+        }
     }
 };
 
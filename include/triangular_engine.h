@@ -0,0 +1,293 @@
+#ifndef _TRIANGULAR_ENGINE_H
+#define _TRIANGULAR_ENGINE_H
+
+#include "exchange_api.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * One conversion of a triangular cycle: `amount_in` of the input currency becomes
+ * `amount_out` of the output currency, at prices no worse than `limit_price`.
+ */
+struct triangle_leg_t
+{
+    uint32_t pair_id;
+    bool     sell_base;   // sell the pair's base at its bids, otherwise buy it at the asks
+    double   limit_price;
+    double   amount_in;
+    double   amount_out;  // after fees
+};
+
+/**
+ * Profitable cycle of three conversions on one exchange, eg. USD -> ETH -> BTC -> USD.
+ */
+struct triangular_opportunity_t
+{
+    exchange_api_t                exchange;
+    uint32_t                      cycle_id;
+    instrument                    start;           // currency the cycle starts and ends in
+    double                        start_amount;
+    double                        expected_return; // at the best prices after fees, eg. 0.001 for 0.1%
+    std::array<triangle_leg_t, 3> legs;
+    int64_t                       recv_ns;         // receive time of the quote that triggered it
+};
+
+struct triangular_config_t
+{
+    double taker_fee  {0}; // charged on every leg
+    double min_return {0}; // after fees
+    bool   use_depth  {true}; // size over the guarded levels rather than the best quotes only
+};
+
+/**
+ * Triangular arbitrage over every registered pair of one exchange.
+ *
+ * Currencies are nodes and each pair gives two directed edges (selling its base at the
+ * bid, buying it at the ask) weighted by the log of the conversion rate net of fees. The
+ * 3-cycles are enumerated once as pairs are added and indexed by pair, so a book update
+ * rewrites its two edge weights and re-sums only the cycles running through them.
+ *
+ * Sizes come from the books' depth: each leg may go down its levels until its rate has
+ * given up a third of the cycle's margin, which keeps the cycle profitable whatever the
+ * other legs fill at. The cycle is then scaled to the leg with the least room.
+ *
+ * There is one writer, callers feeding it from several threads must serialize `on_book`.
+ */
+class triangular_engine_t
+{
+public:
+    typedef std::function<void(const triangular_opportunity_t&)> handler_t;
+
+    triangular_engine_t(exchange_api_t exchange, const triangular_config_t& config = {})
+        : exchange{exchange}, m_config{config}, m_handler{},
+          m_nodes{}, m_currencies{}, m_links{}, m_pair_ids{}, m_pairs{},
+          m_log_rates{}, m_cycles{}, m_pair_cycles{}, m_levels{}
+    {
+        m_levels.reserve(orderbook_t::GUARDED_SUBSET_SIZE);
+    }
+
+    const exchange_api_t exchange;
+
+    void set_handler(handler_t handler)
+    { m_handler = std::move(handler); }
+
+    /**
+     * Register `pair` and the cycles it closes, returns its id. Not thread-safe.
+     */
+    uint32_t add_pair(const instrument_pair_t& pair)
+    {
+        auto [it, inserted] = m_pair_ids.try_emplace(instrument_pair::hash(pair), static_cast<uint32_t>(m_pairs.size()));
+        if (!inserted)
+            return it->second;
+
+        const uint32_t pair_id = it->second;
+        const uint32_t base  = node(pair.first);
+        const uint32_t quote = node(pair.second);
+        m_pairs.push_back(pair_t{pair, base, quote, {}, nullptr});
+        m_log_rates.resize(m_pairs.size() * 2, -std::numeric_limits<double>::infinity());
+        m_pair_cycles.resize(m_pairs.size());
+        m_links.emplace(link_key(base, quote), pair_id);
+
+        // every currency linked to both sides of the new pair closes a triangle
+        for (uint32_t third = 0; third < m_currencies.size(); ++third)
+        {
+            if (third == base || third == quote || !linked(base, third) || !linked(quote, third))
+                continue;
+            add_cycle(base, quote, third);
+            add_cycle(base, third, quote);
+        }
+        return pair_id;
+    }
+
+    size_t cycles() const
+    { return m_cycles.size(); }
+
+    /**
+     * Take in the best bid/offer of `book` and report the cycles it makes profitable,
+     * returns how many.
+     */
+    size_t on_book(const orderbook_t& book)
+    {
+        if (book.exchange != exchange)
+            return 0;
+        auto it = m_pair_ids.find(instrument_pair::hash(book.pair));
+        if (it == m_pair_ids.end())
+            return 0;
+        return on_quote(it->second, book.top_of_book(), &book);
+    }
+
+    /**
+     * `book`, when given, provides the depth for `use_depth` until the pair's next quote.
+     */
+    size_t on_quote(uint32_t pair_id, const orderbook_t::top_of_book_t& top, const orderbook_t* book = nullptr)
+    {
+        if (pair_id >= m_pairs.size())
+            return 0;
+
+        pair_t& pair = m_pairs[pair_id];
+        pair.top  = top;
+        pair.book = book;
+
+        const double fee = std::log(1 - m_config.taker_fee);
+        const double none = -std::numeric_limits<double>::infinity();
+        m_log_rates[pair_id * 2]     = top.bid_quantity > 0 && top.bid_price > 0 ? std::log(top.bid_price) + fee : none;
+        m_log_rates[pair_id * 2 + 1] = top.ask_quantity > 0 && top.ask_price > 0 ? fee - std::log(top.ask_price) : none;
+
+        const double threshold = std::log(1 + m_config.min_return);
+        size_t found = 0;
+        for (const uint32_t cycle_id : m_pair_cycles[pair_id])
+        {
+            const cycle_t& cycle = m_cycles[cycle_id];
+            const double sum = m_log_rates[cycle.edges[0]] + m_log_rates[cycle.edges[1]] + m_log_rates[cycle.edges[2]];
+            if (sum > threshold && sum > 0)
+                found += report(cycle_id, sum, sum - threshold, top.recv_ns);
+        }
+        return found;
+    }
+
+private:
+    struct pair_t
+    {
+        instrument_pair_t          pair;
+        uint32_t                   base;  // node ids
+        uint32_t                   quote;
+        orderbook_t::top_of_book_t top;
+        const orderbook_t*         book;
+    };
+
+    struct cycle_t
+    {
+        uint32_t edges[3]; // pair_id * 2 sells the base, pair_id * 2 + 1 buys it
+        uint32_t start;    // node
+    };
+
+    triangular_config_t                    m_config;
+    handler_t                              m_handler;
+    std::unordered_map<uint64_t, uint32_t> m_nodes;       // instrument id -> node
+    std::vector<instrument>                m_currencies;  // node -> instrument
+    std::unordered_map<uint64_t, uint32_t> m_links;       // unordered node pair -> pair id
+    std::unordered_map<uint64_t, uint32_t> m_pair_ids;
+    std::vector<pair_t>                    m_pairs;
+    std::vector<double>                    m_log_rates;   // per edge, -inf without a quote
+    std::vector<cycle_t>                   m_cycles;
+    std::vector<std::vector<uint32_t>>     m_pair_cycles; // cycles through each pair's edges
+    std::vector<orderbook_t::order_t>      m_levels;      // scratch copy of guarded levels
+
+    uint32_t node(const instrument& currency)
+    {
+        auto [it, inserted] = m_nodes.try_emplace(currency.id(), static_cast<uint32_t>(m_currencies.size()));
+        if (inserted)
+            m_currencies.push_back(currency);
+        return it->second;
+    }
+
+    static uint64_t link_key(uint32_t a, uint32_t b)
+    { return a < b ? (uint64_t{a} << 32) | b : (uint64_t{b} << 32) | a; }
+
+    bool linked(uint32_t a, uint32_t b) const
+    { return m_links.count(link_key(a, b)); }
+
+    // edge converting node `from` into node `to`
+    uint32_t edge(uint32_t from, uint32_t to) const
+    {
+        const uint32_t pair_id = m_links.at(link_key(from, to));
+        return m_pairs[pair_id].base == from ? pair_id * 2 : pair_id * 2 + 1;
+    }
+
+    void add_cycle(uint32_t a, uint32_t b, uint32_t c)
+    {
+        cycle_t cycle;
+        cycle.edges[0] = edge(a, b);
+        cycle.edges[1] = edge(b, c);
+        cycle.edges[2] = edge(c, a);
+        cycle.start    = a;
+
+        const uint32_t cycle_id = static_cast<uint32_t>(m_cycles.size());
+        m_cycles.push_back(cycle);
+        for (const uint32_t e : cycle.edges)
+            m_pair_cycles[e / 2].push_back(cycle_id);
+    }
+
+    /**
+     * Input currency the leg can take while its rate stays within `slack` (log) of its
+     * best rate, and the worst price that reaches.
+     */
+    std::pair<double, double> capacity(uint32_t edge_id, double slack)
+    {
+        const pair_t& pair = m_pairs[edge_id / 2];
+        const bool sell_base = !(edge_id & 1);
+        const double best_price = sell_base ? pair.top.bid_price : pair.top.ask_price;
+        const double top_size   = sell_base ? pair.top.bid_quantity : pair.top.ask_quantity;
+
+        double in    = sell_base ? top_size : top_size * best_price;
+        double limit = best_price;
+        if (!m_config.use_depth || !pair.book)
+            return {in, limit};
+
+        if (sell_base)
+            pair.book->copy_guarded_bids(m_levels);
+        else
+            pair.book->copy_guarded_asks(m_levels);
+
+        // bids may fall to best / e^slack, asks rise to best * e^slack
+        const double bound = sell_base ? best_price / std::exp(slack) : best_price * std::exp(slack);
+        double depth_in = 0;
+        for (const auto& [price, quantity] : m_levels)
+        {
+            if (sell_base ? price < bound : price > bound)
+                break;
+            depth_in += sell_base ? quantity : quantity * price;
+            limit = price;
+        }
+        // the levels can lag a direct top of book quote
+        if (depth_in > in)
+            in = depth_in;
+        else
+            limit = best_price;
+        return {in, limit};
+    }
+
+    size_t report(uint32_t cycle_id, double log_return, double margin, int64_t recv_ns)
+    {
+        if (!m_handler)
+            return 1;
+
+        const cycle_t& cycle = m_cycles[cycle_id];
+        triangular_opportunity_t opportunity {exchange, cycle_id, m_currencies[cycle.start], 0, std::exp(log_return) - 1, {}, recv_ns};
+
+        // start amount that keeps every leg within its capacity, following the best rates
+        double start_amount = std::numeric_limits<double>::infinity();
+        double scale = 1; // leg input per unit of start currency
+        for (size_t i = 0; i < 3; ++i)
+        {
+            const uint32_t e = cycle.edges[i];
+            const auto [in, limit] = capacity(e, margin / 3);
+            opportunity.legs[i].pair_id     = e / 2;
+            opportunity.legs[i].sell_base   = !(e & 1);
+            opportunity.legs[i].limit_price = limit;
+            start_amount = std::min(start_amount, in / scale);
+            scale *= std::exp(m_log_rates[e]);
+        }
+
+        opportunity.start_amount = start_amount;
+        double amount = start_amount;
+        for (size_t i = 0; i < 3; ++i)
+        {
+            opportunity.legs[i].amount_in  = amount;
+            amount *= std::exp(m_log_rates[cycle.edges[i]]);
+            opportunity.legs[i].amount_out = amount;
+        }
+
+        m_handler(opportunity);
+        return 1;
+    }
+};
+
+#endif
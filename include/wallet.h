@@ -10,6 +10,7 @@
 #include <ctime>
 #include <optional>
 #include <cstring>
+#include <functional>
 
 template <typename ExchangeAPI>
     requires is_exchange_api<ExchangeAPI>
@@ -81,5 +82,61 @@ struct order_status
 };
 
 
+/**
+ * Limit order to be submitted through an order gateway.
+ */
+struct order_request_t
+{
+    exchange_api_t    exchange;
+    instrument_pair_t pair;
+    SIDE              side;
+    double            limit_price;
+    double            quantity;
+};
+
+// blocking call that submits the order to the exchange, returns nullopt if it failed
+typedef std::function<std::optional<order_status>(const order_request_t&)> order_gateway_t;
+
+// blocking call that cancels an order, returns false if it failed
+typedef std::function<bool(const std::string& order_id)> cancel_gateway_t;
+
+/**
+ * Wrap the limit order functions of a wallet as an `order_gateway_t`.
+ */
+template <typename Wallet>
+    requires is_wallet<Wallet>
+order_gateway_t make_order_gateway(Wallet& w)
+{
+    return [&w](const order_request_t& order) -> std::optional<order_status> {
+        if constexpr (std::same_as<Wallet, wallet<coinbase_api>>)
+        {
+            std::string order_id;
+            const bool ok = order.side == SIDE::BUY
+                ? w.create_limit_buy_order(order.pair, order.limit_price, order.quantity, order_id)
+                : w.create_limit_sell_order(order.pair, order.limit_price, order.quantity, order_id);
+            if (!ok)
+                return std::nullopt;
+            return std::optional<order_status>(std::in_place, order_id, order.side, STATUS::OPEN);
+        }
+        else
+        {
+            return order.side == SIDE::BUY
+                ? w.create_limit_buy_order(order.pair, order.limit_price, order.quantity)
+                : w.create_limit_sell_order(order.pair, order.limit_price, order.quantity);
+        }
+    };
+}
+
+/**
+ * Wrap the cancel function of a wallet as a `cancel_gateway_t`.
+ */
+template <typename Wallet>
+    requires is_wallet<Wallet>
+cancel_gateway_t make_cancel_gateway(Wallet& w)
+{
+    return [&w](const std::string& order_id) { return w.cancel_limit_order(order_id); };
+}
+
+
 
 #endif
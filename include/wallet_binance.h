@@ -4,6 +4,7 @@
 #include "exchange_api.h"
 #include "requests.h"
 #include "json.h"
+#include "cost_model.h"
 #include "crypto.h"
 #include "wallet.h"
 
@@ -31,12 +32,12 @@ class wallet<binance_api>
         double max_qty;
         double step_qty;
 
-        Value raw_doc;
+        std::string raw_json;
 
         symbol_info_t(int quote_precision, int base_precision, double min_notional,
                       const std::tuple<double, double, double>& price_filter, 
                       const std::tuple<double, double, double>& qty_filter, 
-                      Value& raw_doc)
+                      std::string raw_json)
             :// precision
             quote_precision(quote_precision),
             base_precision(base_precision),
@@ -51,7 +52,7 @@ class wallet<binance_api>
             max_qty(std::get<1>(qty_filter)),
             step_qty(std::get<2>(qty_filter)),
             // raw json
-            raw_doc(std::move(raw_doc))
+            raw_json(std::move(raw_json))
         { }
     };
 
@@ -153,7 +154,7 @@ private:
             .add_url_param("timestamp", std::to_string(time_ms));
 
         CURLcode code = req.fetch_first();
-        if (!code)
+        if (code)
         {
             throw std::runtime_error(std::format("ERROR exchange info request to {} failed with {}", 
                     exchange_api::to_string(binance_api::exchange_api_id),
@@ -172,7 +173,7 @@ private:
                     res.Offset(), rapidjson::GetParseError_En(res.Code())));
         }
 
-        if (!doc.HasMember("symbols") && !doc["symbols"].IsArray() && doc["symbols"].Size() != 1)
+        if (!doc.HasMember("symbols") || !doc["symbols"].IsArray() || doc["symbols"].Size() != 1)
         {
             throw std::runtime_error(std::format("ERROR get order unkown response: {}", to_string<Document>(doc)));
         }
@@ -188,14 +189,14 @@ private:
         std::tuple<double, double, double> lot_size_filter;
         std::tuple<double, double, double> price_filter;
 
-        Value& filters = doc["filters"];
+        Value& filters = symbol["filters"];
         for (size_t i = 0; i < filters.Size(); ++i)
         {
             const Value& filter = filters[i];
             const char* ftype = filter["filterType"].GetString();
             const size_t flen = filter["filterType"].GetStringLength();
 
-            if (min_notional < 0 && !std::strncmp("MIN_NOTIONAL", ftype, flen))
+            if (min_notional < 0 && (!std::strncmp("MIN_NOTIONAL", ftype, flen) || !std::strncmp("NOTIONAL", ftype, flen)))
             {
                 min_notional = std::stod(filter["minNotional"].GetString());
             }
@@ -219,7 +220,60 @@ private:
             throw std::runtime_error(std::format("ERORR unable to all filter values: {}", to_string<Value>(filters)));
 
 
-        return symbol_info_t(quote_precision, base_precision, min_notional, price_filter, lot_size_filter, symbol);
+        return symbol_info_t(quote_precision, base_precision, min_notional, price_filter, lot_size_filter, to_string<Value>(symbol));
+    }
+
+    /**
+     * Fetch the account into `doc`, parsed in place out of `response`. Returns false on failure.
+     */
+    bool fetch_account(std::string& response, Document& doc)
+    {
+        const std::string url {std::format("{}{}", binance_api::BASE_API_URL, binance_api::GET_ACCOUNT_PATH)};
+
+        long time_ms {std::chrono::time_point_cast<std::chrono::milliseconds>(std::chrono::system_clock::now()).time_since_epoch().count()};
+
+        requests_t req;
+        request_args_t& rargs = req.add_request(url, ReqType::GET)
+            .add_header("X-MBX-APIKEY", m_api_key)
+            .add_header("Connection", "close")
+            //.add_url_param("recvWindow", std::to_string(6000))
+            .add_url_param("timestamp", std::to_string(time_ms));
+
+        std::string signature {sign_payload(rargs, "")};
+        rargs.add_url_param("signature", signature);
+
+        requests_t::statuses_t codes;
+        size_t failed = req.fetch_all(codes);
+        if (failed > 0 || codes.at(0) > 0)
+        {
+            log("ERROR get account request to {} failed with {}", 
+                    exchange_api::to_string(binance_api::exchange_api_id),
+                    req.get_error_msg(0, codes[0]));
+
+            return false;
+        }
+
+
+        response = req.get_response(0);
+        if (response.back() != '\0')
+            response.push_back('\0');
+
+
+        rapidjson::ParseResult res {doc.ParseInsitu(response.data())};
+
+        if (!res)
+        {
+            log("ERROR get order response \"{}\", parse error at offet {}: to parse: {}", response,
+                    res.Offset(), rapidjson::GetParseError_En(res.Code()));
+            return false;
+        }
+
+        if (!doc.HasMember("balances") || !doc["balances"].IsArray())
+        {
+            log("ERROR get account unkown response: {}", to_string<Document>(doc));
+            return false;
+        }
+        return true;
     }
 
 
@@ -377,52 +431,10 @@ public:
 
     std::optional<double> get_asset_account_balance(std::string currency = "USD")
     {
-        const std::string url {std::format("{}{}", binance_api::BASE_API_URL, binance_api::GET_ACCOUNT_PATH)};
-
-        long time_ms {std::chrono::time_point_cast<std::chrono::milliseconds>(std::chrono::system_clock::now()).time_since_epoch().count()};
-
-        requests_t req;
-        request_args_t& rargs = req.add_request(url, ReqType::GET)
-            .add_header("X-MBX-APIKEY", m_api_key)
-            .add_header("Connection", "close")
-            //.add_url_param("recvWindow", std::to_string(6000))
-            .add_url_param("timestamp", std::to_string(time_ms));
-
-        std::string signature {sign_payload(rargs, "")};
-        rargs.add_url_param("signature", signature);
-
-        requests_t::statuses_t codes;
-        size_t failed = req.fetch_all(codes);
-        if (failed > 0 || codes.at(0) > 0)
-        {
-            log("ERROR get account request to {} failed with {}", 
-                    exchange_api::to_string(binance_api::exchange_api_id),
-                    req.get_error_msg(0, codes[0]));
-
-            return std::nullopt;
-        }
-
-
-        std::string response {req.get_response(0)};
-        if (response.back() != '\0')
-            response.push_back('\0');
-
-
+        std::string response;
         Document doc;
-        rapidjson::ParseResult res {doc.ParseInsitu(response.data())};
-
-        if (!res)
-        {
-            log("ERROR get order response \"{}\", parse error at offet {}: to parse: {}", response,
-                    res.Offset(), rapidjson::GetParseError_En(res.Code()));
-            return std::nullopt;
-        }
-
-        if (!doc.HasMember("balances") || !doc["balances"].IsArray())
-        {
-            log("ERROR get account unkown response: {}", to_string<Document>(doc));
+        if (!fetch_account(response, doc))
             return std::nullopt;
-        }
 
         const Value& balances = doc["balances"];
         for (size_t i = 0; i < balances.Size(); ++i)
@@ -458,6 +470,50 @@ public:
         return false;
     }
 
+    /**
+     * Fee rate, filters and free balances of `pair` for a `cost_model_t`, refetched on every
+     * call. Returns nullopt if the account request fails, throws like `load_symbol_info`.
+     */
+    std::optional<venue_costs_t> load_costs(instrument_pair_t pair)
+    {
+        const symbol_info_t info {load_symbol_info(pair)};
+
+        std::string response;
+        Document doc;
+        if (!fetch_account(response, doc))
+            return std::nullopt;
+
+        venue_costs_t costs;
+        costs.price_step   = info.step_price;
+        costs.qty_step     = info.step_qty;
+        costs.min_qty      = info.min_qty;
+        costs.min_notional = info.min_notional;
+
+        if (doc.HasMember("commissionRates") && doc["commissionRates"].HasMember("taker"))
+            costs.taker_fee = std::stod(doc["commissionRates"]["taker"].GetString());
+        else if (doc.HasMember("takerCommission"))
+            costs.taker_fee = doc["takerCommission"].GetDouble() / 10000; // in hundredths of a percent
+
+        const std::string base  {pair.first.name()};
+        const std::string quote {pair.second.name()};
+        costs.base_balance  = 0;
+        costs.quote_balance = 0;
+        const Value& balances = doc["balances"];
+        for (size_t i = 0; i < balances.Size(); ++i)
+        {
+            const Value& balance = balances[i];
+            if (!balance.HasMember("asset") || !balance.HasMember("free"))
+                continue;
+
+            const char* asset = balance["asset"].GetString();
+            if (base == asset)
+                costs.base_balance = std::stod(balance["free"].GetString());
+            else if (quote == asset)
+                costs.quote_balance = std::stod(balance["free"].GetString());
+        }
+        return costs;
+    }
+
 
 };
 
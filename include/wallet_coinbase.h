@@ -2,6 +2,7 @@
 #define _WALLET_COINBASE_H
 
 #include "exchange_api.h"
+#include "cost_model.h"
 #include "crypto.h"
 #include "json.h"
 #include "wallet.h"
@@ -490,6 +491,89 @@ public:
     }
 
 
+    /**
+     * Signed GET of `request_path`, returns nullopt if it fails or responds with an error.
+     */
+    std::optional<Document> get_document(const std::string& request_path)
+    {
+        long time_seconds {std::chrono::time_point_cast<std::chrono::seconds>(std::chrono::system_clock::now()).time_since_epoch().count()};
+        std::string signature {sign_payload(request_path, "", time_seconds, "GET")};
+
+        requests_t req;
+        req.add_request(std::format("{}{}", coinbase_api::BASE_API_URL, request_path), ReqType::GET)
+            .add_header("accept", "application/json")
+            .add_header("CB-ACCESS-KEY", m_api_key)
+            .add_header("CB-ACCESS-TIMESTAMP", std::to_string(time_seconds))
+            .add_header("CB-ACCESS-SIGN", signature);
+
+        std::vector<CURLcode> statues;
+        size_t failed = req.fetch_all(statues);
+        if (failed > 0)
+        {
+            log("ERROR: GET {} to {} failed with {}", request_path,
+                    exchange_api::to_string(coinbase_api::exchange_api_id),
+                    req.get_error_msg(0, statues[0]));
+
+            return std::nullopt;
+        }
+
+        Document doc;
+        std::string response {req.get_response(0)};
+        rapidjson::ParseResult res {doc.Parse(response.c_str())};
+        if (!res)
+        {
+            log("ERROR GET {} \"{}\", parse error at offet {}: to parse: {}", request_path, response,
+                    res.Offset(), rapidjson::GetParseError_En(res.Code()));
+            return std::nullopt;
+        }
+
+        if (doc.HasMember("error"))
+        {
+            log("ERROR GET {} \"{}\"", request_path, response);
+            return std::nullopt;
+        }
+
+        return std::optional<Document>(std::move(doc));
+    }
+
+    /**
+     * Fee rate, increments, minimums and available balances of `pair` for a `cost_model_t`,
+     * refetched on every call. Returns nullopt if a request fails.
+     */
+    std::optional<venue_costs_t> load_costs(instrument_pair_t pair)
+    {
+        auto product {get_document(std::format("{}/{}", coinbase_api::GET_PRODUCT_PATH, instrument_pair::to_coinbase(pair)))};
+        auto summary {get_document(coinbase_api::TRANSACTION_SUMMARY_PATH)};
+        auto accounts {list_accounts()};
+        if (!product || !summary || !accounts)
+            return std::nullopt;
+
+        auto number = [](const Value& json, const char* member) -> double {
+            return json.HasMember(member) && json[member].IsString() ? std::stod(json[member].GetString()) : 0.0;
+        };
+
+        venue_costs_t costs;
+        costs.price_step   = number(*product, "quote_increment");
+        costs.qty_step     = number(*product, "base_increment");
+        costs.min_qty      = number(*product, "base_min_size");
+        costs.min_notional = number(*product, "quote_min_size");
+        if (summary->HasMember("fee_tier"))
+            costs.taker_fee = number((*summary)["fee_tier"], "taker_fee_rate");
+
+        const std::string base  {pair.first.name()};
+        const std::string quote {pair.second.name()};
+        costs.base_balance  = 0;
+        costs.quote_balance = 0;
+        for (const account_info& ac : accounts.value())
+        {
+            if (ac.currency == base)
+                costs.base_balance = ac.balance;
+            else if (ac.currency == quote)
+                costs.quote_balance = ac.balance;
+        }
+        return costs;
+    }
+
     std::optional<double> get_fiat_account_balance(std::string currency = "USD", bool refetch = false)
     {
         thread_local std::optional<std::vector<account_info>> accounts {list_accounts()};
@@ -0,0 +1,576 @@
+#ifndef _WS_CLIENT_H
+#define _WS_CLIENT_H
+
+#include "logger.h"
+#include "ws_frame_decoder.h"
+
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Minimal RFC 6455 client over TLS for read-mostly market data connections.
+ *
+ * Frames are read straight into the reusable receive buffer of a `ws_frame_decoder`, which
+ * hands them to the message handler as a pointer into that buffer, '\0' terminated so the
+ * payload can be parsed in situ. Every frame a read brought in is dispatched before the
+ * next read is issued, and nothing is allocated per message. Protocol violations and
+ * messages above `set_max_message_size` fail the connection with close code 1002/1009.
+ *
+ * Not thread-safe: apart from `send_text`, every method has to be called on the thread
+ * running the io_context.
+ */
+class ws_client
+{
+public:
+    typedef asio::ssl::stream<asio::ip::tcp::socket>          stream_t;
+    typedef asio::ip::tcp::socket::lowest_layer_type          lowest_layer_t;
+    typedef std::vector<std::pair<std::string, std::string>>  headers_t;
+
+    // called once connected, before the TLS handshake
+    typedef std::function<void(lowest_layer_t& socket, SSL* ssl)>  socket_init_handler_t;
+    // called once the websocket upgrade completed
+    typedef std::function<void(SSL* ssl)>                         open_handler_t;
+    // `data[len]` is '\0', returning false closes the connection
+    typedef std::function<bool(char* data, size_t len)>           message_handler_t;
+    typedef std::function<void()>                                 pong_handler_t;
+    // called exactly once per connection that got past `connect`, `ssl` is still valid
+    typedef std::function<void(SSL* ssl, const asio::error_code&)> close_handler_t;
+
+    enum class state_t : int {
+        CLOSED,
+        CONNECTING,
+        OPEN,
+        CLOSING
+    };
+
+    static constexpr const size_t MAX_HANDSHAKE_SIZE  = 1 << 14;
+    static constexpr const std::chrono::milliseconds CLOSE_TIMEOUT {1000};
+
+    ws_client(asio::io_context& io_context, std::shared_ptr<asio::ssl::context> ssl_context)
+        : m_io_context{io_context}, m_ssl_context{ssl_context}, m_resolver{io_context},
+          m_close_timer{io_context}, m_conn{nullptr}, m_state{state_t::CLOSED},
+          m_rx{}, m_writing{false}, m_close_after_write{false}, m_close_ec{},
+          m_rng{std::random_device{}()}
+    {
+        m_rx.set_handlers(
+                [this](char* data, size_t len) { deliver(data, len); return m_state != state_t::CLOSED; },
+                [this](uint8_t opcode, const char* data, size_t len) { handle_control(opcode, data, len); return m_state != state_t::CLOSED; });
+    }
+
+    void set_handlers(socket_init_handler_t on_socket_init, open_handler_t on_open,
+            message_handler_t on_message, pong_handler_t on_pong, close_handler_t on_close)
+    {
+        m_socket_init_hdlr = on_socket_init;
+        m_open_hdlr        = on_open;
+        m_message_hdlr     = on_message;
+        m_pong_hdlr        = on_pong;
+        m_close_hdlr       = on_close;
+    }
+
+    /**
+     * Largest message accepted, bigger ones fail the connection with close code 1009.
+     */
+    void set_max_message_size(size_t size)
+    { m_rx.set_max_message_size(size); }
+
+    /**
+     * Start connecting to `uri` (wss://host[:port][/path]). Returns false if the connection
+     * could not be started, otherwise the outcome is reported through the open/close handlers.
+     */
+    bool connect(const std::string& uri, const headers_t& headers, asio::error_code& ec)
+    {
+        if (m_state != state_t::CLOSED)
+        {
+            ec = asio::error::already_started;
+            return false;
+        }
+
+        if (!parse_uri(uri))
+        {
+            ec = asio::error::invalid_argument;
+            return false;
+        }
+
+        m_headers = headers;
+        m_conn    = std::make_shared<connection_t>(m_io_context, *m_ssl_context);
+        m_state   = state_t::CONNECTING;
+
+        m_rx.reset();
+        m_writing = false;
+        m_close_after_write = false;
+        m_close_ec = {};
+
+        m_resolver.async_resolve(m_host, m_port,
+                [this, conn = m_conn](const asio::error_code& ec, asio::ip::tcp::resolver::results_type results) {
+                    if (stale(conn)) return;
+                    if (ec) { fail(ec, "resolve"); return; }
+
+                    asio::async_connect(conn->stream.lowest_layer(), results,
+                            [this, conn](const asio::error_code& ec, const asio::ip::tcp::endpoint&) {
+                                if (stale(conn)) return;
+                                if (ec) { fail(ec, "connect"); return; }
+                                on_connected();
+                            });
+                });
+        return true;
+    }
+
+    /**
+     * Start the closing handshake, the connection is dropped if the peer doesn't answer in time.
+     */
+    void close(uint16_t code = 1000)
+    {
+        if (m_state == state_t::CONNECTING)
+        {
+            finish(asio::error::operation_aborted);
+            return;
+        }
+        if (m_state != state_t::OPEN)
+            return;
+
+        const char payload[2] = {static_cast<char>(code >> 8), static_cast<char>(code & 0xff)};
+        m_state = state_t::CLOSING;
+        queue_frame(OPCODE_CLOSE, payload, sizeof(payload));
+
+        m_close_timer.expires_after(CLOSE_TIMEOUT);
+        m_close_timer.async_wait([this, conn = m_conn](const asio::error_code& ec) {
+                if (ec || stale(conn)) return;
+                finish(asio::error::timed_out);
+            });
+    }
+
+    /**
+     * Drop the connection without a closing handshake, eg. when the peer stopped responding.
+     */
+    void abort()
+    {
+        if (m_state != state_t::CLOSED)
+            finish(asio::error::timed_out);
+    }
+
+    void ping()
+    {
+        if (m_state == state_t::OPEN)
+            queue_frame(OPCODE_PING, nullptr, 0);
+    }
+
+    /**
+     * Queue a text frame. Thread-safe, the frame is written from the I/O thread.
+     */
+    asio::error_code send_text(std::string_view msg)
+    {
+        if (m_state != state_t::OPEN)
+            return asio::error::not_connected;
+
+        // masking uses the connection's rng, so the frame is built on the I/O thread
+        asio::post(m_io_context, [this, msg = std::string{msg}]() {
+                if (m_state != state_t::OPEN) return;
+                queue_frame(OPCODE_TEXT, msg.data(), msg.size());
+            });
+        return {};
+    }
+
+    bool is_open() const
+    { return m_state == state_t::OPEN; }
+
+    state_t state() const
+    { return m_state; }
+
+private:
+    static constexpr const uint8_t OPCODE_TEXT  = ws_frame_decoder::OPCODE_TEXT;
+    static constexpr const uint8_t OPCODE_CLOSE = ws_frame_decoder::OPCODE_CLOSE;
+    static constexpr const uint8_t OPCODE_PING  = ws_frame_decoder::OPCODE_PING;
+    static constexpr const uint8_t OPCODE_PONG  = ws_frame_decoder::OPCODE_PONG;
+
+    // owned by the pending handlers as well, so the stream and the frames being written
+    // outlive any operation still in flight
+    struct connection_t
+    {
+        connection_t(asio::io_context& io_context, asio::ssl::context& ssl_context)
+            : stream{io_context, ssl_context}, tx{}
+        {}
+
+        stream_t                stream;
+        std::deque<std::string> tx;
+    };
+
+    asio::io_context&                   m_io_context;
+    std::shared_ptr<asio::ssl::context> m_ssl_context;
+    asio::ip::tcp::resolver             m_resolver;
+    asio::steady_timer                  m_close_timer;
+    std::shared_ptr<connection_t>       m_conn;
+    std::atomic<state_t>                m_state;
+
+    std::string m_host;
+    std::string m_port;
+    std::string m_target;
+    headers_t   m_headers;
+    std::string m_key;
+
+    ws_frame_decoder m_rx;
+
+    bool             m_writing;
+    bool             m_close_after_write;
+    asio::error_code m_close_ec; // reported once the close frame queued with `m_close_after_write` is written
+
+    std::minstd_rand m_rng;
+
+    socket_init_handler_t m_socket_init_hdlr;
+    open_handler_t        m_open_hdlr;
+    message_handler_t     m_message_hdlr;
+    pong_handler_t        m_pong_hdlr;
+    close_handler_t       m_close_hdlr;
+
+    bool stale(const std::shared_ptr<connection_t>& conn) const
+    { return conn != m_conn || m_state == state_t::CLOSED; }
+
+    bool parse_uri(const std::string& uri)
+    {
+        static constexpr const std::string_view SCHEME {"wss://"};
+        if (!uri.starts_with(SCHEME))
+            return false;
+
+        const size_t host_begin = SCHEME.size();
+        size_t path_begin = uri.find('/', host_begin);
+        if (path_begin == std::string::npos)
+            path_begin = uri.size();
+
+        const std::string authority {uri.substr(host_begin, path_begin - host_begin)};
+        const size_t colon = authority.find(':');
+        m_host = authority.substr(0, colon);
+        m_port = colon == std::string::npos ? "443" : authority.substr(colon + 1);
+        m_target = path_begin == uri.size() ? "/" : uri.substr(path_begin);
+
+        return !m_host.empty();
+    }
+
+    void on_connected()
+    {
+        SSL* ssl = m_conn->stream.native_handle();
+        SSL_set_tlsext_host_name(ssl, m_host.c_str());
+        if (m_socket_init_hdlr)
+            m_socket_init_hdlr(m_conn->stream.lowest_layer(), ssl);
+
+        m_conn->stream.async_handshake(asio::ssl::stream_base::client,
+                [this, conn = m_conn](const asio::error_code& ec) {
+                    if (stale(conn)) return;
+                    if (ec) { fail(ec, "TLS handshake"); return; }
+                    send_upgrade();
+                });
+    }
+
+    void send_upgrade()
+    {
+        unsigned char nonce[16];
+        for (auto& byte : nonce)
+            byte = static_cast<unsigned char>(m_rng());
+        m_key = base64(nonce, sizeof(nonce));
+
+        std::string request;
+        request.reserve(512);
+        request.append("GET ").append(m_target).append(" HTTP/1.1\r\n")
+               .append("Host: ").append(m_host);
+        if (m_port != "443")
+            request.append(":").append(m_port);
+        request.append("\r\n")
+               .append("Upgrade: websocket\r\n")
+               .append("Connection: Upgrade\r\n")
+               .append("Sec-WebSocket-Key: ").append(m_key).append("\r\n")
+               .append("Sec-WebSocket-Version: 13\r\n");
+        for (const auto& [key, value] : m_headers)
+            request.append(key).append(": ").append(value).append("\r\n");
+        request.append("\r\n");
+
+        m_conn->tx.emplace_back(std::move(request));
+        m_writing = true;
+        asio::async_write(m_conn->stream, asio::buffer(m_conn->tx.front()),
+                [this, conn = m_conn](const asio::error_code& ec, size_t) {
+                    if (stale(conn)) return;
+                    if (ec) { fail(ec, "upgrade request"); return; }
+                    conn->tx.pop_front();
+                    m_writing = false;
+                    read_upgrade_response();
+                });
+    }
+
+    void read_upgrade_response()
+    {
+        m_conn->stream.async_read_some(asio::buffer(m_rx.write_ptr(), m_rx.write_space()),
+                [this, conn = m_conn](const asio::error_code& ec, size_t n) {
+                    if (stale(conn)) return;
+                    if (ec) { fail(ec, "upgrade response"); return; }
+                    m_rx.commit(n);
+
+                    const std::string_view received {m_rx.pending()};
+                    const size_t header_end = received.find("\r\n\r\n");
+                    if (header_end == std::string_view::npos)
+                    {
+                        if (received.size() >= MAX_HANDSHAKE_SIZE) { fail(asio::error::message_size, "upgrade response"); return; }
+                        read_upgrade_response();
+                        return;
+                    }
+
+                    if (!check_upgrade_response(received.substr(0, header_end)))
+                    {
+                        log("ERROR websocket upgrade to {} rejected: {}", m_host, received.substr(0, header_end));
+                        fail(asio::error::connection_refused, nullptr);
+                        return;
+                    }
+
+                    // anything after the headers already belongs to the first frames
+                    m_rx.consume(header_end + 4);
+                    m_state = state_t::OPEN;
+                    if (m_open_hdlr)
+                        m_open_hdlr(m_conn->stream.native_handle());
+
+                    if (!stale(conn) && dispatch_frames())
+                        read_frames();
+                });
+    }
+
+    bool check_upgrade_response(std::string_view response) const
+    {
+        if (!response.starts_with("HTTP/1.1 101"))
+            return false;
+
+        std::string lower {response};
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+
+        static constexpr const std::string_view ACCEPT_HEADER {"\r\nsec-websocket-accept:"};
+        const size_t pos = lower.find(ACCEPT_HEADER);
+        if (pos == std::string::npos)
+            return false;
+
+        // the accept value is case sensitive, take it from the original response
+        size_t value_begin = pos + ACCEPT_HEADER.size();
+        while (value_begin < response.size() && response[value_begin] == ' ')
+            ++value_begin;
+        size_t value_end = response.find("\r\n", value_begin);
+        if (value_end == std::string_view::npos)
+            value_end = response.size();
+
+        static constexpr const std::string_view GUID {"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"};
+        const std::string accept_src {m_key + std::string{GUID}};
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_len = 0;
+        EVP_Digest(accept_src.data(), accept_src.size(), digest, &digest_len, EVP_sha1(), nullptr);
+
+        return response.substr(value_begin, value_end - value_begin) == base64(digest, digest_len);
+    }
+
+    void read_frames()
+    {
+        m_rx.prepare();
+
+        m_conn->stream.async_read_some(asio::buffer(m_rx.write_ptr(), m_rx.write_space()),
+                [this, conn = m_conn](const asio::error_code& ec, size_t n) {
+                    if (stale(conn)) return;
+                    if (ec) { fail(ec, m_state == state_t::CLOSING ? nullptr : "read"); return; }
+
+                    m_rx.commit(n);
+                    if (dispatch_frames())
+                        read_frames();
+                });
+    }
+
+    /**
+     * Dispatch every complete frame in the receive buffer.
+     * Returns false if the connection failed and reading should stop.
+     */
+    bool dispatch_frames()
+    {
+        const ws_frame_decoder::status_t status = m_rx.dispatch();
+        if (status == ws_frame_decoder::status_t::PROTOCOL_ERROR)
+        {
+            fail_connection(ws_frame_decoder::close_code(status), asio::error::invalid_argument, "protocol violation");
+            return false;
+        }
+        if (status == ws_frame_decoder::status_t::MESSAGE_TOO_BIG)
+        {
+            fail_connection(ws_frame_decoder::close_code(status), asio::error::message_size, "message too big");
+            return false;
+        }
+
+        return m_state != state_t::CLOSED;
+    }
+
+    void deliver(char* data, size_t len)
+    {
+        if (m_state != state_t::OPEN)
+            return;
+
+        if (!m_message_hdlr(data, len))
+            close();
+    }
+
+    void handle_control(uint8_t opcode, const char* payload, size_t len)
+    {
+        if (opcode == OPCODE_PING)
+        {
+            if (m_state == state_t::OPEN)
+                queue_frame(OPCODE_PONG, payload, len);
+        }
+        else if (opcode == OPCODE_PONG)
+        {
+            if (m_pong_hdlr)
+                m_pong_hdlr();
+        }
+        else if (opcode == OPCODE_CLOSE)
+        {
+            if (m_state == state_t::CLOSING)
+            {
+                // answer to our own close
+                finish({});
+                return;
+            }
+
+            // echo the status code back and drop the connection once it is written
+            m_state = state_t::CLOSING;
+            m_close_after_write = true;
+            queue_frame(OPCODE_CLOSE, payload, std::min<size_t>(len, 2));
+        }
+    }
+
+    std::string build_frame(uint8_t opcode, const char* data, size_t len)
+    {
+        std::string frame;
+        frame.reserve(len + 14);
+        frame.push_back(static_cast<char>(0x80 | opcode));
+
+        // client frames are always masked
+        if (len < 126)
+        {
+            frame.push_back(static_cast<char>(0x80 | len));
+        }
+        else if (len <= 0xffff)
+        {
+            frame.push_back(static_cast<char>(0x80 | 126));
+            frame.push_back(static_cast<char>(len >> 8));
+            frame.push_back(static_cast<char>(len & 0xff));
+        }
+        else
+        {
+            frame.push_back(static_cast<char>(0x80 | 127));
+            for (int shift = 56; shift >= 0; shift -= 8)
+                frame.push_back(static_cast<char>((static_cast<uint64_t>(len) >> shift) & 0xff));
+        }
+
+        const uint32_t mask = m_rng();
+        const char key[4] = {static_cast<char>(mask >> 24), static_cast<char>(mask >> 16),
+                             static_cast<char>(mask >> 8),  static_cast<char>(mask)};
+        frame.append(key, sizeof(key));
+
+        const size_t payload_begin = frame.size();
+        frame.append(data, len);
+        for (size_t i = 0; i < len; ++i)
+            frame[payload_begin + i] ^= key[i & 3];
+
+        return frame;
+    }
+
+    void queue_frame(uint8_t opcode, const char* data, size_t len)
+    {
+        m_conn->tx.emplace_back(build_frame(opcode, data, len));
+        if (!m_writing)
+            write_next();
+    }
+
+    void write_next()
+    {
+        if (m_conn->tx.empty())
+        {
+            m_writing = false;
+            if (m_close_after_write)
+                finish(m_close_ec);
+            return;
+        }
+
+        m_writing = true;
+        asio::async_write(m_conn->stream, asio::buffer(m_conn->tx.front()),
+                [this, conn = m_conn](const asio::error_code& ec, size_t) {
+                    if (stale(conn)) return;
+                    if (ec) { fail(ec, "write"); return; }
+                    conn->tx.pop_front();
+                    write_next();
+                });
+    }
+
+    /**
+     * Fail the connection on a protocol error: send a close frame with `code` and drop the
+     * connection once it is written, without waiting for the peer's answer.
+     */
+    void fail_connection(uint16_t code, const asio::error_code& ec, const char* what)
+    {
+        log("ERROR websocket {} from {}, closing with {:d}", what, m_host, code);
+        if (m_state != state_t::OPEN)
+        {
+            finish(ec);
+            return;
+        }
+
+        const char payload[2] = {static_cast<char>(code >> 8), static_cast<char>(code & 0xff)};
+        m_state = state_t::CLOSING;
+        m_close_after_write = true;
+        m_close_ec = ec;
+        queue_frame(OPCODE_CLOSE, payload, sizeof(payload));
+
+        m_close_timer.expires_after(CLOSE_TIMEOUT);
+        m_close_timer.async_wait([this, conn = m_conn](const asio::error_code& ec) {
+                if (ec || stale(conn)) return;
+                finish(asio::error::timed_out);
+            });
+    }
+
+    void fail(const asio::error_code& ec, const char* what)
+    {
+        if (what)
+            log("ERROR websocket {} failed for {}: {}", what, m_host, ec.message());
+        finish(ec);
+    }
+
+    void finish(const asio::error_code& ec)
+    {
+        if (m_state == state_t::CLOSED)
+            return;
+
+        m_state = state_t::CLOSED;
+        m_close_timer.cancel();
+        m_resolver.cancel();
+
+        // skip the TLS shutdown, the peer is either gone or has already said goodbye
+        asio::error_code ignored;
+        m_conn->stream.lowest_layer().close(ignored);
+
+        m_writing = false;
+
+        if (m_close_hdlr)
+            m_close_hdlr(m_conn->stream.native_handle(), ec);
+    }
+
+    static std::string base64(const unsigned char* data, size_t len)
+    {
+        std::string encoded(4 * ((len + 2) / 3), '\0');
+        const int n = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(encoded.data()), data, static_cast<int>(len));
+        encoded.resize(n);
+        return encoded;
+    }
+};
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef _WS_FRAME_DECODER_H
+#define _WS_FRAME_DECODER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+
+/**
+ * Receive side of an RFC 6455 connection, kept apart from the socket so it can be fed
+ * bytes directly.
+ *
+ * Bytes are read straight into one reusable buffer (`write_ptr`/`commit`), and `dispatch`
+ * then hands every complete frame to the handlers: data messages as a pointer into the
+ * buffer, unmasked and reassembled in place, control frames as they come, also between
+ * the fragments of a message. The byte after a message is set to '\0' for the duration of
+ * the call (the buffer keeps `PADDING` spare bytes at the end so there is always room for
+ * it), so it can be parsed in situ. Nothing is allocated per message.
+ *
+ * Frames that break the protocol (reserved opcodes or bits, fragmented or oversized
+ * control frames, stray continuations) and messages above the size limit stop dispatching
+ * with the status the connection has to be failed with.
+ */
+class ws_frame_decoder
+{
+public:
+    // `data[len]` is '\0', returning false stops dispatching
+    typedef std::function<bool(char* data, size_t len)>                       message_handler_t;
+    // returning false stops dispatching
+    typedef std::function<bool(uint8_t opcode, const char* data, size_t len)> control_handler_t;
+
+    enum class status_t {
+        OK,                // everything complete was dispatched, the rest needs more bytes
+        STOPPED,           // a handler asked to stop
+        PROTOCOL_ERROR,
+        MESSAGE_TOO_BIG
+    };
+
+    static constexpr const uint8_t OPCODE_CONTINUATION = 0x0;
+    static constexpr const uint8_t OPCODE_TEXT         = 0x1;
+    static constexpr const uint8_t OPCODE_BINARY       = 0x2;
+    static constexpr const uint8_t OPCODE_CLOSE        = 0x8;
+    static constexpr const uint8_t OPCODE_PING         = 0x9;
+    static constexpr const uint8_t OPCODE_PONG         = 0xa;
+
+    static constexpr const size_t INITIAL_BUFFER_SIZE  = 1 << 20;
+    static constexpr const size_t READ_CHUNK           = 1 << 16; // minimum free space to read into
+    static constexpr const size_t PADDING              = 64;
+    static constexpr const size_t MAX_MESSAGE_SIZE     = 1 << 26;
+    static constexpr const size_t MAX_CONTROL_SIZE     = 125;
+
+    ws_frame_decoder(size_t initial_size = INITIAL_BUFFER_SIZE)
+        : m_rx(initial_size + PADDING), m_rx_begin{0}, m_rx_end{0}, m_frame_remaining{0},
+          m_fragmented{false}, m_msg_begin{0}, m_msg_len{0}, m_max_message_size{MAX_MESSAGE_SIZE},
+          m_message_hdlr{}, m_control_hdlr{}
+    { }
+
+    void set_handlers(message_handler_t on_message, control_handler_t on_control)
+    {
+        m_message_hdlr = on_message;
+        m_control_hdlr = on_control;
+    }
+
+    /**
+     * Largest message (all fragments together) accepted, anything bigger fails with
+     * `MESSAGE_TOO_BIG` before it is buffered.
+     */
+    void set_max_message_size(size_t size)
+    { m_max_message_size = size; }
+
+    size_t max_message_size() const
+    { return m_max_message_size; }
+
+    /**
+     * Drop everything buffered, for a new connection.
+     */
+    void reset()
+    {
+        m_rx_begin = m_rx_end = 0;
+        m_frame_remaining = 0;
+        m_fragmented = false;
+    }
+
+    /**
+     * Make room for the next read: at least `READ_CHUNK` bytes, or whatever the frame
+     * being received still misses.
+     */
+    void prepare()
+    { ensure_space(std::max(READ_CHUNK, m_frame_remaining)); }
+
+    char* write_ptr()
+    { return m_rx.data() + m_rx_end; }
+
+    size_t write_space() const
+    { return m_rx.size() - PADDING - m_rx_end; }
+
+    /**
+     * Account for `n` bytes read into `write_ptr()`.
+     */
+    void commit(size_t n)
+    { m_rx_end += n; }
+
+    /**
+     * Received bytes not dispatched yet, eg. the handshake response in front of the first frame.
+     */
+    std::string_view pending() const
+    { return {m_rx.data() + m_rx_begin, m_rx_end - m_rx_begin}; }
+
+    void consume(size_t n)
+    { m_rx_begin += std::min(n, m_rx_end - m_rx_begin); }
+
+    size_t capacity() const
+    { return m_rx.size() - PADDING; }
+
+    /**
+     * Dispatch every complete frame in the buffer.
+     */
+    status_t dispatch()
+    {
+        m_frame_remaining = 0;
+        status_t status = status_t::OK;
+        while (status == status_t::OK)
+        {
+            const size_t available = m_rx_end - m_rx_begin;
+            if (available < 2)
+                break;
+
+            const uint8_t* header = reinterpret_cast<const uint8_t*>(m_rx.data() + m_rx_begin);
+            const bool     fin    = header[0] & 0x80;
+            const uint8_t  opcode = header[0] & 0x0f;
+            const bool     masked = header[1] & 0x80;
+
+            // no extensions are negotiated, so the RSV bits must be clear
+            if (header[0] & 0x70)
+                return status_t::PROTOCOL_ERROR;
+
+            const bool control = opcode >= OPCODE_CLOSE;
+            if (opcode > OPCODE_PONG || (opcode > OPCODE_BINARY && !control))
+                return status_t::PROTOCOL_ERROR;
+
+            uint64_t len = header[1] & 0x7f;
+            size_t header_len = 2;
+            if (control && (!fin || len > MAX_CONTROL_SIZE))
+                return status_t::PROTOCOL_ERROR;
+
+            if (len == 126)
+            {
+                if (available < 4) break;
+                len = (static_cast<uint64_t>(header[2]) << 8) | header[3];
+                header_len = 4;
+            }
+            else if (len == 127)
+            {
+                if (available < 10) break;
+                len = 0;
+                for (size_t i = 0; i < 8; ++i)
+                    len = (len << 8) | header[2 + i];
+                header_len = 10;
+            }
+
+            // checked before any of it is buffered, also keeps the 64-bit length from overflowing
+            const uint64_t message_len = len + (opcode == OPCODE_CONTINUATION ? m_msg_len : 0);
+            if (!control && (len > m_max_message_size || message_len > m_max_message_size))
+                return status_t::MESSAGE_TOO_BIG;
+
+            const size_t mask_offset = header_len;
+            if (masked)
+                header_len += 4;
+
+            if (available < header_len || available - header_len < len)
+            {
+                m_frame_remaining = header_len + len - available;
+                break;
+            }
+
+            char* payload = m_rx.data() + m_rx_begin + header_len;
+            if (masked)
+            {
+                // servers must not mask, but it is cheap enough to tolerate
+                const uint8_t* key = header + mask_offset;
+                for (size_t i = 0; i < len; ++i)
+                    payload[i] ^= key[i & 3];
+            }
+            m_rx_begin += header_len + len;
+
+            if (control)
+            {
+                if (m_control_hdlr && !m_control_hdlr(opcode, payload, len))
+                    status = status_t::STOPPED;
+                continue;
+            }
+
+            if (opcode == OPCODE_CONTINUATION)
+            {
+                if (!m_fragmented)
+                    return status_t::PROTOCOL_ERROR;
+
+                // append to the message being reassembled, overwriting the headers in between
+                std::memmove(m_rx.data() + m_msg_begin + m_msg_len, payload, len);
+                m_msg_len += len;
+                if (!fin)
+                    continue;
+
+                m_fragmented = false;
+                if (!deliver(m_rx.data() + m_msg_begin, m_msg_len))
+                    status = status_t::STOPPED;
+            }
+            else
+            {
+                // a new message can't start before the fragmented one is complete
+                if (m_fragmented)
+                    return status_t::PROTOCOL_ERROR;
+
+                if (!fin)
+                {
+                    m_fragmented = true;
+                    m_msg_begin  = payload - m_rx.data();
+                    m_msg_len    = len;
+                    continue;
+                }
+
+                if (!deliver(payload, len))
+                    status = status_t::STOPPED;
+            }
+        }
+
+        if (m_rx_begin == m_rx_end && !m_fragmented)
+            m_rx_begin = m_rx_end = 0;
+
+        return status;
+    }
+
+    /**
+     * Close code to fail the connection with for `status`.
+     */
+    static uint16_t close_code(status_t status)
+    {
+        return status == status_t::MESSAGE_TOO_BIG ? 1009 : 1002;
+    }
+
+private:
+    // [m_rx_begin, m_rx_end) holds received bytes not yet dispatched, a fragmented
+    // message is reassembled at [m_msg_begin, m_msg_begin + m_msg_len) in front of it
+    std::vector<char> m_rx;
+    size_t            m_rx_begin;
+    size_t            m_rx_end;
+    size_t            m_frame_remaining; // bytes still missing from a partially received frame
+    bool              m_fragmented;
+    size_t            m_msg_begin;
+    size_t            m_msg_len;
+    size_t            m_max_message_size;
+
+    message_handler_t m_message_hdlr;
+    control_handler_t m_control_hdlr;
+
+    /**
+     * Make room for at least `need` more bytes after `m_rx_end`, first by moving what is
+     * still needed to the front of the buffer and only then by growing it.
+     */
+    void ensure_space(size_t need)
+    {
+        if (write_space() >= need)
+            return;
+
+        const size_t keep_from = m_fragmented ? m_msg_begin : m_rx_begin;
+        if (keep_from > 0)
+        {
+            std::memmove(m_rx.data(), m_rx.data() + keep_from, m_rx_end - keep_from);
+            m_rx_end   -= keep_from;
+            m_rx_begin -= keep_from;
+            if (m_fragmented)
+                m_msg_begin -= keep_from;
+        }
+
+        while (write_space() < need)
+            m_rx.resize((m_rx.size() - PADDING) * 2 + PADDING);
+    }
+
+    bool deliver(char* data, size_t len)
+    {
+        // terminate in place, the byte after the payload is either the next frame's
+        // header (restored below) or part of the padding
+        const char saved = data[len];
+        data[len] = '\0';
+        const bool keep_going = !m_message_hdlr || m_message_hdlr(data, len);
+        data[len] = saved;
+        return keep_going;
+    }
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "price_matrix.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+/**
+ * Benchmark of the crossed venue scan over 500 pairs x 4 venues, full and dirty-rows-only,
+ * for each kernel. Quotes are random around a per pair mid with a few crossings.
+ */
+int main(void) {
+    constexpr size_t PAIRS  = 500;
+    constexpr size_t VENUES = 4;
+    constexpr size_t ROUNDS = 20000;
+
+    price_matrix_t matrix(PAIRS, VENUES);
+    std::mt19937_64 rng{42};
+    std::uniform_real_distribution<double> noise{-0.00052, 0.00052};
+
+    auto requote = [&](size_t pair, size_t venue) {
+        const double mid = 100.0 + pair;
+        orderbook_t::top_of_book_t top;
+        top.bid_price    = mid * (1 - 0.0005 + noise(rng));
+        top.ask_price    = mid * (1 + 0.0005 + noise(rng));
+        top.bid_quantity = 1;
+        top.ask_quantity = 1;
+        matrix.update(pair, venue, top);
+    };
+    for (size_t pair = 0; pair < PAIRS; ++pair)
+        for (size_t venue = 0; venue < VENUES; ++venue)
+            requote(pair, venue);
+
+    std::vector<crossed_venues_t> out;
+    out.reserve(PAIRS * VENUES * VENUES);
+
+    // both kernels must find the same crossings
+    size_t found = 0;
+    matrix.set_kernel(price_matrix_t::kernel_t::SCALAR);
+    const size_t expected = matrix.scan(out);
+    matrix.set_kernel(price_matrix_t::kernel_t::AVX2);
+    out.clear();
+    if ((found = matrix.scan(out)) != expected)
+    {
+        std::cout << "kernels disagree: " << found << " vs " << expected << " crossings\n";
+        return 1;
+    }
+
+    for (auto kernel : {price_matrix_t::kernel_t::SCALAR, price_matrix_t::kernel_t::AVX2})
+    {
+        matrix.set_kernel(kernel);
+        const char* name = matrix.kernel() == price_matrix_t::kernel_t::AVX2 ? "avx2" : "scalar";
+
+        auto start = std::chrono::steady_clock::now();
+        size_t total = 0;
+        for (size_t i = 0; i < ROUNDS; ++i)
+        {
+            out.clear();
+            total += matrix.scan(out);
+        }
+        auto full_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        // about 5% of the pairs change between dirty scans
+        int64_t dirty_ns = 0;
+        for (size_t i = 0; i < ROUNDS; ++i)
+        {
+            for (size_t j = 0; j < PAIRS / 20; ++j)
+                requote(rng() % PAIRS, rng() % VENUES);
+            out.clear();
+            start = std::chrono::steady_clock::now();
+            total += matrix.scan_dirty(out);
+            dirty_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        std::cout << name << ": full scan " << full_ns / ROUNDS << " ns, dirty scan " << dirty_ns / ROUNDS
+                  << " ns (" << found << " crossings, " << total << " total)\n";
+    }
+}
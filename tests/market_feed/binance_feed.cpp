@@ -12,6 +12,34 @@ int main(void) {
     market_feed<binance_api> feed (pairs,
             "bD9QfIuXXXXXXXXXXXXXXXXXXX2lb9oUyLfC2IknlE4vcIbnFKQaeSm8f0vLW8te",
             "AfqGK6JXXXXXXXXXXXXXXXXXXXXXXMlc4adhvcXeMSOSUKQEIkmIV9SmeZDu0kd5");
+    feed.set_book_ticker(true);
+
+    bar_config_t bars;
+    bars.enabled   = true;
+    bars.intervals = {std::chrono::seconds{1}, std::chrono::seconds{5}};
+    feed.set_bars(bars);
+
+    size_t bbo_updates = 0;
+    feed.register_event_handler(feed_event_t{pairs[0], feed_event_t::BBO_UPDATED}, [&bbo_updates](const orderbook_t& book) {
+            const orderbook_t::top_of_book_t top = book.top_of_book();
+            const book_signals_t signals = book.signals().latest();
+            std::cout << "bbo " << top.bid_price << " x " << top.bid_quantity << " / "
+                      << top.ask_price << " x " << top.ask_quantity << " (" << top.sequence << ")"
+                      << " micro " << signals.microprice << " imbalance " << signals.imbalance
+                      << " depth imbalance " << signals.depth_imbalance << "\n";
+            ++bbo_updates;
+            return true;
+        });
+    feed.register_event_handler(feed_event_t{pairs[0], feed_event_t::BARS_UPDATED}, [](const orderbook_t& book) {
+            for (size_t i = 0; i < book.bars().intervals(); ++i)
+            {
+                const bar_signal_t signal = book.bars().signal(i);
+                std::cout << "bar " << book.bars().series(i).interval_ms() << "ms close " << signal.bar.close
+                          << " momentum " << signal.momentum << " rsi " << signal.rsi
+                          << " vwap " << signal.vwap << (signal.ready ? "\n" : " (warming up)\n");
+            }
+            return true;
+        });
     feed.start_feed();
 
     using namespace std::chrono_literals;
@@ -19,4 +47,6 @@ int main(void) {
 
     feed.close();
     feed.join();
+
+    std::cout << bbo_updates << " best bid/offer changes\n";
 }
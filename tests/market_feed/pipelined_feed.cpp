@@ -0,0 +1,54 @@
+#include "config.h"
+// disble verbose logging
+#undef WEBSOCKET_LOGS
+#undef MESSAGE_PAYLOAD_LOG
+
+#include "exchange_api.h"
+#include "coinbase_feed.h"
+#include "binance_feed.h"
+#include <iostream>
+
+
+void print_stage_stats(const char* name, const feed_pipeline& pipeline)
+{
+    log("{} parse stage: {:d} msgs, mean {:.0f} ns, max {:d} ns, {:d} stalls", name,
+            pipeline.parse_stats.count.load(), pipeline.parse_stats.mean_ns(),
+            pipeline.parse_stats.max_ns.load(), pipeline.parse_stats.stalls.load());
+    log("{} book stage:  {:d} msgs, mean {:.0f} ns, max {:d} ns, {:d} stalls", name,
+            pipeline.book_stats.count.load(), pipeline.book_stats.mean_ns(),
+            pipeline.book_stats.max_ns.load(), pipeline.book_stats.stalls.load());
+}
+
+/**
+ * Test program that runs both feeds with the parse and book stages on their
+ * own threads for ten seconds, then prints the per-stage latencies.
+ */
+int main(void) {
+    instrument_pair_t ethusd {instrument("ETH"), instrument("USD")};
+    std::vector<instrument_pair_t> pairs;
+    pairs.emplace_back(ethusd);
+
+    pipeline_config_t config;
+    config.enabled = true;
+
+    market_feed<coinbase_api> cb_feed (pairs, "OVvF5YREXXXXXXXJ", "gXXXXXXXXXXXXXXXXXXXXXLhXgO0M6ej");
+    cb_feed.configure_pipeline(config);
+
+    market_feed<binance_api> bi_feed (pairs, "bD9QXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXC2IknlE4vcIbnFKQaeSm8f0vLW8te", "AfqGK6Jf8HQGiI93RC7jYDJMKVS9cMlc4adXXXXXXXXXXXXXXXXXXXXXXXXX0kd5");
+    bi_feed.configure_pipeline(config);
+
+    bi_feed.start_feed();
+    cb_feed.start_feed();
+
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(10s);
+
+    bi_feed.close();
+    cb_feed.close();
+
+    bi_feed.join();
+    cb_feed.join();
+
+    print_stage_stats("Binance", bi_feed.pipeline());
+    print_stage_stats("Coinbase", cb_feed.pipeline());
+}
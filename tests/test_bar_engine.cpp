@@ -0,0 +1,91 @@
+#include "bar_engine.h"
+#include "logger.h"
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+static bar_config_t test_config(bar_source_t source)
+{
+    bar_config_t config;
+    config.enabled      = true;
+    config.source       = source;
+    config.intervals    = {std::chrono::seconds{1}, std::chrono::seconds{5}};
+    config.ema_fast     = 3;
+    config.ema_slow     = 5;
+    config.stdev_period = 4;
+    config.rsi_period   = 3;
+    config.vwap_period  = 3;
+    return config;
+}
+
+int main(int argc, char** argv)
+{
+    {
+        // one-second klines roll up into the five-second interval
+        bar_engine_t engine;
+        engine.configure(test_config(bar_source_t::EXCHANGE));
+
+        int closed = 0;
+        for (int i = 0; i < 20; ++i)
+        {
+            bar_t bar;
+            bar.start_ms = 1000 * i;
+            bar.end_ms   = 1000 * i + 1000;
+            bar.open     = 100 + i;
+            bar.high     = 101 + i;
+            bar.low      = 99 + i;
+            bar.close    = 100.5 + i;
+            bar.volume   = 2;
+            bar.notional = 2 * (100.5 + i);
+            bar.trades   = 3;
+            closed += engine.on_bar(bar);
+        }
+        assert(closed == 20 && "a kline reaching the end of its bar must close it");
+
+        const bar_signal_t fast = engine.signal(0);
+        const bar_signal_t slow = engine.signal(1);
+        assert(fast.bars == 20 && slow.bars == 4 && "wrong number of closed bars");
+        assert(fast.ready && "indicators not ready after 20 bars");
+        assert(fast.bar.close == 119.5 && "wrong last close");
+        assert(fast.rsi == 100 && "steadily rising closes must give an RSI of 100");
+        assert(fast.ema_fast > fast.ema_slow && "fast EMA must lead a rising market");
+        assert(std::abs(fast.vwap - 118.5) < 1e-9 && "wrong rolling VWAP");
+
+        assert(slow.bar.start_ms == 15000 && slow.bar.end_ms == 20000 && "wrong five-second bar bounds");
+        assert(slow.bar.open == 115 && slow.bar.high == 120 && slow.bar.low == 114 && slow.bar.close == 119.5
+                && "wrong five-second OHLC");
+        assert(slow.bar.volume == 10 && slow.bar.trades == 15 && "five-second bar lost volume");
+    }
+
+    {
+        // trades close a bar when the first trade of the next interval arrives
+        bar_engine_t engine;
+        engine.configure(test_config(bar_source_t::TRADES));
+
+        const trade_t trades[] = {
+            {10, 1, true,  1, 100,  0},
+            {12, 1, true,  2, 900,  0},
+            {11, 2, false, 3, 1100, 0}
+        };
+        assert(engine.on_trades(trades, 3) && "a trade in the next interval must close the bar");
+
+        const bar_signal_t signal = engine.signal(0);
+        assert(signal.bars == 1 && "wrong number of closed bars");
+        assert(signal.bar.open == 10 && signal.bar.high == 12 && signal.bar.close == 12 && "wrong trade bar OHLC");
+        assert(signal.bar.vwap() == 11 && "wrong trade bar VWAP");
+        assert(engine.series(0).forming() && engine.series(0).forming()->close == 11 && "next bar not started");
+    }
+
+    {
+        // a disabled config drops every interval
+        bar_config_t config = test_config(bar_source_t::EXCHANGE);
+        config.enabled = false;
+        bar_engine_t engine;
+        engine.configure(config);
+        assert(engine.intervals() == 0 && "disabled engine kept its intervals");
+    }
+
+    log("bar_engine: ok");
+    return 0;
+}
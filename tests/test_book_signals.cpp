@@ -0,0 +1,45 @@
+#include "exchange_api.h"
+#include "logger.h"
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+typedef orderbook_t::level_update_t level_update_t;
+
+int main(int argc, char** argv)
+{
+    // bids 100, 99, ... with growing size, asks 101, 102, ... of 2 each
+    orderbook_t book({instrument("ETH"), instrument("USD")}, exchange_api_t::BINANCE);
+    std::vector<level_update_t> levels;
+    for (int i = 0; i < 12; ++i)
+    {
+        levels.push_back({100.0 - i, 1.0 + i, true});
+        levels.push_back({101.0 + i, 2.0, false});
+    }
+    book.process_level_updates(levels.data(), levels.size());
+    book.sync_top_of_book(0, 5);
+
+    book_signals_t signals = book.signals().latest();
+    assert(signals.updates == 2 && "wrong update count");
+    assert(signals.mid == 100.5 && signals.spread == 1 && "wrong mid");
+    assert(std::abs(signals.imbalance + 1.0 / 3) < 1e-9 && "wrong top of book imbalance");
+    assert(std::abs(signals.microprice - 100.5 + 1.0 / 6) < 1e-9 && "microprice not weighted to the thinner side");
+    assert(signals.depth == 5 && "wrong depth");
+    assert(std::abs(signals.depth_imbalance - 0.2) < 1e-9 && "wrong depth imbalance");
+    assert(signals.bid_slope > signals.ask_slope && "thicker bids must have a steeper slope");
+
+    // a level outside the tracked depth changes nothing
+    const level_update_t deep {80, 5, true};
+    book.process_level_updates(&deep, 1);
+    assert(book.signals().latest().updates == 2 && "signals updated by a level out of depth");
+
+    const level_update_t near {99, 7, true};
+    book.process_level_updates(&near, 1);
+    signals = book.signals().latest();
+    assert(signals.updates == 3 && "signals not updated by a level within depth");
+    assert(std::abs(signals.depth_imbalance - 1.0 / 3) < 1e-9 && "wrong depth imbalance after the update");
+
+    log("book_signals: ok");
+    return 0;
+}
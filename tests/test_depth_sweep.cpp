@@ -0,0 +1,43 @@
+#include "arbitrage_engine.h"
+#include "logger.h"
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    const std::vector<orderbook_t::order_t> asks {{100, 1}, {101, 2}, {103, 5}};
+    const std::vector<orderbook_t::order_t> bids {{102.5, 1.5}, {102, 1}, {100.5, 3}};
+
+    {
+        // 1@100 and 0.5@101 against 102.5, 1@101 against 102, then 101 no longer crosses 100.5
+        const depth_sweep_t sweep = sweep_crossed_depth(asks.data(), asks.size(), bids.data(), bids.size());
+        assert(sweep.quantity == 2.5 && "wrong swept quantity");
+        assert(sweep.buy_limit == 101 && sweep.sell_limit == 102 && "wrong limit prices");
+        assert(std::abs(sweep.buy_notional - 251.5) < 1e-9 && std::abs(sweep.profit() - 4.25) < 1e-9 && "wrong profit");
+    }
+
+    {
+        // a single bid level bounds the sweep
+        const depth_sweep_t sweep = sweep_crossed_depth(asks.data(), asks.size(), bids.data() + 2, 1);
+        assert(sweep.quantity == 1 && sweep.profit() == 0.5 && "wrong sweep against one level");
+    }
+
+    {
+        // with 1% fees on both legs only the first pair of levels still crosses
+        const depth_sweep_t sweep = sweep_crossed_depth(asks.data(), asks.size(), bids.data(), bids.size(), 0.01, 0.01);
+        assert(sweep.quantity == 1 && sweep.buy_limit == 100 && sweep.sell_limit == 102.5 && "fees ignored by the sweep");
+    }
+
+    {
+        // books that don't cross, or are empty, give nothing
+        const std::vector<orderbook_t::order_t> low_bids {{99.5, 10}};
+        assert(sweep_crossed_depth(asks.data(), asks.size(), low_bids.data(), low_bids.size()).quantity == 0
+                && "uncrossed books swept");
+        assert(sweep_crossed_depth(asks.data(), 0, bids.data(), bids.size()).quantity == 0 && "empty book swept");
+    }
+
+    log("depth_sweep: ok");
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "feed_arbiter.h"
+#include "logger.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// frames are "<stream>:<sequence>", anything else has no key
+static bool test_key(const char* data, size_t len, uint64_t& stream, uint64_t& sequence)
+{
+    const char* sep = std::strchr(data, ':');
+    if (!sep)
+        return false;
+    stream   = feed_arbiter::fnv1a(data, sep - data);
+    sequence = std::strtoull(sep + 1, nullptr, 10);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> forwarded;
+    feed_arbiter arbiter {test_key, [&forwarded](char* data, size_t len) {
+            forwarded.emplace_back(data, len);
+            return true;
+        }};
+    arbiter.configure(2);
+
+    auto frame = [&arbiter](size_t connection, const char* text) {
+        std::string data {text};
+        return arbiter.on_frame(connection, data.data(), data.size());
+    };
+
+    // the first copy of each frame wins, whichever connection delivers it
+    frame(0, "depth:1");
+    frame(1, "depth:1");
+    frame(1, "depth:2");
+    frame(0, "depth:2");
+    frame(0, "trade:1"); // streams are arbitrated independently
+    frame(1, "ack");     // unkeyed frames always pass
+    frame(0, "ack");
+    assert(forwarded.size() == 5 && "duplicates were forwarded");
+    assert(arbiter.stats(0).wins == 2 && arbiter.stats(1).wins == 1 && "wins miscounted");
+    assert(arbiter.stats(0).duplicates == 1 && arbiter.stats(1).duplicates == 1 && "duplicates miscounted");
+
+    // an older update arriving late is dropped as well
+    frame(1, "depth:5");
+    frame(0, "depth:4");
+    assert(forwarded.back() == "depth:5" && "stale update was forwarded");
+
+    // both connections lost: the streams start over from lower sequences, which would all be
+    // taken as stale copies without a reset
+    frame(0, "depth:3");
+    assert(forwarded.back() == "depth:5" && "restarted stream forwarded before the reset");
+    arbiter.reset();
+    const size_t before = forwarded.size();
+    frame(0, "depth:3");
+    frame(1, "depth:3");
+    frame(1, "depth:4");
+    frame(0, "depth:4");
+    assert(forwarded.size() == before + 2 && "restarted stream not arbitrated after the reset");
+    assert(forwarded.back() == "depth:4" && "restarted stream forwarded out of order");
+
+    // a single connection is passed through untouched
+    arbiter.configure(1);
+    forwarded.clear();
+    frame(0, "depth:1");
+    frame(0, "depth:1");
+    assert(forwarded.size() == 2 && "single connection was arbitrated");
+
+    log("feed_arbiter: ok");
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "arbitrage_engine.h"
+#include "logger.h"
+
+#include <cassert>
+#include <map>
+#include <random>
+
+int main(int argc, char** argv)
+{
+    {
+        // 100ns cooldown, forgotten after 300ns
+        opportunity_cache_t cache {16, 100, 300};
+        const opportunity_key_t key {1, 0, 1, 100.0, 101.0};
+        assert(cache.admit(key, 0) && "new crossing suppressed");
+        assert(!cache.admit(key, 50) && "crossing admitted during its cooldown");
+        assert(cache.admit(key, 100) && "crossing suppressed after its cooldown");
+        assert(!cache.admit(key, 150) && !cache.admit(key, 199) && "crossing admitted during its cooldown");
+        assert(cache.admit(key, 200) && "crossing suppressed after its cooldown");
+
+        opportunity_key_t moved = key;
+        moved.sell_price = 101.5;
+        assert(cache.admit(moved, 201) && "crossing at a new price suppressed");
+
+        assert(cache.admit(key, 1000) && "forgotten crossing suppressed");
+        assert(cache.suppressed() == 3 && "wrong suppressed count");
+    }
+
+    {
+        // a table far smaller than the number of keys never admits a key during its cooldown
+        opportunity_cache_t cache {4, 10, 30};
+        std::map<uint32_t, int64_t> admitted;
+        std::mt19937 rng {3};
+        int64_t now = 0;
+        for (int i = 0; i < 100000; ++i)
+        {
+            now += rng() % 3;
+            const uint32_t id = rng() % 20;
+            const opportunity_key_t key {id, 0, 1, 1.0 * id, 2.0};
+            if (cache.admit(key, now))
+                admitted[id] = now;
+            else
+                assert(admitted.count(id) && now - admitted[id] < 10 && "key suppressed outside its cooldown");
+        }
+    }
+
+    {
+        // the engine reports a crossing again once its prices move or its cooldown expires
+        arbitrage_config_t config;
+        config.cooldown_ns = 1000;
+        arbitrage_engine_t engine {config};
+        const uint32_t pair = engine.add_pair({instrument("ETH"), instrument("USD")});
+        size_t reported = 0;
+        engine.set_handler([&reported](const arbitrage_opportunity_t&) { ++reported; });
+
+        orderbook_t::top_of_book_t low;
+        low.bid_price = 99;  low.bid_quantity = 1; low.ask_price = 100; low.ask_quantity = 1; low.recv_ns = 0;
+        orderbook_t::top_of_book_t high;
+        high.bid_price = 101; high.bid_quantity = 1; high.ask_price = 102; high.ask_quantity = 1; high.recv_ns = 10;
+
+        engine.on_quote(pair, exchange_api_t::COINBASE_ADVANCED, low);
+        engine.on_quote(pair, exchange_api_t::BINANCE, high);
+        assert(reported == 1 && "crossing not reported");
+
+        high.recv_ns = 20;
+        high.bid_quantity = 2;
+        engine.on_quote(pair, exchange_api_t::BINANCE, high);
+        assert(reported == 1 && "same crossing reported during its cooldown");
+
+        high.recv_ns = 30;
+        high.bid_price = 101.5;
+        engine.on_quote(pair, exchange_api_t::BINANCE, high);
+        assert(reported == 2 && "crossing at a new price suppressed");
+
+        high.recv_ns = 2000;
+        engine.on_quote(pair, exchange_api_t::BINANCE, high);
+        assert(reported == 3 && "crossing suppressed after its cooldown");
+        assert(engine.suppressed() == 1 && "wrong suppressed count");
+    }
+
+    log("opportunity_cache: ok");
+    return 0;
+}
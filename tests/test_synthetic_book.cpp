@@ -0,0 +1,75 @@
+#include "synthetic_book.h"
+#include "logger.h"
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+typedef orderbook_t::level_update_t level_update_t;
+
+static bool near(double a, double b)
+{
+    return std::abs(a - b) <= 1e-9 * std::abs(b);
+}
+
+int main(int argc, char** argv)
+{
+    const instrument ETH("ETH"), BTC("BTC"), USD("USD");
+
+    orderbook_t eth_usd({ETH, USD}, exchange_api_t::BINANCE);
+    std::vector<level_update_t> eth_levels {{2000, 1, true}, {1999, 2, true}, {2001, 1, false}, {2002, 3, false}};
+    eth_usd.process_level_updates(eth_levels.data(), eth_levels.size());
+
+    orderbook_t btc_usd({BTC, USD}, exchange_api_t::BINANCE);
+    std::vector<level_update_t> btc_levels {{40000, 0.1, true}, {39990, 1, true}, {40010, 0.02, false}, {40020, 1, false}};
+    btc_usd.process_level_updates(btc_levels.data(), btc_levels.size());
+
+    synthetic_cross_feed cross({ETH, BTC}, {ETH, USD}, {BTC, USD}, 5);
+    assert(cross.book().exchange == exchange_api_t::SYNTHETIC && "synthetic book on a native venue");
+
+    int events = 0;
+    cross.register_event_handler(feed_event_t({ETH, BTC}, feed_event_t::BBO_UPDATED),
+                                 [&events](const orderbook_t&) { ++events; return true; });
+
+    assert(!cross.on_leg(eth_usd) && "book built with one leg empty");
+    assert(cross.on_leg(btc_usd) && "book not built once both legs are quoted");
+    assert(events == 1 && "BBO event not fired");
+
+    // sell ETH at 2000 USD and buy BTC at 40010, limited by the 0.02 BTC offered there
+    orderbook_t::top_of_book_t top = cross.book().top_of_book();
+    assert(near(top.bid_price, 2000 / 40010.0) && near(top.bid_quantity, 0.4001) && "wrong synthetic bid");
+    // buy ETH at 2001 USD paid by selling BTC at 40000
+    assert(near(top.ask_price, 2001 / 40000.0) && near(top.ask_quantity, 1) && "wrong synthetic ask");
+
+    std::vector<orderbook_t::order_t> bids;
+    cross.book().copy_guarded_bids(bids);
+    assert(bids.size() == 3 && near(bids[1].first, 2000 / 40020.0) && near(bids[1].second, 0.5999)
+            && near(bids[2].first, 1999 / 40020.0) && near(bids[2].second, 2) && "wrong synthetic depth");
+
+    assert(!cross.on_leg(btc_usd) && "unchanged leg rebuilt the book");
+
+    // a deeper level changes the depth but not the top
+    const level_update_t deeper {1999, 5, true};
+    eth_usd.process_level_updates(&deeper, 1);
+    assert(cross.on_leg(eth_usd) && "changed leg ignored");
+    assert(events == 1 && "BBO event fired without a top change");
+    cross.book().copy_guarded_bids(bids);
+    assert(bids.size() == 3 && near(bids[2].second, 5) && "deeper level not applied");
+
+    // the same leg quoted the other way round gives the same book
+    orderbook_t usd_btc({USD, BTC}, exchange_api_t::BINANCE);
+    std::vector<level_update_t> inverted {{1 / 40010.0, 0.02 * 40010, true}, {1 / 40020.0, 40020, true},
+                                          {1 / 40000.0, 0.1 * 40000, false}, {1 / 39990.0, 39990, false}};
+    usd_btc.process_level_updates(inverted.data(), inverted.size());
+
+    synthetic_cross_feed inverted_cross({ETH, BTC}, {ETH, USD}, {USD, BTC}, 5);
+    inverted_cross.on_leg(eth_usd);
+    inverted_cross.on_leg(usd_btc);
+    const orderbook_t::top_of_book_t inverted_top = inverted_cross.book().top_of_book();
+    assert(near(inverted_top.bid_price, top.bid_price) && near(inverted_top.bid_quantity, top.bid_quantity)
+            && near(inverted_top.ask_price, top.ask_price) && near(inverted_top.ask_quantity, top.ask_quantity)
+            && "inverted leg gives a different book");
+
+    log("synthetic_book: ok");
+    return 0;
+}
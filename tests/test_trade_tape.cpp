@@ -0,0 +1,58 @@
+#include "trade_tape.h"
+#include "logger.h"
+
+#include <cassert>
+#include <chrono>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    // a trade every 10ms, the last one at 99.99s
+    std::vector<trade_t> trades;
+    for (int i = 0; i < 10000; ++i)
+        trades.push_back(trade_t{100.0 + i % 3, 1.0, i % 2 == 0, i, static_cast<int64_t>(i) * 10, 0});
+
+    {
+        trade_tape_t tape;
+        tape.configure({std::chrono::seconds{1}, std::chrono::seconds{10}});
+        tape.add(trades.data(), trades.size());
+
+        trade_flow_t flow = tape.flow();
+        assert(flow.total_trades == 10000 && "trades lost");
+        assert(flow.windows[0].trades == 100 && flow.windows[1].trades == 1000 && "wrong window counts");
+        assert(flow.windows[0].volume() == 100 && flow.windows[0].imbalance() == 0 && "wrong window volume");
+        assert(!flow.windows[0].truncated && !flow.windows[1].truncated && "windows within the tape truncated");
+        assert(tape.size() == trade_tape_t::TAPE_SIZE && tape.recent(0).trade_id == 9999 && "wrong tape contents");
+
+        // quiet market: the windows decay on the receive time of later updates
+        assert(!tape.advance(0) && "nothing should expire without time passing");
+        assert(tape.advance(500000000) && "half a second must expire trades");
+        flow = tape.flow();
+        assert(flow.windows[0].trades == 50 && flow.windows[1].trades == 950 && "wrong counts after advancing");
+
+        assert(tape.advance(200000000000) && "200s must expire every trade");
+        flow = tape.flow();
+        assert(flow.windows[0].trades == 0 && flow.windows[1].trades == 0 && flow.windows[0].volume() == 0
+                && "windows not emptied");
+        assert(flow.total_trades == 10000 && "total count must survive expiry");
+    }
+
+    {
+        // a window longer than the tape only covers what the tape holds
+        trade_tape_t tape;
+        tape.configure({std::chrono::seconds{100}});
+        tape.add(trades.data(), trades.size());
+        const trade_flow_t flow = tape.flow();
+        assert(flow.windows[0].trades == trade_tape_t::TAPE_SIZE && flow.windows[0].truncated
+                && "window past the tape not flagged");
+    }
+
+    {
+        trade_tape_t tape;
+        tape.configure({std::chrono::milliseconds{10}});
+        assert(!tape.advance(123) && "empty tape advanced");
+    }
+
+    log("trade_tape: ok");
+    return 0;
+}
@@ -7,30 +7,24 @@
 #include "exchange_api.h"
 #include "coinbase_feed.h"
 #include "binance_feed.h"
+#include "trader.h"
+#include "lead_lag.h"
 
 #include <iostream>
 #include <chrono>
+#include <mutex>
 #include <unordered_map>
 
 
-template <>
-struct std::hash<std::tuple<exchange_api_t, exchange_api_t, double, double>>
-{
-    size_t operator()(const std::tuple<exchange_api_t, exchange_api_t, double, double>& key) const noexcept {
-        // quick-and-dirty hash function
-       return static_cast<size_t>(std::get<0>(key))
-              ^ static_cast<size_t>(std::get<1>(key))
-              ^ std::hash<double>{}(std::get<2>(key))
-              ^ std::hash<double>{}(std::get<3>(key));
-    }
-};
-
-
 class TestTrader 
 {
     typedef std::unordered_map<exchange_api_t, std::pair<std::vector<orderbook_t::order_t>,std::vector<orderbook_t::order_t>>>
         map_t;
+    // books of different exchanges come from different feed threads
+    std::mutex m_mutex;
     map_t m_guarded_book;
+    // only log a trade again if it is still there a second later
+    opportunity_cache_t m_logged {256, 1'000'000'000, 5'000'000'000};
 
 
 public:
@@ -38,92 +32,35 @@ public:
     {}
 
 
-    void find_max_profit_ask(exchange_api_t source_id, orderbook_t::order_t source_bid,
-            exchange_api_t target_id, const std::vector<orderbook_t::order_t>& target_asks)
-    {
-        double max_profit = 0;
-        std::vector<orderbook_t::order_t>::const_iterator target_order;
-        for (auto target_it = target_asks.begin(); target_it != target_asks.end(); ++target_it)
-        {
-            auto [target_price, target_quantity] = *target_it;
-            if (target_price > source_bid.first )
-                break;
-            const double diff = source_bid.first - target_price;
-            const double min_quantity = std::min(source_bid.second, target_quantity);
-            const double profit = min_quantity * diff;
-            // log("[{} -> {}] {:.1e} @ {:.1e} -> {:.1e} @ {:.1e}; {:f}",
-            //         exchange_api::to_string(source_id),
-            //         exchange_api::to_string(target_id),
-            //         target_price, target_quantity,
-            //         source_bid.first, source_bid.second,
-            //         profit);
-            if (profit > max_profit)
-            {
-                target_order = target_it;
-                max_profit = profit;
-            }
-
-        }
-
-        if (max_profit > 0)
-        {
-            log("Maximum profit ask: $ {:f}, ({} -> {}) {:f} @ {:.5e} [${:.2f}] -> {:f} @ {:.5e} [${:.2f}]",
-                    max_profit,
-                    exchange_api::to_string(target_id),
-                    exchange_api::to_string(source_id),
-                    target_order->first, target_order->second,
-                    target_order->first * target_order->second,
-                    source_bid.first, source_bid.second,
-                    source_bid.first*source_bid.second);
-        }
-    }
-
-    void find_max_profit_bid(exchange_api_t source_id, orderbook_t::order_t source_ask,
-            exchange_api_t target_id, const std::vector<orderbook_t::order_t>& bids)
+    /**
+     * Buy across `asks` of `buy_id` and sell across `bids` of `sell_id`, as far as they cross.
+     */
+    void find_max_profit(exchange_api_t buy_id, const std::vector<orderbook_t::order_t>& asks,
+            exchange_api_t sell_id, const std::vector<orderbook_t::order_t>& bids)
     {
-        double max_profit = 0;
-        std::vector<orderbook_t::order_t>::const_iterator target_order;
-        for (auto target_it = bids.cbegin(); target_it != bids.cend(); ++target_it)
-        {
-            auto [target_price, target_quantity] = *target_it;
-            if (source_ask.first > target_price)
-                break;
-            const double diff = target_price - source_ask.first;
-            const double min_quantity = std::min(source_ask.second, target_quantity);
-            const double profit = min_quantity * diff;
-            // log("[{} -> {}] {:.1e} @ {:.1e} -> {:.1e} @ {:.1e}; {:f}",
-            //         exchange_api::to_string(source_id),
-            //         exchange_api::to_string(target_id),
-            //         source_ask.first, source_ask.second,
-            //         target_price, target_quantity,
-            //         profit);
-            if (profit > max_profit)
-            {
-                target_order = target_it;
-                max_profit = profit;
-            }
-
-        }
-        // NOTE: need to think about how to about duplicates
-
-        if (max_profit > 0)
-        {
-            log("Maximum profit bid: $ {:f}, ({} -> {}) {:f} @ {:.5e} [${:.2f}]-> {:f} @ {:.5e} [${:.2f}]",
-                    max_profit,
-                    exchange_api::to_string(source_id),
-                    exchange_api::to_string(target_id),
-                    source_ask.first, source_ask.second,
-                    source_ask.first * source_ask.second,
-                    target_order->first, target_order->second,
-                    target_order->first * target_order->second);
-        }
-
+        const depth_sweep_t sweep = sweep_crossed_depth(asks.data(), asks.size(), bids.data(), bids.size());
+        if (sweep.quantity <= 0)
+            return;
+
+        const opportunity_key_t key {0, static_cast<uint16_t>(buy_id), static_cast<uint16_t>(sell_id),
+                                     sweep.buy_limit, sweep.sell_limit};
+        if (!m_logged.admit(key, steady_now_ns()))
+            return;
+
+        log("Maximum profit: $ {:f}, ({} -> {}) {:f} up to {:.5e} [${:.2f}] -> up to {:.5e} [${:.2f}]",
+                sweep.profit(),
+                exchange_api::to_string(buy_id),
+                exchange_api::to_string(sell_id),
+                sweep.quantity,
+                sweep.buy_limit, sweep.buy_notional,
+                sweep.sell_limit, sweep.sell_notional);
     }
 
     bool feed_event_handler(const orderbook_t& book)
     {
         // log("feed_event_handler {} {}", exchange_api::to_string(book.exchange),
         //     instrument_pair::to_coinbase(book.pair));
+        std::lock_guard<std::mutex> lock{m_mutex};
         // copy over updated guarded bids/asks from orderbook 
         auto& [source_bids, source_asks] = m_guarded_book[book.exchange];
         book.copy_guarded_bids(source_bids);
@@ -137,12 +74,10 @@ public:
             auto& [target_bids, target_asks] = map_it->second;
 
             // selling to book.exchange exchange and buying from other exchange
-            if (source_bids.size() > 0)
-                find_max_profit_ask(book.exchange, source_bids[0], map_it->first, target_asks);
+            find_max_profit(map_it->first, target_asks, book.exchange, source_bids);
 
             // buying from book.exchange exchange and selling to other exchange
-            if (source_asks.size() > 0)
-                find_max_profit_bid(book.exchange, source_asks[0], map_it->first, target_bids);
+            find_max_profit(book.exchange, source_asks, map_it->first, target_bids);
         }
 
         return true;
@@ -153,7 +88,7 @@ public:
 /**
  * test program to print out profitables arbritrage trades between exchanges for 10 seconds then quits.
  * format:
- *     Maximum profit <bid|ask>: <max profit> (<exchange A> -> <exchange B>) <price> @ <quantity> -> <price> @ <quantity>
+ *     Maximum profit: <max profit> (<exchange A> -> <exchange B>) <quantity> up to <price> [<notional>] -> up to <price> [<notional>]
  *
  *  To execute on the arbritrage trade, you'd match the ask order on the exchange A (by submitting a bid order)
  *  and match the bid order on exchange B by submitting a sell order.
@@ -173,6 +108,30 @@ int main(void) {
     bi_feed.register_event_handler(feed_event_t(t_pair, feed_event_t::ORDERS_UPDATED),
             std::bind(&TestTrader::feed_event_handler, &trader, std::placeholders::_1));
 
+    arbitrage_config_t arbitrage_config;
+    arbitrage_config.cooldown_ns = 1'000'000'000;
+    ArbritrageTrader<market_feed<binance_api>> arbitrage(t_pair, arbitrage_config);
+    size_t opportunities = 0;
+    arbitrage.set_opportunity_handler([&opportunities](const arbitrage_opportunity_t& opportunity) {
+            log("Crossed: $ {:f}, ({} -> {}) {:f} @ {:.5e} -> {:f} @ {:.5e}",
+                    opportunity.profit,
+                    exchange_api::to_string(opportunity.buy_exchange),
+                    exchange_api::to_string(opportunity.sell_exchange),
+                    opportunity.buy_quantity, opportunity.buy_price,
+                    opportunity.sell_quantity, opportunity.sell_price);
+            ++opportunities;
+        });
+    cb_feed.register_event_handler(feed_event_t(t_pair, feed_event_t::BBO_UPDATED),
+            std::bind(&ArbritrageTrader<market_feed<binance_api>>::feed_event_handler, &arbitrage, std::placeholders::_1));
+    bi_feed.register_event_handler(feed_event_t(t_pair, feed_event_t::BBO_UPDATED),
+            std::bind(&ArbritrageTrader<market_feed<binance_api>>::feed_event_handler, &arbitrage, std::placeholders::_1));
+
+    lead_lag_monitor_t lead_lag(exchange_api_t::COINBASE_ADVANCED, exchange_api_t::BINANCE);
+    cb_feed.register_event_handler(feed_event_t(t_pair, feed_event_t::BBO_UPDATED),
+            std::bind(&lead_lag_monitor_t::feed_event_handler, &lead_lag, std::placeholders::_1));
+    bi_feed.register_event_handler(feed_event_t(t_pair, feed_event_t::BBO_UPDATED),
+            std::bind(&lead_lag_monitor_t::feed_event_handler, &lead_lag, std::placeholders::_1));
+
     bi_feed.start_feed();
     cb_feed.start_feed();
 
@@ -185,4 +144,13 @@ int main(void) {
 
     bi_feed.join();
     cb_feed.join();
+
+    const lead_lag_stats_t stats = lead_lag.stats();
+    log("Lead/lag over {} buckets of {}ms: strongest correlation {:.3f} at lag {} ({} leads)",
+            stats.buckets, stats.bucket_ms, stats.at_lag(stats.best_lag), stats.best_lag,
+            stats.best_lag > 0 ? "binance" : stats.best_lag < 0 ? "coinbase" : "neither");
+    log("Binance - Coinbase mid spread: mean {:.2f}bps, p05 {:.2f}, p50 {:.2f}, p95 {:.2f}",
+            stats.spread_mean, stats.spread_p05, stats.spread_p50, stats.spread_p95);
+
+    std::cout << opportunities << " crossed markets, " << arbitrage.engine().suppressed() << " repeats held back\n";
 }
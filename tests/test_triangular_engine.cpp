@@ -0,0 +1,49 @@
+#include "triangular_engine.h"
+#include "logger.h"
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    triangular_config_t config;
+    config.taker_fee = 0.001;
+    triangular_engine_t engine(exchange_api_t::BINANCE, config);
+
+    const uint32_t eth_usd = engine.add_pair({instrument("ETH"), instrument("USD")});
+    const uint32_t btc_usd = engine.add_pair({instrument("BTC"), instrument("USD")});
+    assert(engine.cycles() == 0 && "cycle found with two pairs");
+    const uint32_t eth_btc = engine.add_pair({instrument("ETH"), instrument("BTC")});
+    assert(engine.cycles() == 2 && "a triangle must give one cycle per direction");
+    assert(engine.add_pair({instrument("ETH"), instrument("BTC")}) == eth_btc && "pair added twice");
+
+    std::vector<triangular_opportunity_t> found;
+    engine.set_handler([&found](const triangular_opportunity_t& opportunity) { found.push_back(opportunity); });
+
+    // ETH/BTC at its fair price of about 0.06667 leaves nothing after fees
+    engine.on_quote(eth_usd, {2000, 1, 2000.5, 1, 0, 0});
+    engine.on_quote(btc_usd, {30000, 0.1, 30001, 0.1, 0, 0});
+    engine.on_quote(eth_btc, {0.0666, 5, 0.06661, 5, 0, 0});
+    assert(found.empty() && "fair prices reported as a cycle");
+
+    // ETH offered cheap in BTC: sell ETH for USD, buy BTC, buy the ETH back
+    assert(engine.on_quote(eth_btc, {0.0659, 5, 0.066, 5, 0, 0}) == 1 && "cheap ETH/BTC not found");
+    assert(found.size() == 1 && "handler not called");
+
+    const triangular_opportunity_t& cycle = found[0];
+    assert(cycle.exchange == exchange_api_t::BINANCE && cycle.start == instrument("ETH") && "wrong cycle start");
+    assert(std::abs(cycle.expected_return - 0.00704) < 1e-5 && "wrong expected return");
+    assert(cycle.legs[0].pair_id == eth_usd && cycle.legs[0].sell_base && cycle.legs[0].limit_price == 2000
+            && "wrong first leg");
+    assert(cycle.legs[1].pair_id == btc_usd && !cycle.legs[1].sell_base && cycle.legs[1].limit_price == 30001
+            && "wrong second leg");
+    assert(cycle.legs[2].pair_id == eth_btc && !cycle.legs[2].sell_base && cycle.legs[2].limit_price == 0.066
+            && "wrong third leg");
+    for (size_t i = 1; i < 3; ++i)
+        assert(cycle.legs[i].amount_in == cycle.legs[i - 1].amount_out && "legs don't chain");
+    assert(cycle.legs[2].amount_out > cycle.start_amount && "cycle doesn't return more than it starts with");
+
+    log("triangular_engine: ok");
+    return 0;
+}
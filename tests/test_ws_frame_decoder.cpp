@@ -0,0 +1,212 @@
+#include "ws_frame_decoder.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+typedef ws_frame_decoder::status_t status_t;
+
+// unmasked server frame, `len_form` forces the 16/64-bit length encodings
+static std::string frame(uint8_t opcode, const std::string& payload, bool fin = true, int len_form = 0)
+{
+    std::string out;
+    out.push_back(static_cast<char>((fin ? 0x80 : 0) | opcode));
+    const uint64_t len = payload.size();
+    if (len_form == 127 || len > 0xffff)
+    {
+        out.push_back(127);
+        for (int shift = 56; shift >= 0; shift -= 8)
+            out.push_back(static_cast<char>((len >> shift) & 0xff));
+    }
+    else if (len_form == 126 || len >= 126)
+    {
+        out.push_back(126);
+        out.push_back(static_cast<char>(len >> 8));
+        out.push_back(static_cast<char>(len & 0xff));
+    }
+    else
+    {
+        out.push_back(static_cast<char>(len));
+    }
+    return out + payload;
+}
+
+struct recorder_t
+{
+    ws_frame_decoder         decoder;
+    std::vector<std::string> messages;
+    std::vector<std::string> controls;
+
+    recorder_t(size_t initial_size = ws_frame_decoder::INITIAL_BUFFER_SIZE)
+        : decoder{initial_size}, messages{}, controls{}
+    {
+        decoder.set_handlers(
+                [this](char* data, size_t len) {
+                    assert(data[len] == '\0' && "message not terminated");
+                    messages.emplace_back(data, len);
+                    return true;
+                },
+                [this](uint8_t opcode, const char* data, size_t len) {
+                    controls.push_back(std::to_string(opcode) + ":" + std::string{data, len});
+                    return true;
+                });
+    }
+
+    // feed `bytes` in reads of at most `chunk` bytes, as the socket would
+    status_t feed(const std::string& bytes, size_t chunk = SIZE_MAX)
+    {
+        status_t status = status_t::OK;
+        for (size_t pos = 0; pos < bytes.size() && status == status_t::OK; )
+        {
+            decoder.prepare();
+            const size_t n = std::min({chunk, bytes.size() - pos, decoder.write_space()});
+            std::memcpy(decoder.write_ptr(), bytes.data() + pos, n);
+            decoder.commit(n);
+            pos += n;
+            status = decoder.dispatch();
+        }
+        return status;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    {
+        // several frames in one read, all three length forms
+        recorder_t r;
+        const std::string mid(300, 'm');
+        const std::string big(70000, 'b');
+        const status_t status = r.feed(frame(0x1, "small") + frame(0x1, mid) + frame(0x2, big)
+                + frame(0x1, "forced-16", true, 126) + frame(0x1, "forced-64", true, 127));
+        assert(status == status_t::OK && "valid frames rejected");
+        assert(r.messages.size() == 5 && "frames lost");
+        assert(r.messages[0] == "small" && r.messages[1] == mid && r.messages[2] == big && "payload mismatch");
+        assert(r.messages[3] == "forced-16" && r.messages[4] == "forced-64" && "extended length forms misread");
+        assert(r.decoder.pending().empty() && "bytes left over");
+    }
+
+    {
+        // fragmented message with control frames in between, fed one byte per read
+        recorder_t r;
+        const std::string bytes = frame(0x1, "frag", false) + frame(0x9, "p1") + frame(0x0, "men", false)
+                + frame(0xa, "p2") + frame(0x0, "ted");
+        assert(r.feed(bytes, 1) == status_t::OK && "fragmented message rejected");
+        assert(r.messages.size() == 1 && r.messages[0] == "fragmented" && "fragments not reassembled");
+        assert(r.controls.size() == 2 && r.controls[0] == "9:p1" && r.controls[1] == "10:p2" && "control frames lost");
+    }
+
+    {
+        // partial reads across a frame boundary never deliver early
+        recorder_t r;
+        const std::string bytes = frame(0x1, std::string(1000, 'x')) + frame(0x1, "tail");
+        assert(r.feed(bytes.substr(0, 600)) == status_t::OK && r.messages.empty() && "partial frame delivered");
+        assert(r.feed(bytes.substr(600)) == status_t::OK && r.messages.size() == 2 && "frame lost across reads");
+        assert(r.messages[1] == "tail" && "payload mismatch after a partial read");
+    }
+
+    {
+        // a message larger than the buffer is reassembled while the buffer grows under it
+        recorder_t r {64};
+        std::string bytes;
+        std::string expected;
+        for (int i = 0; i < 300; ++i)
+        {
+            const std::string part(1000, static_cast<char>('a' + i % 26));
+            bytes += frame(i == 0 ? 0x1 : 0x0, part, i == 299) + frame(0x9, "");
+            expected += part;
+        }
+        bytes += frame(0x1, "after");
+        assert(r.feed(bytes, 4093) == status_t::OK && "large fragmented message rejected");
+        assert(r.messages.size() == 2 && r.messages[0] == expected && r.messages[1] == "after"
+                && "large message corrupted while the buffer grew");
+        assert(r.controls.size() == 300 && "control frames lost while the buffer grew");
+    }
+
+    {
+        // a steady stream of small messages is compacted in place instead of growing the buffer
+        recorder_t r {64};
+        std::string bytes;
+        for (int i = 0; i < 20000; ++i)
+            bytes += frame(0x1, std::to_string(i) + std::string(100, 'x'));
+        assert(r.feed(bytes, 4093) == status_t::OK && "message stream rejected");
+        assert(r.messages.size() == 20000 && r.messages.back() == "19999" + std::string(100, 'x')
+                && "messages corrupted by compaction");
+        assert(r.decoder.capacity() <= 4 * ws_frame_decoder::READ_CHUNK && "buffer grew instead of compacting");
+    }
+
+    {
+        // masked frames are tolerated
+        recorder_t r;
+        std::string bytes {"\x81\x84", 2};
+        const char key[4] = {0x11, 0x22, 0x33, 0x44};
+        bytes.append(key, 4);
+        const char* text = "mask";
+        for (int i = 0; i < 4; ++i)
+            bytes.push_back(text[i] ^ key[i]);
+        assert(r.feed(bytes) == status_t::OK && r.messages.size() == 1 && r.messages[0] == "mask" && "masked frame misread");
+    }
+
+    {
+        // protocol violations
+        for (uint8_t opcode : {0x3, 0x7, 0xb, 0xf})
+        {
+            recorder_t r;
+            assert(r.feed(frame(opcode, "x")) == status_t::PROTOCOL_ERROR && "reserved opcode accepted");
+        }
+        for (uint8_t rsv : {0x40, 0x20, 0x10})
+        {
+            recorder_t r;
+            std::string bytes = frame(0x1, "x");
+            bytes[0] = static_cast<char>(bytes[0] | rsv);
+            assert(r.feed(bytes) == status_t::PROTOCOL_ERROR && "RSV bit accepted");
+        }
+
+        recorder_t stray;
+        assert(stray.feed(frame(0x0, "x")) == status_t::PROTOCOL_ERROR && "stray continuation accepted");
+
+        recorder_t interleaved;
+        assert(interleaved.feed(frame(0x1, "a", false) + frame(0x1, "b")) == status_t::PROTOCOL_ERROR
+                && "data frame inside a fragmented message accepted");
+
+        recorder_t fragmented_control;
+        assert(fragmented_control.feed(frame(0x9, "p", false)) == status_t::PROTOCOL_ERROR && "fragmented ping accepted");
+
+        recorder_t long_control;
+        assert(long_control.feed(frame(0x9, std::string(126, 'p'))) == status_t::PROTOCOL_ERROR && "oversized ping accepted");
+
+        assert(ws_frame_decoder::close_code(status_t::PROTOCOL_ERROR) == 1002 && "wrong close code");
+    }
+
+    {
+        // oversized messages fail before their payload is buffered
+        recorder_t r;
+        r.decoder.set_max_message_size(1000);
+        assert(r.feed(frame(0x1, std::string(1000, 'x'))) == status_t::OK && "message at the limit rejected");
+
+        std::string huge = frame(0x1, "", true, 127);
+        huge[2] = 0x7f; // close to 2^63, just the header
+        assert(r.feed(huge) == status_t::MESSAGE_TOO_BIG && "64-bit length accepted");
+        assert(r.decoder.capacity() < 1 << 21 && "buffer grown for an oversized message");
+
+        recorder_t fragments;
+        fragments.decoder.set_max_message_size(1000);
+        assert(fragments.feed(frame(0x1, std::string(600, 'x'), false) + frame(0x0, std::string(600, 'x')))
+                == status_t::MESSAGE_TOO_BIG && "oversized fragmented message accepted");
+        assert(ws_frame_decoder::close_code(status_t::MESSAGE_TOO_BIG) == 1009 && "wrong close code");
+    }
+
+    {
+        // a handler asking to stop ends the dispatch, the rest stays buffered
+        recorder_t r;
+        r.decoder.set_handlers([&r](char* data, size_t len) { r.messages.emplace_back(data, len); return false; }, {});
+        assert(r.feed(frame(0x1, "one") + frame(0x1, "two")) == status_t::STOPPED && "stop request ignored");
+        assert(r.messages.size() == 1 && !r.decoder.pending().empty() && "dispatched past a stop request");
+    }
+
+    log("ws_frame_decoder: ok");
+    return 0;
+}